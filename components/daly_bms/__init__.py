@@ -1,54 +1,411 @@
+import hashlib
+
 from esphome import automation
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import uart
-from esphome.const import CONF_ID, CONF_ADDRESS, CONF_TRIGGER_ID
+from esphome.components.logger import LOG_LEVEL_SEVERITY
+from esphome.const import (
+    CONF_ID,
+    CONF_LEVEL,
+    CONF_LOGS,
+    CONF_STATE,
+    CONF_ADDRESS,
+    CONF_PROTOCOL,
+    CONF_SIZE,
+    CONF_TRIGGER_ID,
+    CONF_UART_ID,
+    CONF_UPDATE_INTERVAL,
+)
+from esphome.core import CORE
+import esphome.final_validate as fv
 
 MULTI_CONF = True
 CODEOWNERS = ["@s1lvi0"]
 DEPENDENCIES = ["uart"]
 
 CONF_BMS_DALY_ID = "bms_daly_id"
+CONF_DALY_BMS_BUS_ID = "daly_bms_bus_id"
 CONF_ON_FAILURE_STATUS = "on_failure_status"
+CONF_ON_WRITE_COMPLETE = "on_write_complete"
+CONF_SOC = "soc"
+CONF_ENERGY_SAVE_INTERVAL = "energy_save_interval"
+CONF_CELL_UPDATE_INTERVAL = "cell_update_interval"
+CONF_THRESHOLD_UPDATE_INTERVAL = "threshold_update_interval"
+CONF_DIAGNOSTIC_UPDATE_INTERVAL = "diagnostic_update_interval"
+CONF_LOCAL_MIN_MAX = "local_min_max"
+CONF_ACTIVE_UPDATE_INTERVAL = "active_update_interval"
+CONF_CURRENT_STEP = "current_step"
+CONF_HISTORY = "history"
+CONF_CAPTURE = "capture"
+# must match CAPTURE_TAG in daly_bms_bus.cpp
+CAPTURE_TAG = "daly_bms.capture"
+CONF_CELL_ANALYTICS = "cell_analytics"
+CONF_TIME_CONSTANT = "time_constant"
+CONF_PUBLISH_INTERVAL = "publish_interval"
+PROTOCOL_DALY = "daly"
+PROTOCOL_MODBUS = "modbus"
+CONF_BATCH_SIZE = "batch_size"
+
+# must match DALY_HISTORY_BLOCK_SIZE
+HISTORY_BLOCK_SIZE = 256
 
 daly_bms = cg.esphome_ns.namespace("daly_bms")
-DalyBmsComponent = daly_bms.class_(
-    "DalyBmsComponent", cg.PollingComponent, uart.UARTDevice
-)
+DalyBmsComponent = daly_bms.class_("DalyBmsComponent", cg.PollingComponent)
+DalyBmsBus = daly_bms.class_("DalyBmsBus", cg.Component, uart.UARTDevice)
+
+DalyProtocol = daly_bms.enum("DalyProtocol")
+PROTOCOLS = {
+    PROTOCOL_DALY: DalyProtocol.DALY_PROTOCOL_DALY,
+    PROTOCOL_MODBUS: DalyProtocol.DALY_PROTOCOL_MODBUS,
+}
 
+DalyFailureBits = daly_bms.class_("DalyFailureBits")
+DalyFailureBitsRef = DalyFailureBits.operator("ref").operator("const")
 DalyOnFailureStatus = daly_bms.class_(
     "DalyOnFailureStatus",
     automation.Trigger.template(
-        cg.std_vector.template(cg.uint8).operator("ref").operator("const")
+        DalyFailureBitsRef, DalyFailureBitsRef, DalyFailureBitsRef
     ),
 )
 
-CONFIG_SCHEMA = (
+# frames by the suffix of the USE_DALY_BMS_* define that compiles their decoder in
+REQUEST_IDS = {
+    "BATTERY_LEVEL": 0x90,
+    "MIN_MAX_VOLTAGE": 0x91,
+    "MIN_MAX_TEMPERATURE": 0x92,
+    "MOS": 0x93,
+    "STATUS": 0x94,
+    "CELL_VOLTAGE": 0x95,
+    "TEMPERATURE": 0x96,
+    "BALANCE": 0x97,
+    "FAILURE_STATUS": 0x98,
+    "CELL_THRESHOLDS": 0x59,
+    "PACK_THRESHOLDS": 0x5A,
+    "REST_THRESHOLDS": 0x5E,
+    "CAPACITY_NOMINAL_VOLTAGE": 0x50,
+}
+
+
+def request_frames(hub, *frames):
+    """Compile the decoders of `frames` in and add the frames to the poll schedule of `hub`."""
+    requested = CORE.data.setdefault("daly_bms_frames", set())
+    for frame in frames:
+        cg.add_define(f"USE_DALY_BMS_{frame}")
+        if (str(hub), frame) not in requested:
+            requested.add((str(hub), frame))
+            cg.add(hub.enable_request(REQUEST_IDS[frame]))
+
+
+def hub_local_min_max(hub_id):
+    for conf in CORE.config["daly_bms"]:
+        if str(conf[CONF_ID]) == str(hub_id):
+            return conf[CONF_LOCAL_MIN_MAX]
+    return True
+
+
+def hub_protocol(hub_id):
+    for conf in CORE.config["daly_bms"]:
+        if str(conf[CONF_ID]) == str(hub_id):
+            return conf[CONF_PROTOCOL]
+    return PROTOCOL_DALY
+
+
+def _validate_current_step(config):
+    if CONF_CURRENT_STEP in config and CONF_ACTIVE_UPDATE_INTERVAL not in config:
+        raise cv.Invalid(
+            f"{CONF_CURRENT_STEP} requires {CONF_ACTIVE_UPDATE_INTERVAL} to be set"
+        )
+    return config
+
+
+DalyOnWriteComplete = daly_bms.class_(
+    "DalyOnWriteComplete", automation.Trigger.template(cg.uint8, cg.bool_)
+)
+SetChargingMosAction = daly_bms.class_("SetChargingMosAction", automation.Action)
+SetDischargingMosAction = daly_bms.class_("SetDischargingMosAction", automation.Action)
+SetSocAction = daly_bms.class_("SetSocAction", automation.Action)
+ResetAction = daly_bms.class_("ResetAction", automation.Action)
+ResetEnergyAction = daly_bms.class_("ResetEnergyAction", automation.Action)
+DumpHistoryAction = daly_bms.class_("DumpHistoryAction", automation.Action)
+ClearHistoryAction = daly_bms.class_("ClearHistoryAction", automation.Action)
+
+
+CONFIG_SCHEMA = cv.All(
     cv.Schema(
         {
             cv.GenerateID(): cv.declare_id(DalyBmsComponent),
-            cv.Optional(CONF_ADDRESS, default=0x80): cv.positive_int,
+            cv.GenerateID(CONF_DALY_BMS_BUS_ID): cv.declare_id(DalyBmsBus),
+            cv.Optional(CONF_ADDRESS, default=0x80): cv.int_range(min=0x40, max=0xFF),
+            cv.Optional(CONF_PROTOCOL, default=PROTOCOL_DALY): cv.enum(
+                PROTOCOLS, lower=True
+            ),
+            cv.Optional(CONF_LOCAL_MIN_MAX, default=True): cv.boolean,
+            cv.Optional(CONF_ACTIVE_UPDATE_INTERVAL): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_CURRENT_STEP): cv.All(cv.current, cv.positive_float),
+            cv.Optional(CONF_CELL_UPDATE_INTERVAL): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_THRESHOLD_UPDATE_INTERVAL, default="1h"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_DIAGNOSTIC_UPDATE_INTERVAL, default="60s"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(
+                CONF_ENERGY_SAVE_INTERVAL, default="1h"
+            ): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_HISTORY): cv.Schema(
+                {
+                    # in bytes, rounded down to whole blocks
+                    cv.Optional(CONF_SIZE, default=8192): cv.int_range(
+                        min=HISTORY_BLOCK_SIZE, max=HISTORY_BLOCK_SIZE * 0xFFFF
+                    ),
+                }
+            ),
+            # tuning of the per-cell health values, see the analytics sensors in sensor.py
+            cv.Optional(CONF_CELL_ANALYTICS): cv.Schema(
+                {
+                    cv.Optional(
+                        CONF_TIME_CONSTANT, default="10min"
+                    ): cv.positive_time_period_milliseconds,
+                    cv.Optional(CONF_CURRENT_STEP, default="5A"): cv.All(
+                        cv.current, cv.positive_float
+                    ),
+                    cv.Optional(
+                        CONF_PUBLISH_INTERVAL, default="5min"
+                    ): cv.positive_time_period_milliseconds,
+                }
+            ),
+            # logs the raw UART traffic of the bus for tools/daly_capture.py
+            cv.Optional(CONF_CAPTURE, default=False): cv.boolean,
             cv.Optional(CONF_ON_FAILURE_STATUS): automation.validate_automation(
                 {
                     cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(DalyOnFailureStatus),
                 }
             ),
+            cv.Optional(CONF_ON_WRITE_COMPLETE): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(DalyOnWriteComplete),
+                }
+            ),
         }
     )
     .extend(uart.UART_DEVICE_SCHEMA)
-    .extend(cv.polling_component_schema("30s"))
+    .extend(cv.polling_component_schema("30s")),
+    _validate_current_step,
 )
 
 
+def board_number(address):
+    """Address the BMS replies with, see DalyBmsComponent::get_reply_address()."""
+    return address - 0x7F if address >= 0x80 else address - 0x3F
+
+
+def _final_validate(config):
+    # several packs may share one UART, but replies are routed by board number, so each pack needs its own
+    boards = {}
+    for conf in fv.full_config.get()["daly_bms"]:
+        if conf[CONF_UART_ID] != config[CONF_UART_ID]:
+            continue
+        if conf[CONF_PROTOCOL] != config[CONF_PROTOCOL]:
+            raise cv.Invalid(
+                f"All packs on UART {conf[CONF_UART_ID]} must use the same protocol"
+            )
+        board = board_number(conf[CONF_ADDRESS])
+        if board in boards:
+            raise cv.Invalid(
+                f"Addresses 0x{boards[board]:02X} and 0x{conf[CONF_ADDRESS]:02X} both reply as board "
+                f"{board} on UART {conf[CONF_UART_ID]}"
+            )
+        boards[board] = conf[CONF_ADDRESS]
+    if config[CONF_CAPTURE]:
+        _validate_capture_log_level()
+    return config
+
+
+def _validate_capture_log_level():
+    # the capture lines are logged at debug level, below it they are compiled out or filtered and nothing is captured
+    logger = fv.full_config.get().get("logger")
+    if logger is None:
+        raise cv.Invalid("capture needs the logger component", path=[CONF_CAPTURE])
+    levels = [logger.get(CONF_LEVEL, "DEBUG")]
+    if CAPTURE_TAG in logger.get(CONF_LOGS, {}):
+        levels.append(logger[CONF_LOGS][CAPTURE_TAG])
+    level = min(levels, key=LOG_LEVEL_SEVERITY.index)
+    if LOG_LEVEL_SEVERITY.index(level) < LOG_LEVEL_SEVERITY.index("DEBUG"):
+        raise cv.Invalid(
+            f"capture logs at DEBUG level under the {CAPTURE_TAG} tag, but the logger level for it is {level}",
+            path=[CONF_CAPTURE],
+        )
+
+
+FINAL_VALIDATE_SCHEMA = _final_validate
+
+
+async def register_bus(config):
+    # all packs on one UART share a single bus object that owns the line
+    buses = CORE.data.setdefault("daly_bms", {})
+    uart_id = str(config[CONF_UART_ID])
+    if uart_id not in buses:
+        bus = cg.new_Pvariable(config[CONF_DALY_BMS_BUS_ID])
+        await cg.register_component(bus, {})
+        await uart.register_uart_device(bus, config)
+        cg.add(bus.set_protocol(config[CONF_PROTOCOL]))
+        buses[uart_id] = bus
+    return buses[uart_id]
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
-    await uart.register_uart_device(var, config)
+    bus = await register_bus(config)
+    cg.add(bus.register_device(var))
     cg.add(var.set_address(config[CONF_ADDRESS]))
+    cg.add(var.set_protocol(config[CONF_PROTOCOL]))
+    cg.add(var.set_local_min_max(config[CONF_LOCAL_MIN_MAX]))
+    cg.add(
+        var.set_cell_update_interval(
+            config.get(CONF_CELL_UPDATE_INTERVAL, config[CONF_UPDATE_INTERVAL])
+        )
+    )
+    if CONF_ACTIVE_UPDATE_INTERVAL in config:
+        cg.add(var.set_active_update_interval(config[CONF_ACTIVE_UPDATE_INTERVAL]))
+        # activity is detected from the charge state and the current
+        request_frames(var, "MOS", "BATTERY_LEVEL")
+    if CONF_CURRENT_STEP in config:
+        cg.add(var.set_current_step(config[CONF_CURRENT_STEP]))
+    cg.add(var.set_threshold_update_interval(config[CONF_THRESHOLD_UPDATE_INTERVAL]))
+    cg.add(var.set_diagnostic_update_interval(config[CONF_DIAGNOSTIC_UPDATE_INTERVAL]))
+    cg.add(var.set_energy_save_interval(config[CONF_ENERGY_SAVE_INTERVAL]))
+    # stable key for the persisted energy totals
+    energy_hash = int(hashlib.md5(str(config[CONF_ID]).encode()).hexdigest()[:8], 16)
+    cg.add(var.set_energy_hash(energy_hash))
+    if history := config.get(CONF_HISTORY):
+        cg.add_define("USE_DALY_BMS_HISTORY")
+        cg.add(var.set_history_blocks(history[CONF_SIZE] // HISTORY_BLOCK_SIZE))
+        request_frames(var, "BATTERY_LEVEL", "CELL_VOLTAGE", "TEMPERATURE", "STATUS")
+    if analytics := config.get(CONF_CELL_ANALYTICS):
+        cg.add_define("USE_DALY_BMS_CELL_ANALYTICS")
+        cg.add(var.set_analytics_time_constant(analytics[CONF_TIME_CONSTANT]))
+        cg.add(var.set_analytics_current_step(analytics[CONF_CURRENT_STEP]))
+        cg.add(var.set_analytics_publish_interval(analytics[CONF_PUBLISH_INTERVAL]))
+        request_frames(var, "BATTERY_LEVEL", "CELL_VOLTAGE", "STATUS")
+    if config[CONF_CAPTURE]:
+        # the capture belongs to the bus, so it covers every pack on this UART
+        cg.add_define("USE_DALY_BMS_CAPTURE")
+        cg.add(bus.set_capture(True))
+    if CONF_ON_FAILURE_STATUS in config:
+        request_frames(var, "FAILURE_STATUS")
     for conf in config.get(CONF_ON_FAILURE_STATUS, []):
         trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
         await automation.build_automation(
             trigger,
-            [(cg.std_vector.template(cg.uint8).operator("ref").operator("const"), "x")],
+            [
+                (DalyFailureBitsRef, "x"),
+                (DalyFailureBitsRef, "raised"),
+                (DalyFailureBitsRef, "cleared"),
+            ],
             conf,
         )
+    for conf in config.get(CONF_ON_WRITE_COMPLETE, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        await automation.build_automation(
+            trigger, [(cg.uint8, "command"), (cg.bool_, "success")], conf
+        )
+
+
+DALY_MOS_ACTION_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.use_id(DalyBmsComponent),
+        cv.Required(CONF_STATE): cv.templatable(cv.boolean),
+    }
+)
+
+
+@automation.register_action(
+    "daly_bms.set_charging_mos", SetChargingMosAction, DALY_MOS_ACTION_SCHEMA
+)
+@automation.register_action(
+    "daly_bms.set_discharging_mos", SetDischargingMosAction, DALY_MOS_ACTION_SCHEMA
+)
+async def daly_bms_set_mos_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    template_ = await cg.templatable(config[CONF_STATE], args, bool)
+    cg.add(var.set_state(template_))
+    return var
+
+
+@automation.register_action(
+    "daly_bms.set_soc",
+    SetSocAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(DalyBmsComponent),
+            cv.Required(CONF_SOC): cv.templatable(
+                cv.float_range(min=0.0, max=100.0)
+            ),
+        }
+    ),
+)
+async def daly_bms_set_soc_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    template_ = await cg.templatable(config[CONF_SOC], args, float)
+    cg.add(var.set_soc(template_))
+    return var
+
+
+@automation.register_action(
+    "daly_bms.reset",
+    ResetAction,
+    automation.maybe_simple_id({cv.GenerateID(): cv.use_id(DalyBmsComponent)}),
+)
+async def daly_bms_reset_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
+@automation.register_action(
+    "daly_bms.reset_energy",
+    ResetEnergyAction,
+    automation.maybe_simple_id({cv.GenerateID(): cv.use_id(DalyBmsComponent)}),
+)
+async def daly_bms_reset_energy_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
+@automation.register_action(
+    "daly_bms.dump_history",
+    DumpHistoryAction,
+    automation.maybe_simple_id(
+        {
+            cv.GenerateID(): cv.use_id(DalyBmsComponent),
+            cv.Optional(CONF_BATCH_SIZE, default=10): cv.templatable(
+                cv.int_range(min=1, max=1000)
+            ),
+        }
+    ),
+)
+async def daly_bms_dump_history_to_code(config, action_id, template_arg, args):
+    # compiles, and logs that there is nothing to dump, on packs without a history
+    cg.add_define("USE_DALY_BMS_HISTORY")
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    template_ = await cg.templatable(config[CONF_BATCH_SIZE], args, cg.uint16)
+    cg.add(var.set_batch_size(template_))
+    return var
+
+
+@automation.register_action(
+    "daly_bms.clear_history",
+    ClearHistoryAction,
+    automation.maybe_simple_id({cv.GenerateID(): cv.use_id(DalyBmsComponent)}),
+)
+async def daly_bms_clear_history_to_code(config, action_id, template_arg, args):
+    cg.add_define("USE_DALY_BMS_HISTORY")
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
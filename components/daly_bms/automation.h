@@ -3,18 +3,70 @@
 #include "esphome/core/automation.h"
 #include "daly_bms.h"
 
-#include <vector>
-
 namespace esphome {
 namespace daly_bms {
 
-class DalyOnFailureStatus : public Trigger<const std::vector<uint8_t> &> {
+class DalyOnFailureStatus : public Trigger<const DalyFailureBits &, const DalyFailureBits &, const DalyFailureBits &> {
  public:
   explicit DalyOnFailureStatus(DalyBmsComponent *daly) {
-    daly->add_failure_callback([this](const std::vector<uint8_t> &data) { this->trigger(data); });
+    daly->add_failure_callback(
+        [this](const DalyFailureBits &bits, const DalyFailureBits &raised, const DalyFailureBits &cleared) {
+          this->trigger(bits, raised, cleared);
+        });
+  }
+};
+
+class DalyOnWriteComplete : public Trigger<uint8_t, bool> {
+ public:
+  explicit DalyOnWriteComplete(DalyBmsComponent *daly) {
+    daly->add_on_write_complete_callback([this](uint8_t command, bool success) { this->trigger(command, success); });
   }
 };
 
+template<typename... Ts> class SetChargingMosAction : public Action<Ts...>, public Parented<DalyBmsComponent> {
+ public:
+  TEMPLATABLE_VALUE(bool, state)
+
+  void play(Ts... x) override { this->parent_->set_charging_mos(this->state_.value(x...)); }
+};
+
+template<typename... Ts> class SetDischargingMosAction : public Action<Ts...>, public Parented<DalyBmsComponent> {
+ public:
+  TEMPLATABLE_VALUE(bool, state)
+
+  void play(Ts... x) override { this->parent_->set_discharging_mos(this->state_.value(x...)); }
+};
+
+template<typename... Ts> class SetSocAction : public Action<Ts...>, public Parented<DalyBmsComponent> {
+ public:
+  TEMPLATABLE_VALUE(float, soc)
+
+  void play(Ts... x) override { this->parent_->set_soc(this->soc_.value(x...)); }
+};
+
+template<typename... Ts> class ResetAction : public Action<Ts...>, public Parented<DalyBmsComponent> {
+ public:
+  void play(Ts... x) override { this->parent_->reset_bms(); }
+};
+
+template<typename... Ts> class ResetEnergyAction : public Action<Ts...>, public Parented<DalyBmsComponent> {
+ public:
+  void play(Ts... x) override { this->parent_->reset_energy(); }
+};
+
+#ifdef USE_DALY_BMS_HISTORY
+template<typename... Ts> class DumpHistoryAction : public Action<Ts...>, public Parented<DalyBmsComponent> {
+ public:
+  TEMPLATABLE_VALUE(uint16_t, batch_size)
+
+  void play(Ts... x) override { this->parent_->dump_history(this->batch_size_.value(x...)); }
+};
+
+template<typename... Ts> class ClearHistoryAction : public Action<Ts...>, public Parented<DalyBmsComponent> {
+ public:
+  void play(Ts... x) override { this->parent_->clear_history(); }
+};
+#endif
+
 }  // namespace daly_bms
 }  // namespace esphome
-
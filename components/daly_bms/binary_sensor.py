@@ -1,50 +1,92 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import binary_sensor
-from . import DalyBmsComponent, CONF_BMS_DALY_ID
+from esphome.const import DEVICE_CLASS_PROBLEM
+from . import daly_bms, DalyBmsComponent, CONF_BMS_DALY_ID, request_frames
+
+DalyBinarySensor = daly_bms.class_("DalyBinarySensor", binary_sensor.BinarySensor)
 
 CONF_CHARGING_MOS_ENABLED = "charging_mos_enabled"
 CONF_DISCHARGING_MOS_ENABLED = "discharging_mos_enabled"
-CONF_CELL_1_BALANCE_ACTIVE = "cell_1_balance_active"
-CONF_CELL_2_BALANCE_ACTIVE = "cell_2_balance_active"
-CONF_CELL_3_BALANCE_ACTIVE = "cell_3_balance_active"
-CONF_CELL_4_BALANCE_ACTIVE = "cell_4_balance_active"
-CONF_CELL_5_BALANCE_ACTIVE = "cell_5_balance_active"
-CONF_CELL_6_BALANCE_ACTIVE = "cell_6_balance_active"
-CONF_CELL_7_BALANCE_ACTIVE = "cell_7_balance_active"
-CONF_CELL_8_BALANCE_ACTIVE = "cell_8_balance_active"
-CONF_CELL_9_BALANCE_ACTIVE = "cell_9_balance_active"
-CONF_CELL_10_BALANCE_ACTIVE = "cell_10_balance_active"
-CONF_CELL_11_BALANCE_ACTIVE = "cell_11_balance_active"
-CONF_CELL_12_BALANCE_ACTIVE = "cell_12_balance_active"
-CONF_CELL_13_BALANCE_ACTIVE = "cell_13_balance_active"
-CONF_CELL_14_BALANCE_ACTIVE = "cell_14_balance_active"
-CONF_CELL_15_BALANCE_ACTIVE = "cell_15_balance_active"
-CONF_CELL_16_BALANCE_ACTIVE = "cell_16_balance_active"
+CONF_HEARTBEAT = "heartbeat"
+MAX_CELLS = 48
+
+# 0x97 bitmap in bit order, cell n is bit n - 1
+CELL_BALANCE_ACTIVE = [f"cell_{i}_balance_active" for i in range(1, MAX_CELLS + 1)]
 
+# 0x98 alarm bits in bit order (byte * 8 + bit), None marks reserved bits
+FAILURES = [
+    "cell_voltage_high_level_1",
+    "cell_voltage_high_level_2",
+    "cell_voltage_low_level_1",
+    "cell_voltage_low_level_2",
+    "pack_voltage_high_level_1",
+    "pack_voltage_high_level_2",
+    "pack_voltage_low_level_1",
+    "pack_voltage_low_level_2",
+    "charge_temperature_high_level_1",
+    "charge_temperature_high_level_2",
+    "charge_temperature_low_level_1",
+    "charge_temperature_low_level_2",
+    "discharge_temperature_high_level_1",
+    "discharge_temperature_high_level_2",
+    "discharge_temperature_low_level_1",
+    "discharge_temperature_low_level_2",
+    "charge_overcurrent_level_1",
+    "charge_overcurrent_level_2",
+    "discharge_overcurrent_level_1",
+    "discharge_overcurrent_level_2",
+    "soc_high_level_1",
+    "soc_high_level_2",
+    "soc_low_level_1",
+    "soc_low_level_2",
+    "cell_voltage_difference_level_1",
+    "cell_voltage_difference_level_2",
+    "temperature_difference_level_1",
+    "temperature_difference_level_2",
+    None,
+    None,
+    None,
+    None,
+    "charge_mos_overtemperature",
+    "discharge_mos_overtemperature",
+    "charge_mos_temperature_sensor_failure",
+    "discharge_mos_temperature_sensor_failure",
+    "charge_mos_adhesion_failure",
+    "discharge_mos_adhesion_failure",
+    "charge_mos_open_circuit_failure",
+    "discharge_mos_open_circuit_failure",
+    "afe_chip_failure",
+    "cell_voltage_sensing_failure",
+    "temperature_sensor_failure",
+    "eeprom_failure",
+    "rtc_failure",
+    "precharge_failure",
+    "vehicle_communication_failure",
+    "internal_communication_failure",
+    "current_module_failure",
+    "pack_voltage_sensing_failure",
+    "short_circuit_protection_failure",
+    "low_voltage_charging_forbidden",
+]
 
 TYPES = [
     CONF_CHARGING_MOS_ENABLED,
     CONF_DISCHARGING_MOS_ENABLED,
-    CONF_CELL_1_BALANCE_ACTIVE,
-    CONF_CELL_2_BALANCE_ACTIVE,
-    CONF_CELL_3_BALANCE_ACTIVE,
-    CONF_CELL_4_BALANCE_ACTIVE,
-    CONF_CELL_5_BALANCE_ACTIVE,
-    CONF_CELL_6_BALANCE_ACTIVE,
-    CONF_CELL_7_BALANCE_ACTIVE,
-    CONF_CELL_8_BALANCE_ACTIVE,
-    CONF_CELL_9_BALANCE_ACTIVE,
-    CONF_CELL_10_BALANCE_ACTIVE,
-    CONF_CELL_11_BALANCE_ACTIVE,
-    CONF_CELL_12_BALANCE_ACTIVE,
-    CONF_CELL_13_BALANCE_ACTIVE,
-    CONF_CELL_14_BALANCE_ACTIVE,
-    CONF_CELL_15_BALANCE_ACTIVE,
-    CONF_CELL_16_BALANCE_ACTIVE,
 ]
 
-DALY_BINARY_SCHEMA = binary_sensor.binary_sensor_schema()
+DALY_BINARY_SCHEMA = binary_sensor.binary_sensor_schema(DalyBinarySensor).extend(
+    {
+        cv.Optional(CONF_HEARTBEAT): cv.positive_time_period_milliseconds,
+    }
+)
+FAILURE_BINARY_SCHEMA = binary_sensor.binary_sensor_schema(
+    DalyBinarySensor, device_class=DEVICE_CLASS_PROBLEM
+).extend(
+    {
+        cv.Optional(CONF_HEARTBEAT): cv.positive_time_period_milliseconds,
+    }
+)
 
 CONFIG_SCHEMA = cv.All(
     cv.Schema(
@@ -52,34 +94,46 @@ CONFIG_SCHEMA = cv.All(
             cv.GenerateID(CONF_BMS_DALY_ID): cv.use_id(DalyBmsComponent),
             cv.Optional(CONF_CHARGING_MOS_ENABLED): DALY_BINARY_SCHEMA,
             cv.Optional(CONF_DISCHARGING_MOS_ENABLED): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_1_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_2_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_3_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_4_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_5_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_6_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_7_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_8_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_9_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_10_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_11_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_12_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_13_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_14_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_15_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
-            cv.Optional(CONF_CELL_16_BALANCE_ACTIVE): DALY_BINARY_SCHEMA,
+            **{cv.Optional(key): DALY_BINARY_SCHEMA for key in CELL_BALANCE_ACTIVE},
+            **{
+                cv.Optional(key): FAILURE_BINARY_SCHEMA
+                for key in FAILURES
+                if key is not None
+            },
         }
     ).extend(cv.COMPONENT_SCHEMA)
 )
 
 
+async def new_daly_binary_sensor(sensor_config):
+    var = await binary_sensor.new_binary_sensor(sensor_config)
+    if CONF_HEARTBEAT in sensor_config:
+        cg.add(var.set_heartbeat(sensor_config[CONF_HEARTBEAT]))
+    return var
+
+
 async def setup_conf(config, key, hub):
     if sensor_config := config.get(key):
-        var = await binary_sensor.new_binary_sensor(sensor_config)
+        var = await new_daly_binary_sensor(sensor_config)
         cg.add(getattr(hub, f"set_{key}_binary_sensor")(var))
 
 
 async def to_code(config):
     hub = await cg.get_variable(config[CONF_BMS_DALY_ID])
+    if any(key in config for key in TYPES):
+        request_frames(hub, "MOS")
+    if any(key in config for key in CELL_BALANCE_ACTIVE):
+        # sized by the cell count from 0x94
+        request_frames(hub, "BALANCE", "STATUS")
+    if any(key is not None and key in config for key in FAILURES):
+        request_frames(hub, "FAILURE_STATUS")
     for key in TYPES:
-        await setup_conf(config, key, hub)
\ No newline at end of file
+        await setup_conf(config, key, hub)
+    for cell, key in enumerate(CELL_BALANCE_ACTIVE):
+        if sensor_config := config.get(key):
+            var = await new_daly_binary_sensor(sensor_config)
+            cg.add(hub.set_cell_balance_binary_sensor(cell, var))
+    for bit, key in enumerate(FAILURES):
+        if key is not None and (sensor_config := config.get(key)):
+            var = await new_daly_binary_sensor(sensor_config)
+            cg.add(hub.set_failure_binary_sensor(bit, var))
@@ -1,5 +1,10 @@
 #include "daly_bms.h"
-#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "esphome/core/log.h"
 
 namespace esphome {
@@ -7,7 +12,6 @@ namespace daly_bms {
 
 static const char *const TAG = "daly_bms";
 
-static const uint8_t DALY_FRAME_SIZE = 13;
 static const uint8_t DALY_TEMPERATURE_OFFSET = 40;
 static const uint16_t DALY_CURRENT_OFFSET = 30000;
 
@@ -26,427 +30,1469 @@ static const uint8_t DALY_REQUEST_REST_THRESHOLDS = 0x5E;
 static const uint8_t DALY_REQUEST_CAPACITY_NOMINAL_VOLTAGE = 0x50;
 
 
-void DalyBmsComponent::setup() { this->next_request_ = 1; }
+struct DalyRequest {
+  uint8_t data_id;
+  DalyPollTier tier;
+};
+
+// Ordered by priority: whenever the bus is free the first pending entry is sent, so fast frames never queue
+// up behind slow ones.
+static const DalyRequest DALY_REQUESTS[] = {
+    {DALY_REQUEST_BATTERY_LEVEL, DALY_TIER_FAST},
+    {DALY_REQUEST_MIN_MAX_VOLTAGE, DALY_TIER_FAST},
+    {DALY_REQUEST_MOS, DALY_TIER_FAST},
+    {DALY_REQUEST_FAILURE_STATUS, DALY_TIER_FAST},
+    {DALY_REQUEST_STATUS, DALY_TIER_CELLS},
+    {DALY_REQUEST_CELL_VOLTAGE, DALY_TIER_CELLS},
+    {DALY_REQUEST_MIN_MAX_TEMPERATURE, DALY_TIER_CELLS},
+    {DALY_REQUEST_TEMPERATURE, DALY_TIER_CELLS},
+    {DALY_REQUEST_BALANCE, DALY_TIER_CELLS},
+    {DALY_REQUEST_CELL_THRESHOLDS, DALY_TIER_THRESHOLDS},
+    {DALY_REQUEST_PACK_THRESHOLDS, DALY_TIER_THRESHOLDS},
+    {DALY_REQUEST_REST_THRESHOLDS, DALY_TIER_THRESHOLDS},
+    {DALY_REQUEST_CAPACITY_NOMINAL_VOLTAGE, DALY_TIER_THRESHOLDS},
+};
+static_assert(sizeof(DALY_REQUESTS) / sizeof(DALY_REQUESTS[0]) == DALY_REQUEST_COUNT, "request table size");
+
+// Modbus register map of the Daly H/K/M/S series (Daly "RS485 Modbus RTU communication protocol", function 0x03):
+// 48 cell voltages (mV) at 0x00-0x2F, 8 temperatures (°C + 40) at 0x30-0x37, then the pack values from 0x38 on.
+// The pack read takes 0x30-0x52 in one go and hands it to decode_data() as the 0x90-0x94, 0x96 and 0x97 payloads.
+// Thresholds, nominal values and the fault registers are not mapped.
+static const uint16_t DALY_MODBUS_CELL_VOLTAGES = 0x00;
+static const uint16_t DALY_MODBUS_TEMPERATURES = 0x30;
+static const uint8_t DALY_MODBUS_MAX_TEMPERATURES = 8;
+static const uint16_t DALY_MODBUS_VOLTAGE = 0x38;  // 0.1 V
+static const uint16_t DALY_MODBUS_CURRENT = 0x39;  // 0.1 A, 30000 offset
+static const uint16_t DALY_MODBUS_SOC = 0x3A;      // 0.1 %
+static const uint16_t DALY_MODBUS_CELLS = 0x3C;
+static const uint16_t DALY_MODBUS_PROBES = 0x3D;
+static const uint16_t DALY_MODBUS_MAX_CELL_VOLTAGE = 0x3E;  // mV
+static const uint16_t DALY_MODBUS_MAX_CELL = 0x3F;
+static const uint16_t DALY_MODBUS_MIN_CELL_VOLTAGE = 0x40;
+static const uint16_t DALY_MODBUS_MIN_CELL = 0x41;
+static const uint16_t DALY_MODBUS_MAX_TEMPERATURE = 0x43;  // °C + 40
+static const uint16_t DALY_MODBUS_MAX_PROBE = 0x44;
+static const uint16_t DALY_MODBUS_MIN_TEMPERATURE = 0x45;
+static const uint16_t DALY_MODBUS_MIN_PROBE = 0x46;
+static const uint16_t DALY_MODBUS_STATE = 0x48;               // 0 standby, 1 charging, 2 discharging
+static const uint16_t DALY_MODBUS_REMAINING_CAPACITY = 0x4B;  // 0.1 Ah
+static const uint16_t DALY_MODBUS_CYCLES = 0x4C;
+static const uint16_t DALY_MODBUS_BALANCING = 0x4E;  // cells 1-16, 17-32, 33-48, bit 0 is the first of them
+static const uint16_t DALY_MODBUS_CHARGING_MOS = 0x51;
+static const uint16_t DALY_MODBUS_DISCHARGING_MOS = 0x52;
+static const uint16_t DALY_MODBUS_PACK_COUNT = DALY_MODBUS_DISCHARGING_MOS + 1 - DALY_MODBUS_TEMPERATURES;
+
+// upper bounds of the round trip time histogram buckets in ms, the last bucket takes everything above
+static const uint16_t DALY_RTT_BUCKET_LIMITS[DALY_RTT_BUCKETS - 1] = {20, 40, 80, 160, 320};
+
+static int8_t request_index(uint8_t data_id) {
+  for (uint8_t i = 0; i < DALY_REQUEST_COUNT; i++) {
+    if (DALY_REQUESTS[i].data_id == data_id)
+      return i;
+  }
+  return -1;
+}
+
+// write queue priorities, lower goes first: switching a MOS off protects the pack and must not wait
+static const uint8_t DALY_PRIORITY_MOS_OFF = 0;
+static const uint8_t DALY_PRIORITY_MOS_ON = 1;
+static const uint8_t DALY_PRIORITY_SOC = 2;
+static const uint8_t DALY_PRIORITY_RESET = 3;
+
+static bool is_write_command(uint8_t data_id) {
+  return data_id == DALY_COMMAND_RESET || data_id == DALY_COMMAND_SET_SOC || data_id == DALY_COMMAND_DISCHARGING_MOS ||
+         data_id == DALY_COMMAND_CHARGING_MOS;
+}
+
+// samples further apart than this are not integrated, the current in between is unknown
+static const uint32_t DALY_MAX_INTEGRATION_GAP = 10 * 60 * 1000;
+// integrator units per 0.01 Ah and per Wh
+static const uint64_t DALY_CHARGE_PER_CENTI_AH = 10ULL * 3600 * 1000000 / 100;
+static const uint64_t DALY_ENERGY_PER_WH = 100ULL * 3600 * 1000000;
+
+#ifdef USE_DALY_BMS_FAILURE_STATUS
+// 0x98 alarms in bit order (byte * 8 + bit), nullptr marks reserved bits
+static const char *const DALY_FAILURE_NAMES[DALY_FAILURE_BITS] = {
+    // byte 0
+    "Cell voltage high level 1", "Cell voltage high level 2", "Cell voltage low level 1", "Cell voltage low level 2",
+    "Pack voltage high level 1", "Pack voltage high level 2", "Pack voltage low level 1", "Pack voltage low level 2",
+    // byte 1
+    "Charge temperature high level 1", "Charge temperature high level 2", "Charge temperature low level 1",
+    "Charge temperature low level 2", "Discharge temperature high level 1", "Discharge temperature high level 2",
+    "Discharge temperature low level 1", "Discharge temperature low level 2",
+    // byte 2
+    "Charge overcurrent level 1", "Charge overcurrent level 2", "Discharge overcurrent level 1",
+    "Discharge overcurrent level 2", "SOC high level 1", "SOC high level 2", "SOC low level 1", "SOC low level 2",
+    // byte 3
+    "Cell voltage difference level 1", "Cell voltage difference level 2", "Temperature difference level 1",
+    "Temperature difference level 2", nullptr, nullptr, nullptr, nullptr,
+    // byte 4
+    "Charge MOS overtemperature", "Discharge MOS overtemperature", "Charge MOS temperature sensor failure",
+    "Discharge MOS temperature sensor failure", "Charge MOS adhesion failure", "Discharge MOS adhesion failure",
+    "Charge MOS open circuit failure", "Discharge MOS open circuit failure",
+    // byte 5
+    "AFE chip failure", "Cell voltage sensing failure", "Temperature sensor failure", "EEPROM failure",
+    "RTC failure", "Precharge failure", "Vehicle communication failure", "Internal communication failure",
+    // byte 6
+    "Current module failure", "Pack voltage sensing failure", "Short circuit protection failure",
+    "Low voltage, charging forbidden", nullptr, nullptr, nullptr, nullptr,
+};
+#endif
+
+static const uint8_t DALY_CELLS_PER_FRAME = 3;
+static const uint8_t DALY_TEMPERATURES_PER_FRAME = 7;
+// 0x96 frames that carry probes we keep, the last one only partly
+static const uint8_t DALY_MAX_TEMPERATURE_FRAMES =
+    (DALY_MAX_TEMPERATURES + DALY_TEMPERATURES_PER_FRAME - 1) / DALY_TEMPERATURES_PER_FRAME;
+
+#ifdef USE_SENSOR
+void DalySensor::publish_raw(int32_t raw, uint16_t divisor) {
+  const uint32_t now = millis();
+  if (this->change_driven_ && this->has_raw_) {
+    const uint32_t delta = std::abs((int64_t) raw - this->last_raw_);
+    const bool expired = this->heartbeat_ != 0 && now - this->last_publish_ >= this->heartbeat_;
+    if (!expired && (delta == 0 || delta < this->deadband_raw_))
+      return;
+  } else if (!this->has_raw_) {
+    // the deadband is converted to protocol units once, later comparisons stay on integers
+    this->deadband_raw_ = lroundf(this->deadband_ * divisor);
+    this->has_raw_ = true;
+  }
+  this->last_raw_ = raw;
+  this->last_publish_ = now;
+  this->publish_state((float) raw / divisor);
+}
+#endif
+
+#ifdef USE_BINARY_SENSOR
+void DalyBinarySensor::publish_raw(bool state) {
+  const uint32_t now = millis();
+  if (this->has_raw_ && state == this->last_raw_) {
+    if (this->heartbeat_ == 0 || now - this->last_publish_ < this->heartbeat_)
+      return;
+    this->last_publish_ = now;
+    this->publish_initial_state(state);
+    return;
+  }
+  this->has_raw_ = true;
+  this->last_raw_ = state;
+  this->last_publish_ = now;
+  this->publish_state(state);
+}
+#endif
+
+#ifdef USE_SWITCH
+void DalyMosSwitch::write_state(bool state) {
+  if (this->charging_) {
+    this->parent_->set_charging_mos(state);
+  } else {
+    this->parent_->set_discharging_mos(state);
+  }
+}
+#endif
+
+void DalyBmsComponent::setup() {
+  // the read requests never change, build them once
+  for (uint8_t i = 0; i < DALY_REQUEST_COUNT; i++) {
+    uint8_t *request_message = this->request_frames_[i];
+    request_message[0] = 0xA5;                      // Start Flag
+    request_message[1] = this->addr_;               // Communication Module Address
+    request_message[2] = DALY_REQUESTS[i].data_id;  // Data ID
+    request_message[3] = 0x08;                      // Data Length (Fixed)
+    memset(request_message + 4, 0x00, 8);           // Empty Data
+    request_message[12] = (uint8_t) (request_message[0] + request_message[1] + request_message[2] +
+                                     request_message[3]);  // Checksum (Lower byte of the other bytes sum)
+  }
+
+  if (this->local_min_max_) {
+    // min/max come from the snapshot, no need to ask the BMS
+    this->enabled_requests_ &= ~(1 << request_index(DALY_REQUEST_MIN_MAX_VOLTAGE));
+    this->enabled_requests_ &= ~(1 << request_index(DALY_REQUEST_MIN_MAX_TEMPERATURE));
+  }
+
+  if (this->protocol_ == DALY_PROTOCOL_MODBUS) {
+    // thresholds, nominal values and the failure status are not available over Modbus. Left enabled, their bits
+    // would stay pending with no reply to complete the sweep
+    this->enabled_requests_ &=
+        this->covered_requests_(DALY_MODBUS_READ_PACK) | this->covered_requests_(DALY_MODBUS_READ_CELLS);
+  }
+
+  this->idle_update_interval_ = this->get_update_interval();
+
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_BATTERY_LEVEL)
+  this->energy_enabled_ = this->charged_capacity_sensor_ || this->discharged_capacity_sensor_ ||
+                          this->charged_energy_sensor_ || this->discharged_energy_sensor_ ||
+                          this->session_capacity_sensor_ || this->session_energy_sensor_;
+#endif
+  if (this->energy_enabled_) {
+    this->energy_pref_ = global_preferences->make_preference<DalyEnergyState>(this->energy_hash_, true);
+    if (this->energy_pref_.load(&this->energy_)) {
+      this->saved_energy_ = this->energy_;
+    } else {
+      this->energy_ = {};
+    }
+    // flash has limited write cycles: write on an interval and only if something changed
+    this->set_interval("energy", this->energy_save_interval_, [this]() { this->save_energy_(); });
+  }
+
+#ifdef USE_DALY_BMS_HISTORY
+  // the define is global, packs without a history block configured keep none
+  if (this->history_blocks_ != 0 && !this->history_.init(this->history_blocks_)) {
+    ESP_LOGE(TAG, "Could not allocate %u bytes of history for 0x%02X",
+             (unsigned) (this->history_blocks_ * DALY_HISTORY_BLOCK_SIZE), this->addr_);
+  }
+#endif
+
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_CELL_ANALYTICS)
+  // the health values change over hours, publishing them slowly is the point of computing them here
+  this->set_interval("analytics", this->analytics_publish_interval_, [this]() { this->publish_analytics_(); });
+#endif
+
+  this->set_interval("cells", this->cell_update_interval_, [this]() { this->schedule_tier_(DALY_TIER_CELLS); });
+  this->set_interval("thresholds", this->threshold_update_interval_,
+                     [this]() { this->schedule_tier_(DALY_TIER_THRESHOLDS); });
+  this->set_interval("diagnostics", this->diagnostic_update_interval_, [this]() { this->publish_diagnostics_(); });
+  // read everything once at boot
+  this->schedule_tier_(DALY_TIER_FAST);
+  this->schedule_tier_(DALY_TIER_CELLS);
+  this->schedule_tier_(DALY_TIER_THRESHOLDS);
+}
 
 void DalyBmsComponent::dump_config() {
   ESP_LOGCONFIG(TAG, "Daly BMS:");
-  this->check_uart_settings(9600);
+  LOG_UPDATE_INTERVAL(this);
+  if (this->active_update_interval_ != 0) {
+    ESP_LOGCONFIG(TAG, "  Active Update Interval: %.1fs", this->active_update_interval_ / 1000.0f);
+    ESP_LOGCONFIG(TAG, "  Current Step: %.1fA", this->current_step_raw_ / 10.0f);
+  }
+  ESP_LOGCONFIG(TAG, "  Cell Update Interval: %.1fs", this->cell_update_interval_ / 1000.0f);
+  ESP_LOGCONFIG(TAG, "  Threshold Update Interval: %.1fs", this->threshold_update_interval_ / 1000.0f);
+  ESP_LOGCONFIG(TAG, "  Address: 0x%02X", this->addr_);
+  ESP_LOGCONFIG(TAG, "  Local Min/Max: %s", YESNO(this->local_min_max_));
+  if (this->protocol_ == DALY_PROTOCOL_MODBUS)
+    ESP_LOGCONFIG(TAG, "  Protocol: Modbus (slave %u, no thresholds or commands)", this->get_reply_address());
+  if (this->energy_enabled_)
+    ESP_LOGCONFIG(TAG, "  Energy Save Interval: %.1fs", this->energy_save_interval_ / 1000.0f);
+#ifdef USE_DALY_BMS_HISTORY
+  if (this->history_blocks_ != 0) {
+    ESP_LOGCONFIG(TAG, "  History: %u bytes%s", (unsigned) this->history_.capacity(),
+                  this->history_.is_ready() ? "" : " (allocation failed)");
+  }
+#endif
+#ifdef USE_SENSOR
+  LOG_SENSOR("  ", "Timeouts", this->timeouts_sensor_);
+  LOG_SENSOR("  ", "Checksum Errors", this->checksum_errors_sensor_);
+  LOG_SENSOR("  ", "Resyncs", this->resyncs_sensor_);
+  LOG_SENSOR("  ", "Discarded Bytes", this->discarded_bytes_sensor_);
+  LOG_SENSOR("  ", "Frame Rate", this->frame_rate_sensor_);
+  LOG_SENSOR("  ", "Round Trip Time", this->round_trip_time_sensor_);
+  LOG_SENSOR("  ", "Last Frame Age", this->last_frame_age_sensor_);
+#endif
 }
 
-void DalyBmsComponent::update() {
-  this->trigger_next_ = true;
-  this->next_request_ = 0;
+void DalyBmsComponent::on_shutdown() { this->save_energy_(); }
+
+void DalyBmsComponent::update() { this->schedule_tier_(DALY_TIER_FAST); }
+
+#ifdef USE_SENSOR
+void DalyBmsComponent::set_command_frame_rate_sensor(uint8_t data_id, DalySensor *sensor) {
+  const int8_t index = request_index(data_id);
+  if (index >= 0)
+    this->command_frame_rate_sensors_[index] = sensor;
 }
+#endif
 
-void DalyBmsComponent::loop() {
-  const uint32_t now = millis();
-  if (this->receiving_ && (now - this->last_transmission_ >= 200)) {
-    // last transmission too long ago. Reset RX index.
-    ESP_LOGW(TAG, "Last transmission too long ago. Reset RX index.");
-    this->data_.clear();
-    this->receiving_ = false;
-  }
-  if ((now - this->last_transmission_ >= 250) && !this->trigger_next_) {
-    // last transmittion longer than 0.25s ago -> trigger next request
-    this->last_transmission_ = now;
-    this->trigger_next_ = true;
-  }
-  if (available())
-    this->last_transmission_ = now;
-  while (available()) {
-    uint8_t c;
-    read_byte(&c);
-    if (!this->receiving_) {
-      if (c != 0xa5)
-        continue;
-      this->receiving_ = true;
+void DalyBmsComponent::enable_request(uint8_t data_id) {
+  const int8_t index = request_index(data_id);
+  if (index >= 0)
+    this->enabled_requests_ |= 1 << index;
+}
+
+void DalyBmsComponent::schedule_tier_(DalyPollTier tier) {
+  for (uint8_t i = 0; i < DALY_REQUEST_COUNT; i++) {
+    if (DALY_REQUESTS[i].tier == tier)
+      this->pending_requests_ |= (1 << i) & this->enabled_requests_;
+  }
+}
+
+void DalyBmsComponent::set_active_(bool active) {
+  if (this->active_update_interval_ == 0 || active == this->active_)
+    return;
+  this->active_ = active;
+  const uint32_t interval = active ? this->active_update_interval_ : this->idle_update_interval_;
+  ESP_LOGD(TAG, "%s, polling every %.1fs", active ? "Pack active" : "Pack in standby", interval / 1000.0f);
+  this->set_update_interval(interval);
+  this->start_poller();
+  if (active) {
+    // catch the start of the load step instead of waiting for the next interval
+    this->schedule_tier_(DALY_TIER_FAST);
+  }
+}
+
+void DalyBmsComponent::set_charging_mos(bool enabled) {
+  const uint8_t data[8] = {enabled};
+  this->queue_write_(DALY_COMMAND_CHARGING_MOS, data, enabled ? DALY_PRIORITY_MOS_ON : DALY_PRIORITY_MOS_OFF);
+}
+
+void DalyBmsComponent::set_discharging_mos(bool enabled) {
+  const uint8_t data[8] = {enabled};
+  this->queue_write_(DALY_COMMAND_DISCHARGING_MOS, data, enabled ? DALY_PRIORITY_MOS_ON : DALY_PRIORITY_MOS_OFF);
+}
+
+void DalyBmsComponent::set_soc(float soc) {
+  // the first six bytes would carry a date, the BMS ignores them
+  const uint16_t value = lroundf(clamp(soc, 0.0f, 100.0f) * 10);
+  const uint8_t data[8] = {0, 0, 0, 0, 0, 0, (uint8_t) (value >> 8), (uint8_t) (value & 0xFF)};
+  this->queue_write_(DALY_COMMAND_SET_SOC, data, DALY_PRIORITY_SOC);
+}
+
+void DalyBmsComponent::reset_bms() {
+  const uint8_t data[8] = {};
+  this->queue_write_(DALY_COMMAND_RESET, data, DALY_PRIORITY_RESET);
+}
+
+void DalyBmsComponent::queue_write_(uint8_t data_id, const uint8_t *data, uint8_t priority) {
+  if (this->protocol_ == DALY_PROTOCOL_MODBUS) {
+    ESP_LOGW(TAG, "Command 0x%02X is not supported over Modbus", data_id);
+    return;
+  }
+  // a newer command replaces a queued one with the same ID, so the queue holds at most one per command
+  for (auto it = this->write_queue_.begin(); it != this->write_queue_.end(); ++it) {
+    if (it->frame[2] == data_id) {
+      this->write_queue_.erase(it);
+      break;
     }
-    this->data_.push_back(c);
-    if (this->data_.size() == 4)
-      this->data_count_ = c;
-    if ((this->data_.size() > 4) and (data_.size() == this->data_count_ + 5)) {
-      this->decode_data_(this->data_);
-      this->data_.clear();
-      this->receiving_ = false;
+  }
+  WriteRequest request;
+  request.priority = priority;
+  request.frame[0] = 0xA5;
+  request.frame[1] = this->addr_;
+  request.frame[2] = data_id;
+  request.frame[3] = 0x08;
+  memcpy(request.frame + 4, data, 8);
+  uint8_t checksum = 0;
+  for (uint8_t i = 0; i < DALY_FRAME_SIZE - 1; i++)
+    checksum += request.frame[i];
+  request.frame[12] = checksum;
+  auto pos = this->write_queue_.begin();
+  while (pos != this->write_queue_.end() && pos->priority <= priority)
+    ++pos;
+  this->write_queue_.insert(pos, request);
+  ESP_LOGD(TAG, "Queued command 0x%02X for 0x%02X", data_id, this->addr_);
+}
+
+void DalyBmsComponent::on_write_done_(uint8_t data_id, bool success) {
+  this->write_in_flight_ = false;
+  if (success && data_id == DALY_COMMAND_RESET) {
+    ESP_LOGD(TAG, "Reset sent to 0x%02X", this->addr_);
+  } else if (success) {
+    ESP_LOGD(TAG, "Command 0x%02X acknowledged by 0x%02X", data_id, this->addr_);
+  } else {
+    ESP_LOGW(TAG, "Command 0x%02X not acknowledged by 0x%02X", data_id, this->addr_);
+  }
+  this->write_callbacks_.call(data_id, success);
+  // read the MOS state and SOC back right away
+  this->schedule_tier_(DALY_TIER_FAST);
+}
+
+void DalyBmsComponent::integrate_(int32_t voltage, int32_t current) {
+  const uint32_t now_us = micros();
+  const uint32_t now_ms = millis();
+  if (this->has_sample_ && now_ms - this->last_sample_ms_ <= DALY_MAX_INTEGRATION_GAP) {
+    // trapezoid between the previous and this sample
+    const uint32_t dt = now_us - this->last_sample_us_;
+    const int64_t charge = ((int64_t) this->last_sample_current_ + current) * dt / 2;
+    const int64_t energy =
+        ((int64_t) this->last_sample_voltage_ * this->last_sample_current_ + (int64_t) voltage * current) * dt / 2;
+    if (charge >= 0) {
+      this->energy_.charge_in += charge;
+    } else {
+      this->energy_.charge_out += -charge;
+    }
+    if (energy >= 0) {
+      this->energy_.energy_in += energy;
+    } else {
+      this->energy_.energy_out += -energy;
+    }
+    if (this->session_state_ != 0) {
+      this->session_charge_ += std::abs(charge);
+      this->session_energy_ += std::abs(energy);
     }
   }
+  this->has_sample_ = true;
+  this->last_sample_us_ = now_us;
+  this->last_sample_ms_ = now_ms;
+  this->last_sample_voltage_ = voltage;
+  this->last_sample_current_ = current;
+  this->publish_energy_();
+}
 
-  if (this->trigger_next_) {
-    this->trigger_next_ = false;
-    switch (this->next_request_) {
-      case 0:
-        this->request_data_(DALY_REQUEST_BATTERY_LEVEL);
-        this->next_request_ = 1;
-        break;
-      case 1:
-        this->request_data_(DALY_REQUEST_MIN_MAX_VOLTAGE);
-        this->next_request_ = 2;
-        break;
-      case 2:
-        this->request_data_(DALY_REQUEST_MIN_MAX_TEMPERATURE);
-        this->next_request_ = 3;
-        break;
-      case 3:
-        this->request_data_(DALY_REQUEST_MOS);
-        this->next_request_ = 4;
-        break;
-      case 4:
-        this->request_data_(DALY_REQUEST_STATUS);
-        this->next_request_ = 5;
-        break;
-      case 5:
-        this->request_data_(DALY_REQUEST_CELL_VOLTAGE);
-        this->next_request_ = 6;
-        break;
-      case 6:
-        this->request_data_(DALY_REQUEST_TEMPERATURE);
-        this->next_request_ = 7;
-        break;
-      case 7:
-        this->request_data_(DALY_REQUEST_BALANCE);
-        this->next_request_ = 8;
-        break;
-      case 8:
-        this->request_data_(DALY_REQUEST_FAILURE_STATUS);
-        this->next_request_ = 9;
-        break;
-      case 9:
-        this->request_data_(DALY_REQUEST_CELL_THRESHOLDS);
-        this->next_request_ = 10;
-        break;
-      case 10:
-        this->request_data_(DALY_REQUEST_PACK_THRESHOLDS);
-        this->next_request_ = 11;
-        break;
-      case 11:
-        this->request_data_(DALY_REQUEST_REST_THRESHOLDS);
-        this->next_request_ = 12;
-        break;
-      case 12:
-        this->request_data_(DALY_REQUEST_CAPACITY_NOMINAL_VOLTAGE);
-        this->next_request_ = 13;
-        break;
-      case 13:
-      default:
-        break;
+void DalyBmsComponent::publish_energy_() {
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_BATTERY_LEVEL)
+  if (this->charged_capacity_sensor_) {
+    this->charged_capacity_sensor_->publish_raw(this->energy_.charge_in / DALY_CHARGE_PER_CENTI_AH, 100);
+  }
+  if (this->discharged_capacity_sensor_) {
+    this->discharged_capacity_sensor_->publish_raw(this->energy_.charge_out / DALY_CHARGE_PER_CENTI_AH, 100);
+  }
+  // energy in kWh
+  if (this->charged_energy_sensor_) {
+    this->charged_energy_sensor_->publish_raw(this->energy_.energy_in / DALY_ENERGY_PER_WH, 1000);
+  }
+  if (this->discharged_energy_sensor_) {
+    this->discharged_energy_sensor_->publish_raw(this->energy_.energy_out / DALY_ENERGY_PER_WH, 1000);
+  }
+  if (this->session_capacity_sensor_) {
+    this->session_capacity_sensor_->publish_raw(this->session_charge_ / DALY_CHARGE_PER_CENTI_AH, 100);
+  }
+  if (this->session_energy_sensor_) {
+    this->session_energy_sensor_->publish_raw(this->session_energy_ / DALY_ENERGY_PER_WH, 1000);
+  }
+#endif
+}
+
+void DalyBmsComponent::save_energy_() {
+  if (!this->energy_enabled_ || memcmp(&this->energy_, &this->saved_energy_, sizeof(DalyEnergyState)) == 0)
+    return;
+  if (this->energy_pref_.save(&this->energy_))
+    this->saved_energy_ = this->energy_;
+}
+
+void DalyBmsComponent::reset_energy() {
+  ESP_LOGI(TAG, "Resetting charge and energy totals of 0x%02X", this->addr_);
+  this->energy_ = {};
+  this->session_charge_ = 0;
+  this->session_energy_ = 0;
+  this->save_energy_();
+  this->publish_energy_();
+}
+
+#ifdef USE_DALY_BMS_HISTORY
+// ms between two batches of a dump, so the logger and the API get to send each batch first
+static const uint32_t DALY_HISTORY_DUMP_INTERVAL = 50;
+
+void DalyBmsComponent::dump_history(uint16_t batch_size) {
+  if (!this->history_.is_ready()) {
+    ESP_LOGW(TAG, "No history for 0x%02X", this->addr_);
+    return;
+  }
+  this->history_.rewind(this->history_cursor_);
+  this->history_dump_time_ = millis();
+  ESP_LOGI(TAG, "History of 0x%02X: %u records, %u of %u bytes, times relative to now", this->addr_,
+           (unsigned) this->history_.records(), (unsigned) this->history_.used(),
+           (unsigned) this->history_.capacity());
+  // a dump that is still running starts over
+  this->set_interval("history_dump", DALY_HISTORY_DUMP_INTERVAL,
+                     [this, batch_size]() { this->dump_history_batch_(std::max<uint16_t>(batch_size, 1)); });
+}
+
+void DalyBmsComponent::dump_history_batch_(uint16_t batch_size) {
+  DalyHistoryRecord record;
+  char line[16 + DALY_HISTORY_MAX_VALUES * 7];
+  for (uint16_t i = 0; i < batch_size; i++) {
+    if (!this->history_.next(this->history_cursor_, record)) {
+      if (this->history_cursor_.lost_blocks != 0) {
+        ESP_LOGW(TAG, "%u blocks were overwritten during the dump", (unsigned) this->history_cursor_.lost_blocks);
+      }
+      ESP_LOGI(TAG, "End of history of 0x%02X", this->addr_);
+      this->cancel_interval("history_dump");
+      return;
     }
+    const float age = (int32_t) (record.time - this->history_dump_time_) / 1000.0f;
+    if (record.type == DALY_HISTORY_PACK) {
+      ESP_LOGI(TAG, "%+10.3fs pack %.1f V %.1f A %.1f %%", age, record.values[0] / 10.0f, record.values[1] / 10.0f,
+               record.values[2] / 10.0f);
+      continue;
+    }
+    size_t len = snprintf(line, sizeof(line), "%s", record.type == DALY_HISTORY_CELLS ? "cells mV" : "temperatures °C");
+    for (uint8_t value = 0; value < record.count && len < sizeof(line); value++)
+      len += snprintf(line + len, sizeof(line) - len, " %d", (int) record.values[value]);
+    ESP_LOGI(TAG, "%+10.3fs %s", age, line);
   }
 }
 
-float DalyBmsComponent::get_setup_priority() const { return setup_priority::DATA; }
+void DalyBmsComponent::clear_history() {
+  ESP_LOGI(TAG, "Clearing history of 0x%02X", this->addr_);
+  this->cancel_interval("history_dump");
+  this->history_.clear();
+}
+#endif
 
-void DalyBmsComponent::request_data_(uint8_t data_id) {
-  uint8_t request_message[DALY_FRAME_SIZE];
+bool DalyBmsComponent::on_request_sent(uint8_t data_id) {
+  if (data_id != DALY_COMMAND_RESET)
+    return true;
+  // the BMS restarts and often does not get to acknowledge it, so the reset is done once it is on the line
+  this->on_write_done_(data_id, true);
+  return false;
+}
 
-  request_message[0] = 0xA5;         // Start Flag
-  request_message[1] = this->addr_;  // Communication Module Address
-  request_message[2] = data_id;      // Data ID
-  request_message[3] = 0x08;         // Data Length (Fixed)
-  request_message[4] = 0x00;         // Empty Data
-  request_message[5] = 0x00;         //     |
-  request_message[6] = 0x00;         //     |
-  request_message[7] = 0x00;         //     |
-  request_message[8] = 0x00;         //     |
-  request_message[9] = 0x00;         //     |
-  request_message[10] = 0x00;        //     |
-  request_message[11] = 0x00;        // Empty Data
+const uint8_t *DalyBmsComponent::next_request() {
+  if (!this->write_queue_.empty()) {
+    memcpy(this->write_frame_, this->write_queue_.front().frame, DALY_FRAME_SIZE);
+    this->write_queue_.erase(this->write_queue_.begin());
+    this->write_in_flight_ = true;
+    return this->write_frame_;
+  }
+  if (this->pending_requests_ == 0)
+    return nullptr;
+  if (this->protocol_ == DALY_PROTOCOL_MODBUS)
+    return this->next_modbus_request_();
+  uint8_t i = 0;
+  while ((this->pending_requests_ & (1 << i)) == 0)
+    i++;
+  this->pending_requests_ &= ~(1 << i);
+  // a new reply starts a new snapshot
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+  if (DALY_REQUESTS[i].data_id == DALY_REQUEST_CELL_VOLTAGE)
+    this->snapshot_.cell_frames = 0;
+#endif
+#ifdef USE_DALY_BMS_TEMPERATURE
+  if (DALY_REQUESTS[i].data_id == DALY_REQUEST_TEMPERATURE)
+    this->snapshot_.temperature_frames = 0;
+#endif
+  return this->request_frames_[i];
+}
 
-  request_message[12] = (uint8_t) (request_message[0] + request_message[1] + request_message[2] +
-                                   request_message[3]);  // Checksum (Lower byte of the other bytes sum)
+uint16_t DalyBmsComponent::covered_requests_(uint8_t data_id) const {
+  uint16_t covered = 0;
+  switch (data_id) {
+    case DALY_MODBUS_READ_PACK:
+      for (uint8_t id : {DALY_REQUEST_BATTERY_LEVEL, DALY_REQUEST_MIN_MAX_VOLTAGE, DALY_REQUEST_MIN_MAX_TEMPERATURE,
+                         DALY_REQUEST_MOS, DALY_REQUEST_STATUS, DALY_REQUEST_TEMPERATURE, DALY_REQUEST_BALANCE})
+        covered |= 1 << request_index(id);
+      return covered & this->enabled_requests_;
+    case DALY_MODBUS_READ_CELLS:
+      return (1 << request_index(DALY_REQUEST_CELL_VOLTAGE)) & this->enabled_requests_;
+    default: {
+      const int8_t index = request_index(data_id);
+      return index >= 0 ? 1 << index : 0;
+    }
+  }
+}
 
-  ESP_LOGV(TAG, "Request datapacket Nr %x", data_id);
-  this->write_array(request_message, sizeof(request_message));
-  this->flush();
+const uint8_t *DalyBmsComponent::next_modbus_request_() {
+  // everything but the cell voltages comes with the pack read
+  const uint16_t pack = this->covered_requests_(DALY_MODBUS_READ_PACK);
+  const uint16_t cells = this->covered_requests_(DALY_MODBUS_READ_CELLS);
+  if (this->pending_requests_ & pack) {
+    this->pending_requests_ &= ~pack;
+    return this->build_modbus_request_(DALY_MODBUS_READ_PACK, DALY_MODBUS_TEMPERATURES, DALY_MODBUS_PACK_COUNT);
+  }
+  if (this->pending_requests_ & cells) {
+    this->pending_requests_ &= ~cells;
+    // cut short behind the last cell the pack has
+    const uint16_t count = this->cells_number_ != 0 ? std::min(this->cells_number_, DALY_MAX_CELLS) : DALY_MAX_CELLS;
+    return this->build_modbus_request_(DALY_MODBUS_READ_CELLS, DALY_MODBUS_CELL_VOLTAGES, count);
+  }
+  // setup() left only what the two reads cover enabled
+  this->pending_requests_ = 0;
+  return nullptr;
 }
 
-void DalyBmsComponent::decode_data_(std::vector<uint8_t> data) {
-  auto it = data.begin();
+const uint8_t *DalyBmsComponent::build_modbus_request_(uint8_t read, uint16_t start, uint16_t count) {
+  this->modbus_read_ = read;
+  uint8_t *request = this->modbus_frame_;
+  request[0] = this->get_reply_address();  // slave address is the board number
+  request[1] = 0x03;                        // read holding registers
+  request[2] = start >> 8;
+  request[3] = start & 0xFF;
+  request[4] = count >> 8;
+  request[5] = count & 0xFF;
+  const uint16_t crc = crc16(request, 6);
+  request[6] = crc & 0xFF;
+  request[7] = crc >> 8;
+  return request;
+}
 
-  while ((it = std::find(it, data.end(), 0xA5)) != data.end()) {
-    if (data.end() - it >= DALY_FRAME_SIZE && it[1] == 0x01) {
-      uint8_t checksum;
-      int sum = 0;
-      for (int i = 0; i < 12; i++) {
-        sum += it[i];
-      }
-      checksum = sum;
+void DalyBmsComponent::decode_as_frame_(uint8_t data_id, const uint8_t *data) {
+  // frames nothing is configured for are skipped like in the daly protocol, e.g. 0x91 with local_min_max
+  const int8_t index = request_index(data_id);
+  if (index < 0 || (this->enabled_requests_ & (1 << index)) == 0)
+    return;
+  uint8_t frame[DALY_FRAME_SIZE] = {0xA5, this->get_reply_address(), data_id, 0x08};
+  memcpy(frame + 4, data, 8);
+  this->decode_data(frame);
+}
 
-      if (checksum == it[12]) {
-        switch (it[2]) {
-#ifdef USE_SENSOR
-            //================================== BATTERY_LEVEL = 0x90 ==================================
-          case DALY_REQUEST_BATTERY_LEVEL:
-            if (this->voltage_sensor_) {
-              this->voltage_sensor_->publish_state((float) encode_uint16(it[4], it[5]) / 10);
-            }
-            if (this->current_sensor_) {
-              this->current_sensor_->publish_state(((float) (encode_uint16(it[8], it[9]) - DALY_CURRENT_OFFSET) / 10));
-            }
-            if (this->power_sensor_) {
-              this->power_sensor_->publish_state(((float) (encode_uint16(it[4], it[5]) * (encode_uint16(it[8], it[9]) - DALY_CURRENT_OFFSET)) / 100));
-            }
-            if (this->battery_level_sensor_) {
-              this->battery_level_sensor_->publish_state((float) encode_uint16(it[10], it[11]) / 10);
-            }
-            break;
-            //================================== MIN_MAX_VOLTAGE = 0x91 ==================================
-          case DALY_REQUEST_MIN_MAX_VOLTAGE:
-            if (this->max_cell_voltage_sensor_) {
-              this->max_cell_voltage_sensor_->publish_state((float) encode_uint16(it[4], it[5]) / 1000);
-            }
-            if (this->max_cell_voltage_number_sensor_) {
-              this->max_cell_voltage_number_sensor_->publish_state(it[6]);
-            }
-            if (this->min_cell_voltage_sensor_) {
-              this->min_cell_voltage_sensor_->publish_state((float) encode_uint16(it[7], it[8]) / 1000);
-            }
-            if (this->min_cell_voltage_number_sensor_) {
-              this->min_cell_voltage_number_sensor_->publish_state(it[9]);
-            }
-            if (this->cell_voltage_difference_sensor_) {
-              this->cell_voltage_difference_sensor_->publish_state(((float) (encode_uint16(it[4], it[5]) - encode_uint16(it[7], it[8])) / 1000));
-            }
-            break;
-            //================================== MIN_MAX_TEMPERATURE = 0x92 ==================================
-          case DALY_REQUEST_MIN_MAX_TEMPERATURE:
-            if (this->max_temperature_sensor_) {
-              this->max_temperature_sensor_->publish_state(it[4] - DALY_TEMPERATURE_OFFSET);
-            }
-            if (this->max_temperature_probe_number_sensor_) {
-              this->max_temperature_probe_number_sensor_->publish_state(it[5]);
-            }
-            if (this->min_temperature_sensor_) {
-              this->min_temperature_sensor_->publish_state(it[6] - DALY_TEMPERATURE_OFFSET);
-            }
-            if (this->min_temperature_probe_number_sensor_) {
-              this->min_temperature_probe_number_sensor_->publish_state(it[7]);
-            }
-            break;
+void DalyBmsComponent::decode_modbus(uint8_t request, const uint8_t *registers, uint8_t count) {
+  if (request == DALY_MODBUS_READ_PACK) {
+    if (count < DALY_MODBUS_PACK_COUNT) {
+      ESP_LOGW(TAG, "Short Modbus pack read from 0x%02X (%u registers)", this->addr_, count);
+      return;
+    }
+    auto word = [registers](uint16_t reg) -> const uint8_t * {
+      return registers + 2 * (reg - DALY_MODBUS_TEMPERATURES);
+    };
+    auto low = [&word](uint16_t reg) { return word(reg)[1]; };
+
+    const uint8_t *voltage = word(DALY_MODBUS_VOLTAGE);
+    const uint8_t *current = word(DALY_MODBUS_CURRENT);
+    const uint8_t *soc = word(DALY_MODBUS_SOC);
+    const uint8_t battery_level[8] = {voltage[0], voltage[1], 0, 0, current[0], current[1], soc[0], soc[1]};
+    this->decode_as_frame_(DALY_REQUEST_BATTERY_LEVEL, battery_level);
+
+    const uint8_t *max_cell = word(DALY_MODBUS_MAX_CELL_VOLTAGE);
+    const uint8_t *min_cell = word(DALY_MODBUS_MIN_CELL_VOLTAGE);
+    const uint8_t min_max_voltage[8] = {max_cell[0], max_cell[1], low(DALY_MODBUS_MAX_CELL),
+                                        min_cell[0], min_cell[1], low(DALY_MODBUS_MIN_CELL)};
+    this->decode_as_frame_(DALY_REQUEST_MIN_MAX_VOLTAGE, min_max_voltage);
+
+    const uint8_t min_max_temperature[8] = {low(DALY_MODBUS_MAX_TEMPERATURE), low(DALY_MODBUS_MAX_PROBE),
+                                            low(DALY_MODBUS_MIN_TEMPERATURE), low(DALY_MODBUS_MIN_PROBE)};
+    this->decode_as_frame_(DALY_REQUEST_MIN_MAX_TEMPERATURE, min_max_temperature);
+
+    // 0.1 Ah to the mAh of 0x93, which also has a life counter Modbus does not
+    const uint32_t remaining =
+        encode_uint16(word(DALY_MODBUS_REMAINING_CAPACITY)[0], word(DALY_MODBUS_REMAINING_CAPACITY)[1]) * 100;
+    const uint8_t mos[8] = {low(DALY_MODBUS_STATE), low(DALY_MODBUS_CHARGING_MOS), low(DALY_MODBUS_DISCHARGING_MOS),
+                            0, uint8_t(remaining >> 24), uint8_t(remaining >> 16), uint8_t(remaining >> 8),
+                            uint8_t(remaining)};
+    this->decode_as_frame_(DALY_REQUEST_MOS, mos);
+
+    // the status first, the temperatures and balancing bits need the counts
+    const uint8_t *cycles = word(DALY_MODBUS_CYCLES);
+    const uint8_t status[8] = {low(DALY_MODBUS_CELLS), low(DALY_MODBUS_PROBES), 0, 0, 0, cycles[0], cycles[1]};
+    this->decode_as_frame_(DALY_REQUEST_STATUS, status);
+
+    uint8_t balance[8] = {};
+    for (uint8_t i = 0; i < 3; i++) {
+      balance[2 * i] = word(DALY_MODBUS_BALANCING + i)[1];
+      balance[2 * i + 1] = word(DALY_MODBUS_BALANCING + i)[0];
+    }
+    this->decode_as_frame_(DALY_REQUEST_BALANCE, balance);
+
+#ifdef USE_DALY_BMS_TEMPERATURE
+    if (this->enabled_requests_ & (1 << request_index(DALY_REQUEST_TEMPERATURE))) {
+      uint8_t probes = DALY_MODBUS_MAX_TEMPERATURES;
+      if (this->temperatures_number_ != 0)
+        probes = std::min(probes, this->temperatures_number_);
+      for (uint8_t i = 0; i < probes; i++)
+        this->snapshot_.temperatures[i] = low(DALY_MODBUS_TEMPERATURES + i) - DALY_TEMPERATURE_OFFSET;
+      this->snapshot_.temperature_frames =
+          (1 << ((probes + DALY_TEMPERATURES_PER_FRAME - 1) / DALY_TEMPERATURES_PER_FRAME)) - 1;
+      this->frames_decoded_++;
+      DalyCommandStats &stats = this->command_stats_[request_index(DALY_REQUEST_TEMPERATURE)];
+      stats.frames++;
+      stats.last_frame = millis();
+      this->publish_temperature_snapshot_();
+    }
+#endif
+    return;
+  }
+
+  if (request != DALY_MODBUS_READ_CELLS)
+    return;
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+  auto word = [registers](uint8_t reg) -> const uint8_t * { return registers + 2 * reg; };
+  // until the pack read has told the cell count, registers of missing cells read 0
+  uint8_t cells = std::min<uint8_t>(count, DALY_MAX_CELLS);
+  if (this->cells_number_ != 0) {
+    cells = std::min(cells, this->cells_number_);
+  } else {
+    while (cells != 0 && encode_uint16(word(cells - 1)[0], word(cells - 1)[1]) == 0)
+      cells--;
+    // stands in for the count until the next pack read
+    this->cells_number_ = cells;
+  }
+  if (cells != 0) {
+    for (uint8_t i = 0; i < cells; i++)
+      this->snapshot_.cell_voltages[i] = encode_uint16(word(i)[0], word(i)[1]);
+    this->snapshot_.cell_frames = (1UL << ((cells + DALY_CELLS_PER_FRAME - 1) / DALY_CELLS_PER_FRAME)) - 1;
+    this->frames_decoded_++;
+    DalyCommandStats &stats = this->command_stats_[request_index(DALY_REQUEST_CELL_VOLTAGE)];
+    stats.frames++;
+    stats.last_frame = millis();
+    this->publish_cell_snapshot_();
+  }
+#endif
+}
+
+void DalyBmsComponent::on_reply_complete(uint8_t data_id, uint32_t round_trip) {
+  uint8_t bucket = 0;
+  while (bucket < DALY_RTT_BUCKETS - 1 && round_trip >= DALY_RTT_BUCKET_LIMITS[bucket])
+    bucket++;
+  this->rtt_histogram_[bucket]++;
+  this->rtt_sum_ += round_trip;
+  this->rtt_count_++;
+  const uint16_t covered = this->covered_requests_(data_id);
+  for (uint8_t i = 0; i < DALY_REQUEST_COUNT; i++) {
+    if ((covered & (1 << i)) == 0)
+      continue;
+    DalyCommandStats &stats = this->command_stats_[i];
+    stats.replies++;
+    stats.rtt_sum += round_trip;
+    stats.rtt_max = std::max(stats.rtt_max, round_trip);
+  }
+
+  if (this->write_in_flight_ && is_write_command(data_id))
+    this->on_write_done_(data_id, true);
+
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+  if (data_id == DALY_REQUEST_CELL_VOLTAGE)
+    this->publish_cell_snapshot_();
+#endif
+#ifdef USE_DALY_BMS_TEMPERATURE
+  if (data_id == DALY_REQUEST_TEMPERATURE)
+    this->publish_temperature_snapshot_();
+#endif
+  this->on_sweep_done_();
+}
+
+void DalyBmsComponent::on_reply_timeout(uint8_t data_id) {
+  const uint16_t covered = this->covered_requests_(data_id);
+  for (uint8_t i = 0; i < DALY_REQUEST_COUNT; i++) {
+    if (covered & (1 << i))
+      this->command_stats_[i].timeouts++;
+  }
+  if (this->write_in_flight_ && is_write_command(data_id))
+    this->on_write_done_(data_id, false);
+
+  // a multi-frame reply may have stalled after the last frame we needed
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+  if (data_id == DALY_REQUEST_CELL_VOLTAGE)
+    this->publish_cell_snapshot_();
+#endif
+#ifdef USE_DALY_BMS_TEMPERATURE
+  if (data_id == DALY_REQUEST_TEMPERATURE)
+    this->publish_temperature_snapshot_();
+#endif
+  this->on_sweep_done_();
+}
+
+void DalyBmsComponent::on_sweep_done_() {
+  // a sweep ends when everything scheduled has been asked for and answered (or timed out)
+  if (this->pending_requests_ != 0 || !this->write_queue_.empty())
+    return;
+#if defined(USE_TEXT_SENSOR) && defined(USE_DALY_BMS_SNAPSHOT)
+  this->publish_snapshot_text_();
+#endif
+}
+
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_CELL_ANALYTICS)
+void DalyBmsComponent::publish_analytics_() {
+  const DalyCellAnalytics &analytics = this->analytics_;
+  const uint8_t cells = analytics.cells();
+  if (cells == 0)
+    return;
+  const float mean = analytics.mean();
+  uint8_t max_resistance_cell = 0;
+  uint8_t max_deviation_cell = 0;
+  bool has_resistance = false;
+  for (uint8_t cell = 0; cell < cells; cell++) {
+    // deviation in 0.1 mV, resistance in 0.01 mΩ
+    const float deviation = analytics.voltage(cell) - mean;
+    if (std::fabs(deviation) > std::fabs(analytics.voltage(max_deviation_cell) - mean))
+      max_deviation_cell = cell;
+    if (cell < this->cell_deviation_sensors_.size() && this->cell_deviation_sensors_[cell] != nullptr) {
+      this->cell_deviation_sensors_[cell]->publish_raw(lroundf(deviation * 10), 10);
+    }
+    const float resistance = analytics.resistance(cell);
+    if (std::isnan(resistance))
+      continue;
+    if (!has_resistance || resistance > analytics.resistance(max_resistance_cell))
+      max_resistance_cell = cell;
+    has_resistance = true;
+    if (cell < this->cell_resistance_sensors_.size() && this->cell_resistance_sensors_[cell] != nullptr) {
+      this->cell_resistance_sensors_[cell]->publish_raw(lroundf(resistance * 100), 100);
+    }
+  }
+  if (this->max_cell_deviation_sensor_) {
+    this->max_cell_deviation_sensor_->publish_raw(lroundf((analytics.voltage(max_deviation_cell) - mean) * 10), 10);
+  }
+  if (this->max_cell_deviation_number_sensor_) {
+    this->max_cell_deviation_number_sensor_->publish_raw(max_deviation_cell + 1);
+  }
+  if (!has_resistance)
+    return;
+  if (this->max_cell_resistance_sensor_) {
+    this->max_cell_resistance_sensor_->publish_raw(lroundf(analytics.resistance(max_resistance_cell) * 100), 100);
+  }
+  if (this->max_cell_resistance_number_sensor_) {
+    this->max_cell_resistance_number_sensor_->publish_raw(max_resistance_cell + 1);
+  }
+}
+#endif
+
+#if defined(USE_TEXT_SENSOR) && defined(USE_DALY_BMS_SNAPSHOT)
+// the snapshot JSON is built in a fixed buffer; `len` stops two bytes short of its end, for the closing brace
+static void append_json(char *json, size_t size, size_t *len, const char *format, ...)
+    __attribute__((format(printf, 4, 5)));
+static void append_json(char *json, size_t size, size_t *len, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  const int written = vsnprintf(json + *len, size - 1 - *len, format, args);
+  va_end(args);
+  if (written > 0)
+    *len = std::min(*len + written, size - 2);
+}
+
+static void append_json_hex(char *json, size_t size, size_t *len, const uint8_t *data, size_t count) {
+  static const char DIGITS[] = "0123456789abcdef";
+  for (size_t i = 0; i < count && *len + 2 <= size - 2; i++) {
+    json[(*len)++] = DIGITS[data[i] >> 4];
+    json[(*len)++] = DIGITS[data[i] & 0x0F];
+  }
+  json[*len] = '\0';
+}
+
+void DalyBmsComponent::publish_snapshot_text_() {
+  DalyPackSnapshot &snapshot = this->snapshot_;
+  const uint16_t received = snapshot.received;
+  const uint8_t cells = snapshot.cells;
+  const uint8_t probes = snapshot.probes;
+  snapshot.received = 0;
+  snapshot.cells = 0;
+  snapshot.probes = 0;
+  if (this->snapshot_text_sensor_ == nullptr || (received == 0 && cells == 0 && probes == 0))
+    return;
+  auto payload = [&](uint8_t data_id) -> const uint8_t * {
+    const int8_t index = request_index(data_id);
+    return index >= 0 && (received & (1 << index)) ? snapshot.payloads[index] : nullptr;
+  };
+
+  // short keys and protocol integers where the unit is obvious, only what this sweep brought in. Every field
+  // starts with a comma, the first one becomes the opening brace. Sized for all fields at their widest with 48
+  // cells and 16 probes; should it still run full, the fields are cut short but the brace closes.
+  char json[768] = "{";
+  size_t len = 0;
+  if (const uint8_t *it = payload(DALY_REQUEST_BATTERY_LEVEL)) {
+    append_json(json, sizeof(json), &len, ",\"v\":%.1f,\"i\":%.1f,\"soc\":%.1f", encode_uint16(it[0], it[1]) / 10.0f,
+                (encode_uint16(it[4], it[5]) - DALY_CURRENT_OFFSET) / 10.0f, encode_uint16(it[6], it[7]) / 10.0f);
+  }
+  if (const uint8_t *it = payload(DALY_REQUEST_MOS)) {
+    append_json(json, sizeof(json), &len, ",\"state\":%u,\"chg\":%u,\"dsg\":%u,\"mah\":%u", it[0], it[1], it[2],
+                (unsigned) encode_uint32(it[4], it[5], it[6], it[7]));
+  }
+  if (const uint8_t *it = payload(DALY_REQUEST_STATUS)) {
+    append_json(json, sizeof(json), &len, ",\"cycles\":%u", encode_uint16(it[5], it[6]));
+  }
+  if (const uint8_t *it = payload(DALY_REQUEST_BALANCE)) {
+    // bitmaps as hex in frame byte order
+    append_json(json, sizeof(json), &len, ",\"bal\":\"");
+    append_json_hex(json, sizeof(json), &len, it, DALY_MAX_CELLS / 8);
+    append_json(json, sizeof(json), &len, "\"");
+  }
+  if (const uint8_t *it = payload(DALY_REQUEST_FAILURE_STATUS)) {
+    append_json(json, sizeof(json), &len, ",\"alarms\":\"");
+    append_json_hex(json, sizeof(json), &len, it, DALY_FAILURE_BYTES);
+    append_json(json, sizeof(json), &len, "\"");
+  }
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+  if (cells != 0) {
+    append_json(json, sizeof(json), &len, ",\"mv\":[");
+    for (uint8_t cell = 0; cell < cells; cell++)
+      append_json(json, sizeof(json), &len, cell == 0 ? "%u" : ",%u", snapshot.cell_voltages[cell]);
+    append_json(json, sizeof(json), &len, "]");
+  }
+#endif
+#ifdef USE_DALY_BMS_TEMPERATURE
+  if (probes != 0) {
+    append_json(json, sizeof(json), &len, ",\"temp\":[");
+    for (uint8_t probe = 0; probe < probes; probe++)
+      append_json(json, sizeof(json), &len, probe == 0 ? "%d" : ",%d", snapshot.temperatures[probe]);
+    append_json(json, sizeof(json), &len, "]");
+  }
+#endif
+  json[0] = '{';
+  // append_json() leaves room for the brace
+  len = std::max<size_t>(len, 1);
+  json[len] = '}';
+  json[len + 1] = '\0';
+  // an unchanged pack does not need another message
+  if (this->snapshot_text_sensor_->has_state() && this->snapshot_text_sensor_->state == json)
+    return;
+  this->snapshot_text_sensor_->publish_state(json);
+}
+#endif
+
+#ifdef USE_DALY_BMS_FAILURE_STATUS
+void DalyBmsComponent::decode_failures_(const uint8_t *it) {
+  DalyFailureBits bits;
+  std::copy(it + 4, it + 4 + DALY_FAILURE_BYTES, bits.begin());
+  // the bits start out all clear, automations only hear about changes
+  if (!this->has_failure_bits_ || bits != this->failure_bits_) {
+    DalyFailureBits raised;
+    DalyFailureBits cleared;
+    for (uint8_t i = 0; i < DALY_FAILURE_BYTES; i++) {
+      raised[i] = bits[i] & ~this->failure_bits_[i];
+      cleared[i] = ~bits[i] & this->failure_bits_[i];
+    }
+#ifdef USE_TEXT_SENSOR
+    std::string summary;
+#endif
+    for (uint8_t bit = 0; bit < DALY_FAILURE_BITS; bit++) {
+      const char *name = DALY_FAILURE_NAMES[bit] != nullptr ? DALY_FAILURE_NAMES[bit] : "Unknown failure";
+      const uint8_t mask = 1 << (bit % 8);
+      if (raised[bit / 8] & mask)
+        ESP_LOGW(TAG, "0x%02X: %s", this->addr_, name);
+      if (cleared[bit / 8] & mask)
+        ESP_LOGI(TAG, "0x%02X: %s cleared", this->addr_, name);
+#ifdef USE_TEXT_SENSOR
+      if (bits[bit / 8] & mask) {
+        if (!summary.empty())
+          summary += ", ";
+        summary += name;
+      }
 #endif
-            // ================================== MOS = 0x93 ==================================
-          case DALY_REQUEST_MOS:
+    }
 #ifdef USE_TEXT_SENSOR
-            if (this->status_text_sensor_ != nullptr) {
-              switch (it[4]) {
-                case 0:
-                  this->status_text_sensor_->publish_state("Standby");
-                  break;
-                case 1:
-                  this->status_text_sensor_->publish_state("Charging");
-                  break;
-                case 2:
-                  this->status_text_sensor_->publish_state("Discharging");
-                  break;
-                default:
-                  break;
-              }
-            }
+    if (this->failures_text_sensor_ != nullptr) {
+      this->failures_text_sensor_->publish_state(summary.empty() ? "OK" : summary);
+    }
 #endif
+    const bool changed = bits != this->failure_bits_;
+    this->failure_bits_ = bits;
+    this->has_failure_bits_ = true;
+    if (changed)
+      this->failure_callbacks_.call(bits, raised, cleared);
+  }
+
 #ifdef USE_BINARY_SENSOR
-            if (this->charging_mos_enabled_binary_sensor_) {
-              this->charging_mos_enabled_binary_sensor_->publish_state(it[5]);
-            }
-            if (this->discharging_mos_enabled_binary_sensor_) {
-              this->discharging_mos_enabled_binary_sensor_->publish_state(it[6]);
-            }
+  for (uint8_t bit = 0; bit < this->failure_binary_sensors_.size(); bit++) {
+    if (this->failure_binary_sensors_[bit] != nullptr) {
+      this->failure_binary_sensors_[bit]->publish_raw(bits[bit / 8] & (1 << (bit % 8)));
+    }
+  }
 #endif
 #ifdef USE_SENSOR
-            if (this->remaining_capacity_sensor_) {
-              this->remaining_capacity_sensor_->publish_state((float) encode_uint32(it[8], it[9], it[10], it[11]) / 1000);
-            }
-			if (this->bms_watchdog_sensor_) {
-              this->bms_watchdog_sensor_->publish_state(it[7]);
-            }
+  if (this->fehlercode_sensor_) {
+    this->fehlercode_sensor_->publish_raw(it[11]);
+  }
 #endif
-            break;
-            // ================================== STATUS = 0x94 ==================================
+}
+#endif
+
+#if defined(USE_BINARY_SENSOR) && defined(USE_DALY_BMS_BALANCE)
+void DalyBmsComponent::decode_balance_(const uint8_t *it) {
+  // bytes 0-5 are a bitmap of the cells being balanced, bit 0 of the first byte is cell 1
+  uint64_t bits = 0;
+  for (uint8_t i = 0; i < DALY_MAX_CELLS / 8; i++)
+    bits |= (uint64_t) it[4 + i] << (8 * i);
+  // bits past the cell count are whatever the BMS left there
+  const uint8_t cells = this->cells_number_ != 0 ? std::min(this->cells_number_, DALY_MAX_CELLS) : DALY_MAX_CELLS;
+  bits &= (UINT64_C(1) << cells) - 1;
+  const uint64_t changed = this->has_balance_bits_ ? bits ^ this->balance_bits_ : ~UINT64_C(0);
+  this->balance_bits_ = bits;
+  this->has_balance_bits_ = true;
+
+  const uint8_t count = std::min<size_t>(cells, this->cell_balance_binary_sensors_.size());
+  for (uint8_t cell = 0; cell < count; cell++) {
+    DalyBinarySensor *binary_sensor = this->cell_balance_binary_sensors_[cell];
+    // only changed cells, unless the sensor wants its heartbeat
+    if (binary_sensor == nullptr || (!((changed >> cell) & 1) && !binary_sensor->has_heartbeat()))
+      continue;
+    binary_sensor->publish_raw((bits >> cell) & 1);
+  }
+}
+#endif
+
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+void DalyBmsComponent::publish_cell_snapshot_() {
+  const uint32_t received = this->snapshot_.cell_frames;
+  this->snapshot_.cell_frames = 0;
+  if (received == 0)
+    return;
+  // without the cell count from 0x94 the highest frame number tells how many cells there are
+  uint8_t frames = (this->cells_number_ + DALY_CELLS_PER_FRAME - 1) / DALY_CELLS_PER_FRAME;
+  if (this->cells_number_ == 0) {
+    while (received >> frames)
+      frames++;
+  }
+  frames = std::min<uint8_t>(frames, DALY_MAX_CELLS / DALY_CELLS_PER_FRAME);
+  const uint32_t expected = (1UL << frames) - 1;
+  if ((received & expected) != expected) {
+    ESP_LOGW(TAG, "Incomplete cell voltage reply, dropping it");
+    return;
+  }
+  const uint8_t cells = std::min<uint8_t>(
+      this->cells_number_ != 0 ? this->cells_number_ : frames * DALY_CELLS_PER_FRAME, DALY_MAX_CELLS);
+#ifdef USE_DALY_BMS_SNAPSHOT
+  this->snapshot_.cells = cells;
+#endif
+#ifdef USE_DALY_BMS_CELL_ANALYTICS
+  this->analytics_.add_cells(this->snapshot_.cell_voltages, cells, millis());
+#endif
+#ifdef USE_DALY_BMS_HISTORY
+  int32_t voltages[DALY_MAX_CELLS];
+  std::copy(this->snapshot_.cell_voltages, this->snapshot_.cell_voltages + cells, voltages);
+  this->history_.record(DALY_HISTORY_CELLS, millis(), voltages, cells);
+#endif
+
 #ifdef USE_SENSOR
-          case DALY_REQUEST_STATUS:
-            if (this->cells_number_sensor_) {
-              this->cells_number_sensor_->publish_state(it[4]);
-            }
-            if (this->cycle_sensor_) {
-              this->cycle_sensor_->publish_state((int) encode_uint16(it[9], it[10]));
-            }
-            break;
-            //================================== TEMPERATURE = 0x96 ==================================
-          case DALY_REQUEST_TEMPERATURE:
-              
-            if (this->temperature_1_sensor_) {
-                this->temperature_1_sensor_->publish_state(it[5] - DALY_TEMPERATURE_OFFSET);
-            }
-            if (this->temperature_2_sensor_) {
-                this->temperature_2_sensor_->publish_state(it[6] - DALY_TEMPERATURE_OFFSET);
-            }
-            break;
-            //================================== CELL VOLTAGE 0x95 ==================================
-          case DALY_REQUEST_CELL_VOLTAGE:
-            switch (it[4]) {
-              case 1:
-                if (this->cell_1_voltage_sensor_) {
-                  this->cell_1_voltage_sensor_->publish_state((float) encode_uint16(it[5], it[6]) / 1000);
-                }
-                if (this->cell_2_voltage_sensor_) {
-                  this->cell_2_voltage_sensor_->publish_state((float) encode_uint16(it[7], it[8]) / 1000);
-                }
-                if (this->cell_3_voltage_sensor_) {
-                  this->cell_3_voltage_sensor_->publish_state((float) encode_uint16(it[9], it[10]) / 1000);
-                }
-                break;
-              case 2:
-                if (this->cell_4_voltage_sensor_) {
-                  this->cell_4_voltage_sensor_->publish_state((float) encode_uint16(it[5], it[6]) / 1000);
-                }
-                if (this->cell_5_voltage_sensor_) {
-                  this->cell_5_voltage_sensor_->publish_state((float) encode_uint16(it[7], it[8]) / 1000);
-                }
-                if (this->cell_6_voltage_sensor_) {
-                  this->cell_6_voltage_sensor_->publish_state((float) encode_uint16(it[9], it[10]) / 1000);
-                }
-                break;
-              case 3:
-                if (this->cell_7_voltage_sensor_) {
-                  this->cell_7_voltage_sensor_->publish_state((float) encode_uint16(it[5], it[6]) / 1000);
-                }
-                if (this->cell_8_voltage_sensor_) {
-                  this->cell_8_voltage_sensor_->publish_state((float) encode_uint16(it[7], it[8]) / 1000);
-                }
-                if (this->cell_9_voltage_sensor_) {
-                  this->cell_9_voltage_sensor_->publish_state((float) encode_uint16(it[9], it[10]) / 1000);
-                }
-                break;
-              case 4:
-                if (this->cell_10_voltage_sensor_) {
-                  this->cell_10_voltage_sensor_->publish_state((float) encode_uint16(it[5], it[6]) / 1000);
-                }
-                if (this->cell_11_voltage_sensor_) {
-                  this->cell_11_voltage_sensor_->publish_state((float) encode_uint16(it[7], it[8]) / 1000);
-                }
-                if (this->cell_12_voltage_sensor_) {
-                  this->cell_12_voltage_sensor_->publish_state((float) encode_uint16(it[9], it[10]) / 1000);
-                }
-                break;
-              case 5:
-                if (this->cell_13_voltage_sensor_) {
-                  this->cell_13_voltage_sensor_->publish_state((float) encode_uint16(it[5], it[6]) / 1000);
-                }
-                if (this->cell_14_voltage_sensor_) {
-                  this->cell_14_voltage_sensor_->publish_state((float) encode_uint16(it[7], it[8]) / 1000);
-                }
-                if (this->cell_15_voltage_sensor_) {
-                  this->cell_15_voltage_sensor_->publish_state((float) encode_uint16(it[9], it[10]) / 1000);
-                }
-                break;
-              case 6:
-                if (this->cell_16_voltage_sensor_) {
-                  this->cell_16_voltage_sensor_->publish_state((float) encode_uint16(it[5], it[6]) / 1000);
-                }
-                break;
-              default:
-                break;
-            }
+  // one pass for min, max and sum, then everything goes out together
+  uint8_t min_cell = 0;
+  uint8_t max_cell = 0;
+  uint32_t sum = 0;
+  for (uint8_t cell = 0; cell < cells; cell++) {
+    const uint16_t voltage = this->snapshot_.cell_voltages[cell];
+    if (voltage < this->snapshot_.cell_voltages[min_cell])
+      min_cell = cell;
+    if (voltage > this->snapshot_.cell_voltages[max_cell])
+      max_cell = cell;
+    sum += voltage;
+    if (cell < this->cell_voltage_sensors_.size() && this->cell_voltage_sensors_[cell] != nullptr) {
+      this->cell_voltage_sensors_[cell]->publish_raw(voltage, 1000);
+    }
+  }
+  const uint16_t min_voltage = this->snapshot_.cell_voltages[min_cell];
+  const uint16_t max_voltage = this->snapshot_.cell_voltages[max_cell];
+  if (this->average_cell_voltage_sensor_) {
+    // in 0.1 mV so the average keeps a digit more than the cells
+    this->average_cell_voltage_sensor_->publish_raw(sum * 10 / cells, 10000);
+  }
+  if (!this->local_min_max_)
+    return;
+  if (this->max_cell_voltage_sensor_) {
+    this->max_cell_voltage_sensor_->publish_raw(max_voltage, 1000);
+  }
+  if (this->max_cell_voltage_number_sensor_) {
+    this->max_cell_voltage_number_sensor_->publish_raw(max_cell + 1);
+  }
+  if (this->min_cell_voltage_sensor_) {
+    this->min_cell_voltage_sensor_->publish_raw(min_voltage, 1000);
+  }
+  if (this->min_cell_voltage_number_sensor_) {
+    this->min_cell_voltage_number_sensor_->publish_raw(min_cell + 1);
+  }
+  if (this->cell_voltage_difference_sensor_) {
+    this->cell_voltage_difference_sensor_->publish_raw(max_voltage - min_voltage, 1000);
+  }
+#endif
+}
+#endif
+
+#ifdef USE_DALY_BMS_TEMPERATURE
+void DalyBmsComponent::publish_temperature_snapshot_() {
+  const uint8_t received = this->snapshot_.temperature_frames;
+  this->snapshot_.temperature_frames = 0;
+  if (received == 0)
+    return;
+  uint8_t frames =
+      (this->temperatures_number_ + DALY_TEMPERATURES_PER_FRAME - 1) / DALY_TEMPERATURES_PER_FRAME;
+  if (this->temperatures_number_ == 0) {
+    while (received >> frames)
+      frames++;
+  }
+  // probes beyond DALY_MAX_TEMPERATURES are not kept, their frames are not waited for
+  frames = std::min(frames, DALY_MAX_TEMPERATURE_FRAMES);
+  const uint8_t expected = (1 << frames) - 1;
+  if ((received & expected) != expected) {
+    ESP_LOGW(TAG, "Incomplete temperature reply, dropping it");
+    return;
+  }
+  const uint8_t probes =
+      std::min<uint8_t>(this->temperatures_number_ != 0 ? this->temperatures_number_
+                                                        : frames * DALY_TEMPERATURES_PER_FRAME,
+                        DALY_MAX_TEMPERATURES);
+#ifdef USE_DALY_BMS_SNAPSHOT
+  this->snapshot_.probes = probes;
+#endif
+#ifdef USE_DALY_BMS_HISTORY
+  int32_t probe_temperatures[DALY_MAX_TEMPERATURES];
+  std::copy(this->snapshot_.temperatures, this->snapshot_.temperatures + probes, probe_temperatures);
+  this->history_.record(DALY_HISTORY_TEMPERATURES, millis(), probe_temperatures, probes);
+#endif
+
+#ifdef USE_SENSOR
+  // one pass for the probes and their min/max, like the cells
+  const int8_t *temperatures = this->snapshot_.temperatures;
+  uint8_t min_probe = 0;
+  uint8_t max_probe = 0;
+  for (uint8_t probe = 0; probe < probes; probe++) {
+    if (temperatures[probe] < temperatures[min_probe])
+      min_probe = probe;
+    if (temperatures[probe] > temperatures[max_probe])
+      max_probe = probe;
+    if (probe < this->temperature_sensors_.size() && this->temperature_sensors_[probe] != nullptr) {
+      this->temperature_sensors_[probe]->publish_raw(temperatures[probe]);
+    }
+  }
+  if (!this->local_min_max_)
+    return;
+  if (this->max_temperature_sensor_) {
+    this->max_temperature_sensor_->publish_raw(temperatures[max_probe]);
+  }
+  if (this->max_temperature_probe_number_sensor_) {
+    this->max_temperature_probe_number_sensor_->publish_raw(max_probe + 1);
+  }
+  if (this->min_temperature_sensor_) {
+    this->min_temperature_sensor_->publish_raw(temperatures[min_probe]);
+  }
+  if (this->min_temperature_probe_number_sensor_) {
+    this->min_temperature_probe_number_sensor_->publish_raw(min_probe + 1);
+  }
+#endif
+}
+#endif
+
+void DalyBmsComponent::on_checksum_error(uint8_t data_id) {
+  const uint16_t covered = this->covered_requests_(data_id);
+  for (uint8_t i = 0; i < DALY_REQUEST_COUNT; i++) {
+    if (covered & (1 << i))
+      this->command_stats_[i].checksum_errors++;
+  }
+}
+
+void DalyBmsComponent::on_resync(uint8_t data_id) {
+  const uint16_t covered = this->covered_requests_(data_id);
+  for (uint8_t i = 0; i < DALY_REQUEST_COUNT; i++) {
+    if (covered & (1 << i))
+      this->command_stats_[i].resyncs++;
+  }
+}
 
+void DalyBmsComponent::publish_diagnostics_() {
+  const uint32_t now = millis();
+  uint32_t timeouts = 0;
+  uint32_t checksum_errors = 0;
+  uint32_t resyncs = 0;
+  uint32_t last_frame = 0;
+  const uint32_t elapsed = this->diagnostics_time_ != 0 ? now - this->diagnostics_time_ : 0;
+  for (uint8_t i = 0; i < DALY_REQUEST_COUNT; i++) {
+    const DalyCommandStats &stats = this->command_stats_[i];
+    timeouts += stats.timeouts;
+    checksum_errors += stats.checksum_errors;
+    resyncs += stats.resyncs;
+    if (stats.last_frame != 0 && (last_frame == 0 || now - stats.last_frame < now - last_frame))
+      last_frame = stats.last_frame;
+    ESP_LOGV(TAG,
+             "0x%02X: %u timeouts, %u checksum errors, %u resyncs, round trip %ums mean %ums max, last frame %us ago",
+             DALY_REQUESTS[i].data_id, (unsigned) stats.timeouts, (unsigned) stats.checksum_errors,
+             (unsigned) stats.resyncs, stats.replies == 0 ? 0u : (unsigned) (stats.rtt_sum / stats.replies),
+             (unsigned) stats.rtt_max, stats.last_frame == 0 ? 0u : (unsigned) ((now - stats.last_frame) / 1000));
+#ifdef USE_SENSOR
+    if (this->command_frame_rate_sensors_[i] != nullptr && elapsed != 0) {
+      this->command_frame_rate_sensors_[i]->publish_raw(
+          (stats.frames - this->diagnostics_command_frames_[i]) * 1000 * 10 / elapsed, 10);
+    }
 #endif
+    this->diagnostics_command_frames_[i] = stats.frames;
+  }
+  ESP_LOGV(TAG, "Round trip <20ms: %u, <40ms: %u, <80ms: %u, <160ms: %u, <320ms: %u, more: %u",
+           (unsigned) this->rtt_histogram_[0], (unsigned) this->rtt_histogram_[1], (unsigned) this->rtt_histogram_[2],
+           (unsigned) this->rtt_histogram_[3], (unsigned) this->rtt_histogram_[4], (unsigned) this->rtt_histogram_[5]);
+
+#ifdef USE_SENSOR
+  if (this->timeouts_sensor_) {
+    this->timeouts_sensor_->publish_raw(timeouts);
+  }
+  if (this->checksum_errors_sensor_) {
+    this->checksum_errors_sensor_->publish_raw(checksum_errors);
+  }
+  if (this->resyncs_sensor_) {
+    this->resyncs_sensor_->publish_raw(resyncs);
+  }
+  if (this->discarded_bytes_sensor_) {
+    this->discarded_bytes_sensor_->publish_raw(this->discarded_bytes_);
+  }
+  if (this->frame_rate_sensor_ && elapsed != 0) {
+    this->frame_rate_sensor_->publish_raw((this->frames_decoded_ - this->diagnostics_frames_) * 1000 * 10 / elapsed,
+                                          10);
+  }
+  if (this->round_trip_time_sensor_ && this->rtt_count_ != 0) {
+    this->round_trip_time_sensor_->publish_raw(this->rtt_sum_ / this->rtt_count_);
+  }
+  if (this->last_frame_age_sensor_ && last_frame != 0) {
+    this->last_frame_age_sensor_->publish_raw((now - last_frame) / 1000);
+  }
+#endif
+  this->rtt_sum_ = 0;
+  this->rtt_count_ = 0;
+  this->diagnostics_frames_ = this->frames_decoded_;
+  this->diagnostics_time_ = now;
+}
+
+const DalyCommandStats *DalyBmsComponent::get_command_stats(uint8_t data_id) const {
+  const int8_t index = request_index(data_id);
+  return index >= 0 ? &this->command_stats_[index] : nullptr;
+}
+
+uint8_t DalyBmsComponent::get_reply_address() const {
+  // the BMS answers with its board number: 0x80 (UART/Bluetooth) and 0x40 (RS485) address board 1
+  return this->addr_ >= 0x80 ? this->addr_ - 0x7F : this->addr_ - 0x3F;
+}
+
+bool DalyBmsComponent::is_known_data_id(uint8_t data_id) {
+  return request_index(data_id) >= 0 || is_write_command(data_id);
+}
+
+float DalyBmsComponent::get_setup_priority() const { return setup_priority::DATA; }
+
+uint8_t DalyBmsComponent::expected_reply_frames(uint8_t data_id) const {
+  // 0 means the frame count is not known yet and the reply ends after DALY_FRAME_GAP of silence
+  switch (data_id) {
+    case DALY_REQUEST_CELL_VOLTAGE:
+      return (this->cells_number_ + DALY_CELLS_PER_FRAME - 1) / DALY_CELLS_PER_FRAME;
+    case DALY_REQUEST_TEMPERATURE:
+      return (this->temperatures_number_ + DALY_TEMPERATURES_PER_FRAME - 1) / DALY_TEMPERATURES_PER_FRAME;
+    default:
+      return 1;
+  }
+}
+
+void DalyBmsComponent::decode_data(const uint8_t *it) {
+  this->frames_decoded_++;
+  const int8_t index = request_index(it[2]);
+  if (index >= 0) {
+    this->command_stats_[index].frames++;
+    this->command_stats_[index].last_frame = millis();
+  }
+#ifdef USE_DALY_BMS_SNAPSHOT
+  if (index >= 0) {
+    memcpy(this->snapshot_.payloads[index], it + 4, 8);
+    this->snapshot_.received |= 1 << index;
+  }
+#endif
+
+  // each frame is only decoded if something in the configuration consumes it, see request_frames() in __init__.py
+  switch (it[2]) {
+#ifdef USE_DALY_BMS_BATTERY_LEVEL
+      //================================== BATTERY_LEVEL = 0x90 ==================================
+    case DALY_REQUEST_BATTERY_LEVEL: {
+      const int32_t current = encode_uint16(it[8], it[9]) - DALY_CURRENT_OFFSET;
+      if (this->has_current_ && this->current_step_raw_ != 0 &&
+          std::abs(current - this->last_current_raw_) >= this->current_step_raw_) {
+        // held until the next 0x93: the fast tier is asked again right away and that reading shows no step
+        this->current_step_ = true;
+        this->set_active_(true);
+      }
+      this->last_current_raw_ = current;
+      this->has_current_ = true;
+      if (this->energy_enabled_)
+        this->integrate_(encode_uint16(it[4], it[5]), current);
+#ifdef USE_DALY_BMS_CELL_ANALYTICS
+      this->analytics_.add_current(current, millis());
+#endif
+#ifdef USE_DALY_BMS_HISTORY
+      const int32_t pack[3] = {encode_uint16(it[4], it[5]), current, encode_uint16(it[10], it[11])};
+      this->history_.record(DALY_HISTORY_PACK, millis(), pack, 3);
+#endif
+#ifdef USE_SENSOR
+      if (this->voltage_sensor_) {
+        this->voltage_sensor_->publish_raw(encode_uint16(it[4], it[5]), 10);
+      }
+      if (this->current_sensor_) {
+        this->current_sensor_->publish_raw(current, 10);
+      }
+      if (this->power_sensor_) {
+        this->power_sensor_->publish_raw(encode_uint16(it[4], it[5]) * current, 100);
+      }
+      if (this->battery_level_sensor_) {
+        this->battery_level_sensor_->publish_raw(encode_uint16(it[10], it[11]), 10);
+      }
+#endif
+      break;
+    }
+#endif
+#if defined(USE_DALY_BMS_MIN_MAX_VOLTAGE) && defined(USE_SENSOR)
+      //================================== MIN_MAX_VOLTAGE = 0x91 ==================================
+    case DALY_REQUEST_MIN_MAX_VOLTAGE:
+      if (this->max_cell_voltage_sensor_) {
+        this->max_cell_voltage_sensor_->publish_raw(encode_uint16(it[4], it[5]), 1000);
+      }
+      if (this->max_cell_voltage_number_sensor_) {
+        this->max_cell_voltage_number_sensor_->publish_raw(it[6]);
+      }
+      if (this->min_cell_voltage_sensor_) {
+        this->min_cell_voltage_sensor_->publish_raw(encode_uint16(it[7], it[8]), 1000);
+      }
+      if (this->min_cell_voltage_number_sensor_) {
+        this->min_cell_voltage_number_sensor_->publish_raw(it[9]);
+      }
+      if (this->cell_voltage_difference_sensor_) {
+        this->cell_voltage_difference_sensor_->publish_raw(encode_uint16(it[4], it[5]) - encode_uint16(it[7], it[8]), 1000);
+      }
+      break;
+#endif
+#if defined(USE_DALY_BMS_MIN_MAX_TEMPERATURE) && defined(USE_SENSOR)
+      //================================== MIN_MAX_TEMPERATURE = 0x92 ==================================
+    case DALY_REQUEST_MIN_MAX_TEMPERATURE:
+      if (this->max_temperature_sensor_) {
+        this->max_temperature_sensor_->publish_raw(it[4] - DALY_TEMPERATURE_OFFSET);
+      }
+      if (this->max_temperature_probe_number_sensor_) {
+        this->max_temperature_probe_number_sensor_->publish_raw(it[5]);
+      }
+      if (this->min_temperature_sensor_) {
+        this->min_temperature_sensor_->publish_raw(it[6] - DALY_TEMPERATURE_OFFSET);
+      }
+      if (this->min_temperature_probe_number_sensor_) {
+        this->min_temperature_probe_number_sensor_->publish_raw(it[7]);
+      }
+      break;
+#endif
+#ifdef USE_DALY_BMS_MOS
+      // ================================== MOS = 0x93 ==================================
+    case DALY_REQUEST_MOS:
+      if (it[4] != 0 && it[4] != this->session_state_) {
+        // a new charge or discharge session starts
+        this->session_charge_ = 0;
+        this->session_energy_ = 0;
+      }
+      this->session_state_ = it[4];
+      // 0 is standby, 1 charging, 2 discharging; a current step seen in the same sweep keeps the fast rate
+      this->set_active_(it[4] != 0 || this->current_step_);
+      this->current_step_ = false;
+#ifdef USE_TEXT_SENSOR
+      if (this->status_text_sensor_ != nullptr) {
+        switch (it[4]) {
+          case 0:
+            this->status_text_sensor_->publish_state("Standby");
             break;
-            // ================================== BALANCE = 0x97 ==================================
-#ifdef USE_BINARY_SENSOR
-          case DALY_REQUEST_BALANCE:
-            switch (it[4]) {
-              case 0:
-                if (this->cell_1_balance_active_binary_sensor_) {this->cell_1_balance_active_binary_sensor_->publish_state(it[4]);}
-                if (this->cell_2_balance_active_binary_sensor_) { this->cell_2_balance_active_binary_sensor_->publish_state(it[5]);}
-                if (this->cell_3_balance_active_binary_sensor_) {this->cell_3_balance_active_binary_sensor_->publish_state(it[6]);}
-                if (this->cell_4_balance_active_binary_sensor_) {this->cell_4_balance_active_binary_sensor_->publish_state(it[7]);}
-                if (this->cell_5_balance_active_binary_sensor_) {this->cell_5_balance_active_binary_sensor_->publish_state(it[8]);}
-                if (this->cell_6_balance_active_binary_sensor_) {this->cell_6_balance_active_binary_sensor_->publish_state(it[9]);}
-                if (this->cell_7_balance_active_binary_sensor_) {this->cell_7_balance_active_binary_sensor_->publish_state(it[10]);}
-                if (this->cell_8_balance_active_binary_sensor_) {this->cell_8_balance_active_binary_sensor_->publish_state(it[11]);}
-                
-              case 1:
-                if (this->cell_9_balance_active_binary_sensor_) {this->cell_9_balance_active_binary_sensor_->publish_state(it[4]);}
-                if (this->cell_10_balance_active_binary_sensor_) {this->cell_10_balance_active_binary_sensor_->publish_state(it[5]);}
-                if (this->cell_11_balance_active_binary_sensor_) {this->cell_11_balance_active_binary_sensor_->publish_state(it[6]);}
-                if (this->cell_12_balance_active_binary_sensor_) {this->cell_12_balance_active_binary_sensor_->publish_state(it[7]);}
-                if (this->cell_13_balance_active_binary_sensor_) {this->cell_13_balance_active_binary_sensor_->publish_state(it[8]);}
-                if (this->cell_14_balance_active_binary_sensor_) {this->cell_14_balance_active_binary_sensor_->publish_state(it[9]);}
-                if (this->cell_15_balance_active_binary_sensor_) {this->cell_15_balance_active_binary_sensor_->publish_state(it[10]);}
-                if (this->cell_16_balance_active_binary_sensor_) {this->cell_16_balance_active_binary_sensor_->publish_state(it[11]);}
-                break;
-            }
-#endif
-            // ================================== FAILURE = 0x98 ==================================
-          case DALY_REQUEST_FAILURE_STATUS:
-            this->failure_callbacks_.call(std::vector<uint8_t>(it + 4, it + 11));
+          case 1:
+            this->status_text_sensor_->publish_state("Charging");
+            break;
+          case 2:
+            this->status_text_sensor_->publish_state("Discharging");
             break;
-			this->fehlercode_sensor_->publish_state(it[11]);
-			break;
           default:
-		    break;
-            // ================================== THRESHOLD = 0x59 ==================================
+            break;
+        }
+      }
+#endif
+#ifdef USE_SWITCH
+      if (this->charging_mos_switch_) {
+        this->charging_mos_switch_->publish_state(it[5]);
+      }
+      if (this->discharging_mos_switch_) {
+        this->discharging_mos_switch_->publish_state(it[6]);
+      }
+#endif
+#ifdef USE_BINARY_SENSOR
+      if (this->charging_mos_enabled_binary_sensor_) {
+        this->charging_mos_enabled_binary_sensor_->publish_raw(it[5]);
+      }
+      if (this->discharging_mos_enabled_binary_sensor_) {
+        this->discharging_mos_enabled_binary_sensor_->publish_raw(it[6]);
+      }
+#endif
 #ifdef USE_SENSOR
-          case DALY_REQUEST_CELL_THRESHOLDS:
-            if (this->cell_level_1_alarm_high_voltage_sensor_) {
-              this->cell_level_1_alarm_high_voltage_sensor_->publish_state((float) encode_uint16(it[4], it[5]) / 1000);
-            }
-            if (this->cell_level_2_alarm_high_voltage_sensor_) {
-              this->cell_level_2_alarm_high_voltage_sensor_->publish_state((float) encode_uint16(it[6], it[7]) / 1000);
-            }
-            if (this->cell_level_1_alarm_low_voltage_sensor_) {
-              this->cell_level_1_alarm_low_voltage_sensor_->publish_state((float) encode_uint16(it[8], it[9]) / 1000);
-            }
-            if (this->cell_level_2_alarm_low_voltage_sensor_) {
-              this->cell_level_2_alarm_low_voltage_sensor_->publish_state((float) encode_uint16(it[10], it[11]) / 1000);
-            }
-            break; 
-            // ================================== THRESHOLD = 0x5A ==================================
-          case DALY_REQUEST_PACK_THRESHOLDS:
-            if (this->battpack_level_1_alarm_high_voltage_sensor_) {
-              this->battpack_level_1_alarm_high_voltage_sensor_->publish_state((float) encode_uint16(it[4], it[5]) / 10);
-            }
-            if (this->battpack_level_2_alarm_high_voltage_sensor_) {
-              this->battpack_level_2_alarm_high_voltage_sensor_->publish_state((float) encode_uint16(it[6], it[7]) / 10);
-            }
-            if (this->battpack_level_1_alarm_low_voltage_sensor_) {
-              this->battpack_level_1_alarm_low_voltage_sensor_->publish_state((float) encode_uint16(it[8], it[9]) / 10);
-            }
-            if (this->battpack_level_2_alarm_low_voltage_sensor_) {
-              this->battpack_level_2_alarm_low_voltage_sensor_->publish_state((float) encode_uint16(it[10], it[11]) / 10);
-            }
-            break; 
-            // ================================== THRESHOLD = 0x5E ==================================
-          case DALY_REQUEST_REST_THRESHOLDS:
-            if (this->cell_level_1_alarm_difference_voltage_sensor_) {
-              this->cell_level_1_alarm_difference_voltage_sensor_->publish_state((float) encode_uint16(it[4], it[5]) / 1000);
-            }
-            if (this->cell_level_2_alarm_difference_voltage_sensor_) {
-              this->cell_level_2_alarm_difference_voltage_sensor_->publish_state((float) encode_uint16(it[6], it[7]) / 1000);
-            }
-            if (this->cell_level_1_alarm_difference_temperature_sensor_) {
-              this->cell_level_1_alarm_difference_temperature_sensor_->publish_state(it[8]);
-            }
-            if (this->cell_level_2_alarm_difference_temperature_sensor_) {
-              this->cell_level_2_alarm_difference_temperature_sensor_->publish_state(it[9]);
-            }
-            break; 
-            // ================================== THRESHOLD = 0x50 ==================================
-          case DALY_REQUEST_CAPACITY_NOMINAL_VOLTAGE:
-            if (this->cell_nominal_capacity_sensor_) {
-              this->cell_nominal_capacity_sensor_->publish_state((float) encode_uint32(it[4], it[5], it[6], it[7]) / 1000);
-            }
-            if (this->cell_nominal_voltage_sensor_) {
-              this->cell_nominal_voltage_sensor_->publish_state((float) encode_uint16(it[10], it[11]) / 1000);
-            }
-            break; 
-			
+      if (this->remaining_capacity_sensor_) {
+        this->remaining_capacity_sensor_->publish_raw(encode_uint32(it[8], it[9], it[10], it[11]), 1000);
+      }
+      if (this->bms_watchdog_sensor_) {
+        this->bms_watchdog_sensor_->publish_raw(it[7]);
+      }
 #endif
-        }
-      } else {
-        ESP_LOGW(TAG, "Checksum-Error on Packet %x", it[4]);
+      break;
+#endif
+#ifdef USE_DALY_BMS_STATUS
+      // ================================== STATUS = 0x94 ==================================
+    case DALY_REQUEST_STATUS:
+      this->cells_number_ = it[4];
+      this->temperatures_number_ = it[5];
+#ifdef USE_SENSOR
+      if (this->cells_number_sensor_) {
+        this->cells_number_sensor_->publish_raw(it[4]);
       }
-      std::advance(it, DALY_FRAME_SIZE);
-    } else {
-      std::advance(it, 1);
-    }
+      if (this->cycle_sensor_) {
+        this->cycle_sensor_->publish_raw(encode_uint16(it[9], it[10]));
+      }
+#endif
+      break;
+#endif
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+      //================================== CELL VOLTAGE 0x95 ==================================
+    case DALY_REQUEST_CELL_VOLTAGE:
+      // frame number followed by three cell voltages; they go into the snapshot and are published once the
+      // reply is complete
+      if (it[4] == 0 || it[4] > DALY_MAX_CELLS / DALY_CELLS_PER_FRAME)
+        break;
+      for (uint8_t i = 0; i < DALY_CELLS_PER_FRAME; i++)
+        this->snapshot_.cell_voltages[(it[4] - 1) * DALY_CELLS_PER_FRAME + i] = encode_uint16(it[5 + 2 * i], it[6 + 2 * i]);
+      this->snapshot_.cell_frames |= 1UL << (it[4] - 1);
+      break;
+#endif
+#ifdef USE_DALY_BMS_TEMPERATURE
+      //================================== TEMPERATURE = 0x96 ==================================
+    case DALY_REQUEST_TEMPERATURE:
+      // frame number followed by seven probes, published with the snapshot as well
+      if (it[4] == 0 || it[4] > DALY_MAX_TEMPERATURE_FRAMES)
+        break;
+      for (uint8_t i = 0; i < DALY_TEMPERATURES_PER_FRAME; i++) {
+        const uint8_t probe = (it[4] - 1) * DALY_TEMPERATURES_PER_FRAME + i;
+        if (probe < DALY_MAX_TEMPERATURES)
+          this->snapshot_.temperatures[probe] = it[5 + i] - DALY_TEMPERATURE_OFFSET;
+      }
+      this->snapshot_.temperature_frames |= 1 << (it[4] - 1);
+      break;
+#endif
+#if defined(USE_DALY_BMS_BALANCE) && defined(USE_BINARY_SENSOR)
+      // ================================== BALANCE = 0x97 ==================================
+    case DALY_REQUEST_BALANCE:
+      this->decode_balance_(it);
+      break;
+#endif
+#ifdef USE_DALY_BMS_FAILURE_STATUS
+      // ================================== FAILURE = 0x98 ==================================
+    case DALY_REQUEST_FAILURE_STATUS:
+      this->decode_failures_(it);
+      break;
+#endif
+#if defined(USE_DALY_BMS_CELL_THRESHOLDS) && defined(USE_SENSOR)
+      // ================================== THRESHOLD = 0x59 ==================================
+    case DALY_REQUEST_CELL_THRESHOLDS:
+      if (this->cell_level_1_alarm_high_voltage_sensor_) {
+        this->cell_level_1_alarm_high_voltage_sensor_->publish_raw(encode_uint16(it[4], it[5]), 1000);
+      }
+      if (this->cell_level_2_alarm_high_voltage_sensor_) {
+        this->cell_level_2_alarm_high_voltage_sensor_->publish_raw(encode_uint16(it[6], it[7]), 1000);
+      }
+      if (this->cell_level_1_alarm_low_voltage_sensor_) {
+        this->cell_level_1_alarm_low_voltage_sensor_->publish_raw(encode_uint16(it[8], it[9]), 1000);
+      }
+      if (this->cell_level_2_alarm_low_voltage_sensor_) {
+        this->cell_level_2_alarm_low_voltage_sensor_->publish_raw(encode_uint16(it[10], it[11]), 1000);
+      }
+      break;
+#endif
+#if defined(USE_DALY_BMS_PACK_THRESHOLDS) && defined(USE_SENSOR)
+      // ================================== THRESHOLD = 0x5A ==================================
+    case DALY_REQUEST_PACK_THRESHOLDS:
+      if (this->battpack_level_1_alarm_high_voltage_sensor_) {
+        this->battpack_level_1_alarm_high_voltage_sensor_->publish_raw(encode_uint16(it[4], it[5]), 10);
+      }
+      if (this->battpack_level_2_alarm_high_voltage_sensor_) {
+        this->battpack_level_2_alarm_high_voltage_sensor_->publish_raw(encode_uint16(it[6], it[7]), 10);
+      }
+      if (this->battpack_level_1_alarm_low_voltage_sensor_) {
+        this->battpack_level_1_alarm_low_voltage_sensor_->publish_raw(encode_uint16(it[8], it[9]), 10);
+      }
+      if (this->battpack_level_2_alarm_low_voltage_sensor_) {
+        this->battpack_level_2_alarm_low_voltage_sensor_->publish_raw(encode_uint16(it[10], it[11]), 10);
+      }
+      break;
+#endif
+#if defined(USE_DALY_BMS_REST_THRESHOLDS) && defined(USE_SENSOR)
+      // ================================== THRESHOLD = 0x5E ==================================
+    case DALY_REQUEST_REST_THRESHOLDS:
+      if (this->cell_level_1_alarm_difference_voltage_sensor_) {
+        this->cell_level_1_alarm_difference_voltage_sensor_->publish_raw(encode_uint16(it[4], it[5]), 1000);
+      }
+      if (this->cell_level_2_alarm_difference_voltage_sensor_) {
+        this->cell_level_2_alarm_difference_voltage_sensor_->publish_raw(encode_uint16(it[6], it[7]), 1000);
+      }
+      if (this->cell_level_1_alarm_difference_temperature_sensor_) {
+        this->cell_level_1_alarm_difference_temperature_sensor_->publish_raw(it[8]);
+      }
+      if (this->cell_level_2_alarm_difference_temperature_sensor_) {
+        this->cell_level_2_alarm_difference_temperature_sensor_->publish_raw(it[9]);
+      }
+      break;
+#endif
+#if defined(USE_DALY_BMS_CAPACITY_NOMINAL_VOLTAGE) && defined(USE_SENSOR)
+      // ================================== THRESHOLD = 0x50 ==================================
+    case DALY_REQUEST_CAPACITY_NOMINAL_VOLTAGE:
+      if (this->cell_nominal_capacity_sensor_) {
+        this->cell_nominal_capacity_sensor_->publish_raw(encode_uint32(it[4], it[5], it[6], it[7]), 1000);
+      }
+      if (this->cell_nominal_voltage_sensor_) {
+        this->cell_nominal_voltage_sensor_->publish_raw(encode_uint16(it[10], it[11]), 1000);
+      }
+      break;
+#endif
+    default:
+      break;
   }
 }
 
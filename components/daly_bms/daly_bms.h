@@ -3,6 +3,7 @@
 #include "esphome/core/component.h"
 #include "esphome/core/defines.h"
 #include "esphome/core/helpers.h"
+#include "esphome/core/preferences.h"
 #ifdef USE_SENSOR
 #include "esphome/components/sensor/sensor.h"
 #endif
@@ -12,121 +13,551 @@
 #ifdef USE_BINARY_SENSOR
 #include "esphome/components/binary_sensor/binary_sensor.h"
 #endif
-#include "esphome/components/uart/uart.h"
+#ifdef USE_SWITCH
+#include "esphome/components/switch/switch.h"
+#endif
+#ifdef USE_DALY_BMS_HISTORY
+#include "daly_history.h"
+#endif
+#ifdef USE_DALY_BMS_CELL_ANALYTICS
+#include "daly_cell_analytics.h"
+#endif
 
+#include <array>
+#include <cmath>
+#include <string>
 #include <vector>
 
 namespace esphome {
 namespace daly_bms {
 
-class DalyBmsComponent : public PollingComponent, public uart::UARTDevice {
+static const uint8_t DALY_FRAME_SIZE = 13;
+static const uint8_t DALY_MAX_CELLS = 48;
+static const uint8_t DALY_MAX_TEMPERATURES = 16;
+static const uint8_t DALY_REQUEST_COUNT = 13;
+static const uint8_t DALY_RTT_BUCKETS = 6;
+static const uint8_t DALY_FAILURE_BYTES = 7;
+static const uint8_t DALY_FAILURE_BITS = DALY_FAILURE_BYTES * 8;
+
+/// The seven alarm bytes of 0x98, bit n of byte m is failure m * 8 + n.
+using DalyFailureBits = std::array<uint8_t, DALY_FAILURE_BYTES>;
+
+// write commands
+static const uint8_t DALY_COMMAND_RESET = 0x00;
+static const uint8_t DALY_COMMAND_SET_SOC = 0x21;
+static const uint8_t DALY_COMMAND_DISCHARGING_MOS = 0xD9;
+static const uint8_t DALY_COMMAND_CHARGING_MOS = 0xDA;
+
+#ifdef USE_SENSOR
+/// Sensor fed with the undecoded protocol integer. With a deadband or heartbeat configured it only publishes
+/// when the raw value moved by at least the deadband or the heartbeat interval has passed.
+class DalySensor : public sensor::Sensor {
+ public:
+  void set_deadband(float deadband) {
+    this->deadband_ = deadband;
+    this->change_driven_ = true;
+  }
+  void set_heartbeat(uint32_t heartbeat) {
+    this->heartbeat_ = heartbeat;
+    this->change_driven_ = true;
+  }
+  /// Publishes raw / divisor, divisor being the protocol resolution (e.g. 1000 for mV).
+  void publish_raw(int32_t raw, uint16_t divisor = 1);
+
+ protected:
+  bool change_driven_{false};
+  float deadband_{0};
+  uint32_t deadband_raw_{0};
+  uint32_t heartbeat_{0};
+  bool has_raw_{false};
+  int32_t last_raw_{0};
+  uint32_t last_publish_{0};
+};
+
+#define DALY_SUB_SENSOR(name) \
+ protected: \
+  DalySensor *name##_sensor_{nullptr}; \
+\
+ public: \
+  void set_##name##_sensor(DalySensor *sensor) { this->name##_sensor_ = sensor; }
+#endif
+
+#ifdef USE_BINARY_SENSOR
+/// Binary sensor that publishes on changes only, plus a forced update every heartbeat interval if configured.
+class DalyBinarySensor : public binary_sensor::BinarySensor {
+ public:
+  void set_heartbeat(uint32_t heartbeat) { this->heartbeat_ = heartbeat; }
+  bool has_heartbeat() const { return this->heartbeat_ != 0; }
+  void publish_raw(bool state);
+
+ protected:
+  uint32_t heartbeat_{0};
+  bool has_raw_{false};
+  bool last_raw_{false};
+  uint32_t last_publish_{0};
+};
+
+#define DALY_SUB_BINARY_SENSOR(name) \
+ protected: \
+  DalyBinarySensor *name##_binary_sensor_{nullptr}; \
+\
+ public: \
+  void set_##name##_binary_sensor(DalyBinarySensor *binary_sensor) { this->name##_binary_sensor_ = binary_sensor; }
+#endif
+
+class DalyBmsComponent;
+
+#ifdef USE_SWITCH
+/// Switches the charging or discharging MOS; the state follows what the BMS reports in 0x93.
+class DalyMosSwitch : public switch_::Switch, public Parented<DalyBmsComponent> {
+ public:
+  void set_charging(bool charging) { this->charging_ = charging; }
+
+ protected:
+  void write_state(bool state) override;
+
+  bool charging_{false};
+};
+#endif
+
+enum DalyProtocol : uint8_t {
+  DALY_PROTOCOL_DALY = 0,  // 13 byte frames, one request per data ID
+  DALY_PROTOCOL_MODBUS,    // Modbus RTU, function 0x03 over blocks of registers
+};
+
+// Modbus reads have IDs of their own, apart from the daly data IDs and commands, see covered_requests_()
+static const uint8_t DALY_MODBUS_READ_PACK = 0xE0;
+static const uint8_t DALY_MODBUS_READ_CELLS = 0xE1;
+static const uint8_t DALY_MODBUS_REQUEST_SIZE = 8;
+static const uint8_t DALY_MODBUS_MAX_REGISTERS = 64;
+
+enum DalyPollTier : uint8_t {
+  DALY_TIER_FAST = 0,    // pack voltage/current, MOS state, alarms (every update_interval)
+  DALY_TIER_CELLS,       // status, cell voltages, temperatures, balancing
+  DALY_TIER_THRESHOLDS,  // configured alarm thresholds and nominal values
+};
+
+/// Link statistics of one request since boot.
+struct DalyCommandStats {
+  uint32_t timeouts{0};
+  uint32_t checksum_errors{0};
+  uint32_t resyncs{0};  // frames dropped because they broke off or had a corrupted header
+  uint32_t frames{0};   // frames decoded
+  uint32_t replies{0};  // complete replies, the round trip times are taken over these
+  uint32_t rtt_sum{0};  // ms
+  uint32_t rtt_max{0};
+  uint32_t last_frame{0};  // millis() of the last decoded frame, 0 if none yet
+};
+
+/// Charge and energy integrated from the 0x90 stream, in 0.1 A·µs and 0.01 W·µs (the protocol resolution times
+/// the sample interval) so nothing is lost to rounding between samples. Persisted as is.
+struct DalyEnergyState {
+  uint64_t charge_in;
+  uint64_t charge_out;
+  uint64_t energy_in;
+  uint64_t energy_out;
+} __attribute__((packed));
+
+/// Cell voltages and temperatures of one 0x95/0x96 reply. They are published together once every frame is in,
+/// so min/max and the single values always belong to the same reading.
+struct DalyPackSnapshot {
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+  uint16_t cell_voltages[DALY_MAX_CELLS];  // mV
+  uint32_t cell_frames;                    // bit n set once frame n + 1 of the cell voltage reply arrived
+#endif
+#ifdef USE_DALY_BMS_TEMPERATURE
+  int8_t temperatures[DALY_MAX_TEMPERATURES];  // °C
+  uint8_t temperature_frames;                  // same for the temperature reply
+#endif
+#ifdef USE_DALY_BMS_SNAPSHOT
+  // what the current sweep brought in, for the snapshot text sensor
+  uint8_t payloads[DALY_REQUEST_COUNT][8];  // data bytes of the last frame of each request
+  uint16_t received;                        // bit n set once request n was answered
+  uint8_t cells;                            // cell voltages of a complete reply, 0 if there was none
+  uint8_t probes;                           // same for the temperatures
+#endif
+};
+
+class DalyBmsComponent : public PollingComponent {
  public:
   DalyBmsComponent() = default;
 
+  // sensors are grouped by the frame they are decoded from, only frames with a consumer are compiled in
 #ifdef USE_SENSOR
-  SUB_SENSOR(battery_level)
-  SUB_SENSOR(battpack_level_1_alarm_high_voltage)
-  SUB_SENSOR(battpack_level_2_alarm_high_voltage)
-  SUB_SENSOR(battpack_level_1_alarm_low_voltage)
-  SUB_SENSOR(battpack_level_2_alarm_low_voltage)
-  SUB_SENSOR(bms_watchdog)
-  SUB_SENSOR(cell_1_voltage)
-  SUB_SENSOR(cell_2_voltage)
-  SUB_SENSOR(cell_3_voltage)
-  SUB_SENSOR(cell_4_voltage)
-  SUB_SENSOR(cell_5_voltage)
-  SUB_SENSOR(cell_6_voltage)
-  SUB_SENSOR(cell_7_voltage)
-  SUB_SENSOR(cell_8_voltage)
-  SUB_SENSOR(cell_9_voltage)
-  SUB_SENSOR(cell_10_voltage)
-  SUB_SENSOR(cell_11_voltage)
-  SUB_SENSOR(cell_12_voltage)
-  SUB_SENSOR(cell_13_voltage)
-  SUB_SENSOR(cell_14_voltage)
-  SUB_SENSOR(cell_15_voltage)
-  SUB_SENSOR(cell_16_voltage)
-  SUB_SENSOR(cell_nominal_capacity)
-  SUB_SENSOR(cell_nominal_voltage)
-  SUB_SENSOR(cell_level_1_alarm_high_voltage)
-  SUB_SENSOR(cell_level_2_alarm_high_voltage)
-  SUB_SENSOR(cell_level_1_alarm_low_voltage)
-  SUB_SENSOR(cell_level_2_alarm_low_voltage)
-  SUB_SENSOR(cell_level_1_alarm_difference_temperature)
-  SUB_SENSOR(cell_level_2_alarm_difference_temperature)
-  SUB_SENSOR(cell_level_1_alarm_difference_voltage)
-  SUB_SENSOR(cell_level_2_alarm_difference_voltage)
-  SUB_SENSOR(cell_voltage_difference)
-  SUB_SENSOR(cells_number)
-  SUB_SENSOR(current)
-  SUB_SENSOR(cycle)
-  SUB_SENSOR(min_cell_voltage)
-  SUB_SENSOR(min_cell_voltage_number)
-  SUB_SENSOR(max_cell_voltage)
-  SUB_SENSOR(max_cell_voltage_number)
-  SUB_SENSOR(min_temperature)
-  SUB_SENSOR(min_temperature_probe_number)
-  SUB_SENSOR(max_temperature)
-  SUB_SENSOR(max_temperature_probe_number)
-  SUB_SENSOR(remaining_capacity)
-  SUB_SENSOR(temperature_1)
-  SUB_SENSOR(temperature_2)
-  SUB_SENSOR(voltage)
-  SUB_SENSOR(power)
-  SUB_SENSOR(fehlercode)
+#ifdef USE_DALY_BMS_BATTERY_LEVEL
+  DALY_SUB_SENSOR(battery_level)
+  DALY_SUB_SENSOR(current)
+  DALY_SUB_SENSOR(voltage)
+  DALY_SUB_SENSOR(power)
+  // integrated from voltage and current
+  DALY_SUB_SENSOR(charged_capacity)
+  DALY_SUB_SENSOR(discharged_capacity)
+  DALY_SUB_SENSOR(charged_energy)
+  DALY_SUB_SENSOR(discharged_energy)
+  DALY_SUB_SENSOR(session_capacity)
+  DALY_SUB_SENSOR(session_energy)
+#endif
+#if defined(USE_DALY_BMS_MIN_MAX_VOLTAGE) || defined(USE_DALY_BMS_CELL_VOLTAGE)
+  DALY_SUB_SENSOR(cell_voltage_difference)
+  DALY_SUB_SENSOR(min_cell_voltage)
+  DALY_SUB_SENSOR(min_cell_voltage_number)
+  DALY_SUB_SENSOR(max_cell_voltage)
+  DALY_SUB_SENSOR(max_cell_voltage_number)
+#endif
+#if defined(USE_DALY_BMS_MIN_MAX_TEMPERATURE) || defined(USE_DALY_BMS_TEMPERATURE)
+  DALY_SUB_SENSOR(min_temperature)
+  DALY_SUB_SENSOR(min_temperature_probe_number)
+  DALY_SUB_SENSOR(max_temperature)
+  DALY_SUB_SENSOR(max_temperature_probe_number)
+#endif
+#ifdef USE_DALY_BMS_MOS
+  DALY_SUB_SENSOR(bms_watchdog)
+  DALY_SUB_SENSOR(remaining_capacity)
+#endif
+#ifdef USE_DALY_BMS_STATUS
+  DALY_SUB_SENSOR(cells_number)
+  DALY_SUB_SENSOR(cycle)
+#endif
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+  DALY_SUB_SENSOR(average_cell_voltage)
+#endif
+#ifdef USE_DALY_BMS_CELL_ANALYTICS
+  // the weakest cell, from the analytics
+  DALY_SUB_SENSOR(max_cell_resistance)
+  DALY_SUB_SENSOR(max_cell_resistance_number)
+  DALY_SUB_SENSOR(max_cell_deviation)
+  DALY_SUB_SENSOR(max_cell_deviation_number)
+#endif
+#ifdef USE_DALY_BMS_FAILURE_STATUS
+  DALY_SUB_SENSOR(fehlercode)
+#endif
+#ifdef USE_DALY_BMS_CELL_THRESHOLDS
+  DALY_SUB_SENSOR(cell_level_1_alarm_high_voltage)
+  DALY_SUB_SENSOR(cell_level_2_alarm_high_voltage)
+  DALY_SUB_SENSOR(cell_level_1_alarm_low_voltage)
+  DALY_SUB_SENSOR(cell_level_2_alarm_low_voltage)
+#endif
+#ifdef USE_DALY_BMS_PACK_THRESHOLDS
+  DALY_SUB_SENSOR(battpack_level_1_alarm_high_voltage)
+  DALY_SUB_SENSOR(battpack_level_2_alarm_high_voltage)
+  DALY_SUB_SENSOR(battpack_level_1_alarm_low_voltage)
+  DALY_SUB_SENSOR(battpack_level_2_alarm_low_voltage)
+#endif
+#ifdef USE_DALY_BMS_REST_THRESHOLDS
+  DALY_SUB_SENSOR(cell_level_1_alarm_difference_temperature)
+  DALY_SUB_SENSOR(cell_level_2_alarm_difference_temperature)
+  DALY_SUB_SENSOR(cell_level_1_alarm_difference_voltage)
+  DALY_SUB_SENSOR(cell_level_2_alarm_difference_voltage)
+#endif
+#ifdef USE_DALY_BMS_CAPACITY_NOMINAL_VOLTAGE
+  DALY_SUB_SENSOR(cell_nominal_capacity)
+  DALY_SUB_SENSOR(cell_nominal_voltage)
+#endif
+  // link diagnostics
+  DALY_SUB_SENSOR(timeouts)
+  DALY_SUB_SENSOR(checksum_errors)
+  DALY_SUB_SENSOR(resyncs)
+  DALY_SUB_SENSOR(discarded_bytes)
+  DALY_SUB_SENSOR(frame_rate)
+  DALY_SUB_SENSOR(round_trip_time)
+  DALY_SUB_SENSOR(last_frame_age)
 #endif
 
 #ifdef USE_TEXT_SENSOR
+#ifdef USE_DALY_BMS_MOS
   SUB_TEXT_SENSOR(status)
-  
+#endif
+#ifdef USE_DALY_BMS_FAILURE_STATUS
+  SUB_TEXT_SENSOR(failures)
+#endif
+#ifdef USE_DALY_BMS_SNAPSHOT
+  // the whole sweep as one JSON record
+  SUB_TEXT_SENSOR(snapshot)
+#endif
 #endif
 
 #ifdef USE_BINARY_SENSOR
-  SUB_BINARY_SENSOR(charging_mos_enabled)
-  SUB_BINARY_SENSOR(discharging_mos_enabled)
-  SUB_BINARY_SENSOR(cell_1_balance_active)
-  SUB_BINARY_SENSOR(cell_2_balance_active)
-  SUB_BINARY_SENSOR(cell_3_balance_active)
-  SUB_BINARY_SENSOR(cell_4_balance_active)
-  SUB_BINARY_SENSOR(cell_5_balance_active)
-  SUB_BINARY_SENSOR(cell_6_balance_active)
-  SUB_BINARY_SENSOR(cell_7_balance_active)
-  SUB_BINARY_SENSOR(cell_8_balance_active)
-  SUB_BINARY_SENSOR(cell_9_balance_active)
-  SUB_BINARY_SENSOR(cell_10_balance_active)
-  SUB_BINARY_SENSOR(cell_11_balance_active)
-  SUB_BINARY_SENSOR(cell_12_balance_active)
-  SUB_BINARY_SENSOR(cell_13_balance_active)
-  SUB_BINARY_SENSOR(cell_14_balance_active)
-  SUB_BINARY_SENSOR(cell_15_balance_active)
-  SUB_BINARY_SENSOR(cell_16_balance_active)
-
-  
+#ifdef USE_DALY_BMS_MOS
+  DALY_SUB_BINARY_SENSOR(charging_mos_enabled)
+  DALY_SUB_BINARY_SENSOR(discharging_mos_enabled)
+#endif
+#endif
+
+#if defined(USE_SWITCH) && defined(USE_DALY_BMS_MOS)
+  void set_charging_mos_switch(DalyMosSwitch *mos_switch) { this->charging_mos_switch_ = mos_switch; }
+  void set_discharging_mos_switch(DalyMosSwitch *mos_switch) { this->discharging_mos_switch_ = mos_switch; }
 #endif
 
   void setup() override;
   void dump_config() override;
   void update() override;
-  void loop() override;
+  void on_shutdown() override;
 
   float get_setup_priority() const override;
   void set_address(uint8_t address) { this->addr_ = address; }
-  void add_failure_callback(std::function<void(const std::vector<uint8_t> &)> &&failure_callback) {
-    this->failure_callbacks_.add(std::move(failure_callback));
+  uint8_t get_address() const { return this->addr_; }
+  uint8_t get_reply_address() const;
+  /// True for the data IDs of all read requests and write commands, the parser rejects frames with any other.
+  static bool is_known_data_id(uint8_t data_id);
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_CELL_VOLTAGE)
+  void set_cell_voltage_sensor(uint8_t cell, DalySensor *sensor) {
+    if (cell >= this->cell_voltage_sensors_.size())
+      this->cell_voltage_sensors_.resize(cell + 1, nullptr);
+    this->cell_voltage_sensors_[cell] = sensor;
+  }
+#endif
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_TEMPERATURE)
+  void set_temperature_sensor(uint8_t probe, DalySensor *sensor) {
+    if (probe >= this->temperature_sensors_.size())
+      this->temperature_sensors_.resize(probe + 1, nullptr);
+    this->temperature_sensors_[probe] = sensor;
+  }
+#endif
+#if defined(USE_BINARY_SENSOR) && defined(USE_DALY_BMS_BALANCE)
+  void set_cell_balance_binary_sensor(uint8_t cell, DalyBinarySensor *binary_sensor) {
+    if (cell >= this->cell_balance_binary_sensors_.size())
+      this->cell_balance_binary_sensors_.resize(cell + 1, nullptr);
+    this->cell_balance_binary_sensors_[cell] = binary_sensor;
+  }
+#endif
+#ifdef USE_SENSOR
+  /// Frames per second decoded from the replies to `data_id`.
+  void set_command_frame_rate_sensor(uint8_t data_id, DalySensor *sensor);
+#endif
+  /// Adds a frame to the poll schedule, codegen calls this for every frame a configured entity or automation needs.
+  void enable_request(uint8_t data_id);
+  /// Derive min/max cell voltage and temperature from the cell and temperature frames instead of polling
+  /// 0x91 and 0x92.
+  void set_local_min_max(bool local_min_max) { this->local_min_max_ = local_min_max; }
+  /// Poll the fast tier every `interval` while the pack is charging or discharging, update_interval applies in
+  /// standby.
+  void set_active_update_interval(uint32_t interval) { this->active_update_interval_ = interval; }
+  /// A current change of at least this many amps between two reads counts as activity even in standby.
+  void set_current_step(float current_step) { this->current_step_raw_ = lroundf(current_step * 10); }
+  /// Key of the persisted energy totals, derived from the component ID.
+  void set_energy_hash(uint32_t hash) { this->energy_hash_ = hash; }
+  void set_energy_save_interval(uint32_t interval) { this->energy_save_interval_ = interval; }
+  /// Clears the charge/energy totals and the current session.
+  void reset_energy();
+#ifdef USE_DALY_BMS_CELL_ANALYTICS
+  /// Time constant of the smoothed cell voltages the deviation is taken from.
+  void set_analytics_time_constant(uint32_t time_constant) { this->analytics_.set_time_constant(time_constant); }
+  /// Smallest change of the pack current that yields a resistance estimate.
+  void set_analytics_current_step(float current_step) {
+    this->analytics_.set_current_step(lroundf(current_step * 10));
+  }
+  void set_analytics_publish_interval(uint32_t interval) { this->analytics_publish_interval_ = interval; }
+#ifdef USE_SENSOR
+  void set_cell_resistance_sensor(uint8_t cell, DalySensor *sensor) {
+    if (cell >= this->cell_resistance_sensors_.size())
+      this->cell_resistance_sensors_.resize(cell + 1, nullptr);
+    this->cell_resistance_sensors_[cell] = sensor;
+  }
+  void set_cell_deviation_sensor(uint8_t cell, DalySensor *sensor) {
+    if (cell >= this->cell_deviation_sensors_.size())
+      this->cell_deviation_sensors_.resize(cell + 1, nullptr);
+    this->cell_deviation_sensors_[cell] = sensor;
+  }
+#endif
+#endif
+#ifdef USE_DALY_BMS_HISTORY
+  void set_history_blocks(uint16_t blocks) { this->history_blocks_ = blocks; }
+  /// Logs the recorded history oldest first, `batch_size` records at a time so the logger can keep up.
+  void dump_history(uint16_t batch_size);
+  void clear_history();
+#endif
+  void set_cell_update_interval(uint32_t interval) { this->cell_update_interval_ = interval; }
+  void set_threshold_update_interval(uint32_t interval) { this->threshold_update_interval_ = interval; }
+  void set_diagnostic_update_interval(uint32_t interval) { this->diagnostic_update_interval_ = interval; }
+#if defined(USE_BINARY_SENSOR) && defined(USE_DALY_BMS_FAILURE_STATUS)
+  void set_failure_binary_sensor(uint8_t bit, DalyBinarySensor *binary_sensor) {
+    if (bit >= this->failure_binary_sensors_.size())
+      this->failure_binary_sensors_.resize(bit + 1, nullptr);
+    this->failure_binary_sensors_[bit] = binary_sensor;
+  }
+#endif
+  /// Called when failure bits change with the current bits, the newly raised and the newly cleared ones.
+  void add_failure_callback(
+      std::function<void(const DalyFailureBits &, const DalyFailureBits &, const DalyFailureBits &)> &&callback) {
+    this->failure_callbacks_.add(std::move(callback));
   }
+
+  // write commands, sent ahead of any pending read; switching a MOS off goes first
+  void set_charging_mos(bool enabled);
+  void set_discharging_mos(bool enabled);
+  void set_soc(float soc);
+  void reset_bms();
+  bool has_pending_write() const { return !this->write_queue_.empty(); }
+  void add_on_write_complete_callback(std::function<void(uint8_t, bool)> &&callback) {
+    this->write_callbacks_.add(std::move(callback));
+  }
+
+  void set_protocol(DalyProtocol protocol) { this->protocol_ = protocol; }
+  DalyProtocol get_protocol() const { return this->protocol_; }
+  uint8_t request_size() const {
+    return this->protocol_ == DALY_PROTOCOL_MODBUS ? DALY_MODBUS_REQUEST_SIZE : DALY_FRAME_SIZE;
+  }
+  /// Data ID of a daly request, DALY_MODBUS_READ_* of the Modbus read next_request() returned last.
+  uint8_t request_id(const uint8_t *request) const {
+    return this->protocol_ == DALY_PROTOCOL_MODBUS ? this->modbus_read_ : request[2];
+  }
+
+  /// Pops the most urgent pending request frame, called by the bus whenever the line is free.
+  const uint8_t *next_request();
+  /// Called by the bus once `data_id` went out, false if no reply is to be waited for.
+  bool on_request_sent(uint8_t data_id);
+  /// Number of frames the reply to data_id consists of, 0 if unknown.
+  uint8_t expected_reply_frames(uint8_t data_id) const;
+  void decode_data(const uint8_t *it);
+  /// Decodes the registers of a Modbus read by handing them to decode_data() as the equivalent frames.
+  void decode_modbus(uint8_t request, const uint8_t *registers, uint8_t count);
+
+  // link statistics reported by the bus
+  void on_reply_complete(uint8_t data_id, uint32_t round_trip);
+  void on_reply_timeout(uint8_t data_id);
+  void on_checksum_error(uint8_t data_id);
+  void on_resync(uint8_t data_id);
+  void on_discarded_bytes(uint16_t count) { this->discarded_bytes_ += count; }
+  /// Statistics of the read request `data_id`, nullptr if there is no such request.
+  const DalyCommandStats *get_command_stats(uint8_t data_id) const;
+  uint32_t get_discarded_bytes() const { return this->discarded_bytes_; }
+
  protected:
-  void request_data_(uint8_t data_id);
-  void decode_data_(std::vector<uint8_t> data);
+  struct WriteRequest {
+    uint8_t priority;
+    uint8_t frame[DALY_FRAME_SIZE];
+  };
+
+  void queue_write_(uint8_t data_id, const uint8_t *data, uint8_t priority);
+  void on_write_done_(uint8_t data_id, bool success);
+  void schedule_tier_(DalyPollTier tier);
+  void set_active_(bool active);
+  void integrate_(int32_t voltage, int32_t current);
+  void publish_energy_();
+  void save_energy_();
+  void publish_diagnostics_();
+  const uint8_t *next_modbus_request_();
+  const uint8_t *build_modbus_request_(uint8_t read, uint16_t start, uint16_t count);
+  /// Bits (request indices) of the daly requests the reply to `data_id` stands for: the request itself, or the
+  /// enabled requests whose values a Modbus read returns.
+  uint16_t covered_requests_(uint8_t data_id) const;
+  void decode_as_frame_(uint8_t data_id, const uint8_t *data);
+#ifdef USE_DALY_BMS_HISTORY
+  void dump_history_batch_(uint16_t batch_size);
+#endif
+#ifdef USE_DALY_BMS_FAILURE_STATUS
+  void decode_failures_(const uint8_t *it);
+#endif
+#if defined(USE_BINARY_SENSOR) && defined(USE_DALY_BMS_BALANCE)
+  void decode_balance_(const uint8_t *it);
+#endif
+  void on_sweep_done_();
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_CELL_ANALYTICS)
+  void publish_analytics_();
+#endif
+#if defined(USE_TEXT_SENSOR) && defined(USE_DALY_BMS_SNAPSHOT)
+  void publish_snapshot_text_();
+#endif
+#ifdef USE_DALY_BMS_CELL_VOLTAGE
+  void publish_cell_snapshot_();
+#endif
+#ifdef USE_DALY_BMS_TEMPERATURE
+  void publish_temperature_snapshot_();
+#endif
 
   uint8_t addr_;
+  DalyProtocol protocol_{DALY_PROTOCOL_DALY};
+  uint8_t modbus_frame_[DALY_MODBUS_REQUEST_SIZE];
+  uint8_t modbus_read_{0};
+
+  uint32_t idle_update_interval_{0};
+  uint32_t active_update_interval_{0};
+  uint16_t current_step_raw_{0};
+  int32_t last_current_raw_{0};
+  bool has_current_{false};
+  bool current_step_{false};
+  bool active_{false};
+  uint32_t cell_update_interval_;
 
-  std::vector<uint8_t> data_;
-  bool receiving_{false};
-  uint8_t data_count_;
-  uint32_t last_transmission_{0};
-  bool trigger_next_;
-  uint8_t next_request_;
-  CallbackManager<void(const std::vector<uint8_t> &)> failure_callbacks_{};
+  // coulomb counting
+  bool energy_enabled_{false};
+  uint32_t energy_hash_{0};
+  uint32_t energy_save_interval_{3600000};
+  ESPPreferenceObject energy_pref_;
+  DalyEnergyState energy_{};
+  DalyEnergyState saved_energy_{};
+  uint64_t session_charge_{0};
+  uint64_t session_energy_{0};
+  uint8_t session_state_{0};
+  bool has_sample_{false};
+  uint32_t last_sample_us_{0};
+  uint32_t last_sample_ms_{0};
+  int32_t last_sample_voltage_{0};
+  int32_t last_sample_current_{0};
+#ifdef USE_DALY_BMS_CELL_ANALYTICS
+  DalyCellAnalytics analytics_{};
+  uint32_t analytics_publish_interval_{300000};
+#ifdef USE_SENSOR
+  std::vector<DalySensor *> cell_resistance_sensors_;
+  std::vector<DalySensor *> cell_deviation_sensors_;
+#endif
+#endif
+#ifdef USE_DALY_BMS_HISTORY
+  DalyHistory history_;
+  uint16_t history_blocks_{0};
+  DalyHistoryCursor history_cursor_{};
+  uint32_t history_dump_time_{0};
+#endif
+  uint32_t threshold_update_interval_;
+  uint32_t diagnostic_update_interval_;
+  bool local_min_max_{true};
+  uint16_t pending_requests_{0};
+  uint16_t enabled_requests_{0};
+  uint8_t request_frames_[DALY_REQUEST_COUNT][DALY_FRAME_SIZE];
+  std::vector<WriteRequest> write_queue_;
+  uint8_t write_frame_[DALY_FRAME_SIZE];
+  bool write_in_flight_{false};
+  CallbackManager<void(uint8_t, bool)> write_callbacks_{};
+
+  DalyCommandStats command_stats_[DALY_REQUEST_COUNT]{};
+  uint32_t rtt_histogram_[DALY_RTT_BUCKETS]{};
+  uint32_t discarded_bytes_{0};
+  uint32_t frames_decoded_{0};
+  uint32_t rtt_sum_{0};
+  uint32_t rtt_count_{0};
+  uint32_t diagnostics_frames_{0};
+  uint32_t diagnostics_command_frames_[DALY_REQUEST_COUNT]{};
+  uint32_t diagnostics_time_{0};
+#ifdef USE_SENSOR
+  DalySensor *command_frame_rate_sensors_[DALY_REQUEST_COUNT]{};
+#endif
+
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_CELL_VOLTAGE)
+  std::vector<DalySensor *> cell_voltage_sensors_;
+#endif
+#if defined(USE_SENSOR) && defined(USE_DALY_BMS_TEMPERATURE)
+  std::vector<DalySensor *> temperature_sensors_;
+#endif
+#if defined(USE_SWITCH) && defined(USE_DALY_BMS_MOS)
+  DalyMosSwitch *charging_mos_switch_{nullptr};
+  DalyMosSwitch *discharging_mos_switch_{nullptr};
+#endif
+  DalyPackSnapshot snapshot_{};
+  uint8_t cells_number_{0};
+  uint8_t temperatures_number_{0};
+#if defined(USE_BINARY_SENSOR) && defined(USE_DALY_BMS_FAILURE_STATUS)
+  std::vector<DalyBinarySensor *> failure_binary_sensors_;
+#endif
+  DalyFailureBits failure_bits_{};
+  bool has_failure_bits_{false};
+#if defined(USE_BINARY_SENSOR) && defined(USE_DALY_BMS_BALANCE)
+  std::vector<DalyBinarySensor *> cell_balance_binary_sensors_;
+  // 0x97 bitmap, bit n is cell n + 1
+  uint64_t balance_bits_{0};
+  bool has_balance_bits_{false};
+#endif
+  CallbackManager<void(const DalyFailureBits &, const DalyFailureBits &, const DalyFailureBits &)>
+      failure_callbacks_{};
 };
 
 }  // namespace daly_bms
@@ -0,0 +1,375 @@
+#include "daly_bms_bus.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace daly_bms {
+
+static const char *const TAG = "daly_bms.bus";
+#ifdef USE_DALY_BMS_CAPTURE
+static const char *const CAPTURE_TAG = "daly_bms.capture";
+
+// record kinds, keep in sync with tools/daly_capture.py
+static const uint8_t DALY_CAPTURE_RX = 0;
+static const uint8_t DALY_CAPTURE_TX = 1;
+// a partly filled line goes out after this long so the log stays close to real time
+static const uint32_t DALY_CAPTURE_FLUSH_TIME = 250;
+#endif
+
+// Rates of the Daly UART/RS485 port and of the Bluetooth/WiFi modules that may sit in between.
+static const uint32_t DALY_BAUD_RATES[] = {9600, 19200, 38400, 57600, 115200};
+
+// Reply timeout before the first reply has been measured, and its upper bound after backing off.
+static const uint32_t DALY_INITIAL_REPLY_TIMEOUT = 250;
+static const uint32_t DALY_MAX_REPLY_TIMEOUT = 1000;
+// Slack on top of the time the request and the first reply frame need on the wire.
+static const uint32_t DALY_MIN_REPLY_SLACK = 10;
+// The loop only looks at the UART every few ms, gaps shorter than that cannot be measured.
+static const uint32_t DALY_MIN_RX_TIMEOUT = 20;
+static const uint32_t DALY_MAX_RX_TIMEOUT = 200;
+
+void DalyBmsBus::setup() {
+  // time one frame needs on the wire (10 bits per byte), requests and reply frames have the same size
+  const uint32_t baud_rate = this->parent_->get_baud_rate();
+  this->tx_time_ = (DALY_FRAME_SIZE * 10 * 1000 + baud_rate - 1) / baud_rate;
+  this->min_reply_timeout_ = 2 * this->tx_time_ + DALY_MIN_REPLY_SLACK;
+  this->initial_reply_timeout_ = std::max(this->min_reply_timeout_, this->tx_time_ + DALY_INITIAL_REPLY_TIMEOUT);
+  this->reply_timing_.assign(this->devices_.size(), ReplyTiming{this->initial_reply_timeout_, 0, 0});
+  // a frame arrives in one piece, a pause of a few frame times means the rest is lost
+  this->min_rx_timeout_ = clamp<uint32_t>(3 * this->tx_time_, DALY_MIN_RX_TIMEOUT, DALY_MAX_RX_TIMEOUT);
+  this->rx_timeout_ = this->min_rx_timeout_;
+}
+
+void DalyBmsBus::dump_config() {
+  ESP_LOGCONFIG(TAG, "Daly BMS Bus:");
+  ESP_LOGCONFIG(TAG, "  Devices: %u", (unsigned) this->devices_.size());
+  ESP_LOGCONFIG(TAG, "  Frame time: %ums", (unsigned) this->tx_time_);
+  ESP_LOGCONFIG(TAG, "  Reply timeout: %ums (min %ums, per device)", (unsigned) this->initial_reply_timeout_,
+                (unsigned) this->min_reply_timeout_);
+  ESP_LOGCONFIG(TAG, "  Inter-byte timeout: %ums (min %ums)", (unsigned) this->rx_timeout_,
+                (unsigned) this->min_rx_timeout_);
+  const uint32_t baud_rate = this->parent_->get_baud_rate();
+  if (std::find(std::begin(DALY_BAUD_RATES), std::end(DALY_BAUD_RATES), baud_rate) == std::end(DALY_BAUD_RATES))
+    ESP_LOGW(TAG, "  Baud rate %u is not supported by Daly BMSes", (unsigned) baud_rate);
+#ifdef USE_DALY_BMS_CAPTURE
+  if (this->capture_) {
+    ESP_LOGCONFIG(TAG, "  Capture: debug level, tag %s", CAPTURE_TAG);
+#if ESPHOME_LOG_LEVEL < ESPHOME_LOG_LEVEL_DEBUG
+    // the capture lines are compiled out below debug level
+    ESP_LOGW(TAG, "  Capture is on, but the logger level is below DEBUG: nothing is captured");
+#endif
+  }
+#endif
+}
+
+float DalyBmsBus::get_setup_priority() const { return setup_priority::BUS - 1.0f; }
+
+void DalyBmsBus::loop() {
+  const uint32_t now = millis();
+  if (this->rx_index_ != 0 && (now - this->last_transmission_ >= this->rx_timeout_)) {
+    // last transmission too long ago. Reset RX index and give a slow link more time next round.
+    ESP_LOGW(TAG, "Last transmission too long ago. Reset RX index.");
+    if (this->active_device_ != nullptr)
+      this->active_device_->on_resync(this->partial_frame_id_());
+    this->rx_index_ = 0;
+    this->rx_timeout_ = std::min(2 * this->rx_timeout_, DALY_MAX_RX_TIMEOUT);
+  }
+  uint8_t buffer[DALY_FRAME_SIZE];
+  int avail;
+  while ((avail = this->available()) > 0) {
+    const size_t len = std::min<size_t>(avail, sizeof(buffer));
+    if (!this->read_array(buffer, len))
+      break;
+    this->last_transmission_ = now;
+#ifdef USE_DALY_BMS_CAPTURE
+    if (this->capture_)
+      this->add_capture_(DALY_CAPTURE_RX, buffer, len, now);
+#endif
+    for (size_t i = 0; i < len; i++)
+      this->parse_byte_(buffer[i]);
+  }
+
+  if (this->waiting_reply_) {
+    if (this->expected_frames_ != 0 && this->received_frames_ >= this->expected_frames_) {
+      // all frames of the reply are in -> send the next request right away
+      this->waiting_reply_ = false;
+      this->active_device_->on_reply_complete(this->pending_request_, now - this->request_time_);
+    } else if (this->expected_frames_ == 0 && this->received_frames_ != 0 && this->rx_index_ == 0 &&
+               now - this->last_transmission_ >= this->rx_timeout_ + this->tx_time_) {
+      // multi-frame reply of unknown length: complete once the line stays quiet longer than a frame gap
+      this->waiting_reply_ = false;
+      this->active_device_->on_reply_complete(this->pending_request_, this->last_transmission_ - this->request_time_);
+    } else if (this->received_frames_ == 0 && this->rx_index_ == 0
+                   ? now - this->request_time_ >= this->active_timing_->reply_timeout
+                   : now - this->last_transmission_ >= this->active_timing_->reply_timeout) {
+      // either nothing came back at all or a multi-frame reply stalled
+      ESP_LOGW(TAG, "No reply from %x to request %x", this->active_device_->get_address(), this->pending_request_);
+      this->waiting_reply_ = false;
+      this->active_timing_->reply_timeout =
+          std::min(2 * this->active_timing_->reply_timeout, DALY_MAX_REPLY_TIMEOUT);
+      this->active_device_->on_reply_timeout(this->pending_request_);
+    }
+  }
+
+  if (!this->waiting_reply_)
+    this->send_next_request_();
+#ifdef USE_DALY_BMS_CAPTURE
+  if (this->capture_size_ != 0 && now - this->capture_start_ >= DALY_CAPTURE_FLUSH_TIME)
+    this->flush_capture_();
+#endif
+}
+
+void DalyBmsBus::send_next_request_() {
+  // write commands of any device go out before the next read
+  for (size_t index = 0; index < this->devices_.size(); index++) {
+    if (this->devices_[index]->has_pending_write()) {
+      this->request_data_(index, this->devices_[index]->next_request());
+      return;
+    }
+  }
+  // round robin: start with the device after the one that was served last
+  const size_t count = this->devices_.size();
+  for (size_t n = 0; n < count; n++) {
+    const size_t index = (this->next_device_ + n) % count;
+    DalyBmsComponent *device = this->devices_[index];
+    const uint8_t *request = device->next_request();
+    if (request == nullptr)
+      continue;
+    this->next_device_ = (index + 1) % count;
+    this->request_data_(index, request);
+    return;
+  }
+}
+
+void DalyBmsBus::request_data_(size_t index, const uint8_t *request) {
+  DalyBmsComponent *device = this->devices_[index];
+  const uint8_t id = device->request_id(request);
+  ESP_LOGV(TAG, "Request datapacket Nr %x from %x", id, device->get_address());
+  // the frame fits into the UART TX buffer, the reply timeout covers the time it takes to go out
+  this->write_array(request, device->request_size());
+#ifdef USE_DALY_BMS_CAPTURE
+  if (this->capture_)
+    this->add_capture_(DALY_CAPTURE_TX, request, device->request_size(), millis());
+#endif
+
+  this->active_device_ = device;
+  this->active_timing_ = &this->reply_timing_[index];
+  this->pending_request_ = id;
+  this->expected_frames_ = device->expected_reply_frames(id);
+  this->received_frames_ = 0;
+  this->waiting_reply_ = device->on_request_sent(id);
+  this->request_time_ = millis();
+}
+
+void DalyBmsBus::parse_byte_(uint8_t c) {
+  if (this->protocol_ == DALY_PROTOCOL_MODBUS) {
+    this->parse_modbus_byte_(c);
+    return;
+  }
+  const uint8_t at = this->rx_index_;
+  if (at == 0 && c != 0xA5) {
+    // hunting for the start flag
+    if (this->active_device_ != nullptr)
+      this->active_device_->on_discarded_bytes(1);
+    return;
+  }
+  this->rx_buffer_[at] = c;
+  this->rx_index_ = at + 1;
+  // check each header byte as it comes in, a corrupted header must not hold on to the bytes after it
+  if ((at == 1 && !this->is_known_address_(c)) || (at == 2 && !DalyBmsComponent::is_known_data_id(c)) ||
+      (at == 3 && c != DALY_FRAME_SIZE - 5)) {
+    ESP_LOGV(TAG, "Invalid header byte %u: 0x%02X", at, c);
+    if (this->active_device_ != nullptr)
+      this->active_device_->on_resync(this->partial_frame_id_());
+    this->resync_();
+    return;
+  }
+  if (at < DALY_FRAME_SIZE - 1) {
+    this->rx_checksum_ = at == 0 ? c : this->rx_checksum_ + c;
+    return;
+  }
+  if (c != this->rx_checksum_) {
+    ESP_LOGW(TAG, "Checksum-Error on Packet %x", this->rx_buffer_[2]);
+    if (this->active_device_ != nullptr)
+      this->active_device_->on_checksum_error(this->rx_buffer_[2]);
+    this->resync_();
+    return;
+  }
+  this->rx_index_ = 0;
+  // frames come through in one piece again, let the inter-byte timeout shrink back
+  if (this->rx_timeout_ > this->min_rx_timeout_)
+    this->rx_timeout_--;
+  this->handle_frame_(this->rx_buffer_);
+}
+
+void DalyBmsBus::resync_() {
+  // the start flag was a data byte or the frame lost bytes: the next frame may already be buffered, so parse again
+  // from the next start flag instead of waiting for the line to go quiet
+  const uint8_t size = this->rx_index_;
+  uint8_t skip = 1;
+  while (skip < size && this->rx_buffer_[skip] != 0xA5)
+    skip++;
+  if (this->active_device_ != nullptr)
+    this->active_device_->on_discarded_bytes(skip);
+  uint8_t pending[DALY_FRAME_SIZE];
+  const uint8_t rest = size - skip;
+  memcpy(pending, this->rx_buffer_ + skip, rest);
+  this->rx_index_ = 0;
+  // each pass drops at least the old start flag, so this ends after a frame length at most
+  for (uint8_t i = 0; i < rest; i++)
+    this->parse_byte_(pending[i]);
+}
+
+uint8_t DalyBmsBus::partial_frame_id_() const {
+  // the data ID of a Daly frame counts once its header has been checked, Modbus replies do not carry it
+  if (this->protocol_ == DALY_PROTOCOL_DALY && this->rx_index_ > 3)
+    return this->rx_buffer_[2];
+  return this->pending_request_;
+}
+
+bool DalyBmsBus::is_known_address_(uint8_t address) const {
+  for (auto *device : this->devices_) {
+    if (device->get_reply_address() == address)
+      return true;
+  }
+  return false;
+}
+
+void DalyBmsBus::parse_modbus_byte_(uint8_t c) {
+  const uint8_t at = this->rx_index_;
+  // Modbus has no start flag: a reply starts with the address of the device that was asked
+  if (at == 0 && (!this->waiting_reply_ || c != this->active_device_->get_reply_address())) {
+    if (this->active_device_ != nullptr)
+      this->active_device_->on_discarded_bytes(1);
+    return;
+  }
+  if (at == 1 && (c & 0x7F) != 0x03) {
+    ESP_LOGW(TAG, "Unexpected Modbus function 0x%02X", c);
+    this->rx_index_ = 0;
+    return;
+  }
+  if (at == 2 && !(this->rx_buffer_[1] & 0x80) && (c & 1 || c > 2 * DALY_MODBUS_MAX_REGISTERS)) {
+    ESP_LOGW(TAG, "Invalid Modbus byte count %u", c);
+    this->rx_index_ = 0;
+    return;
+  }
+  this->rx_buffer_[at] = c;
+  this->rx_index_ = at + 1;
+  if (at == 0 && this->received_frames_ == 0) {
+    // time to the first byte, scaled to a daly frame so the reply timeout means the same for both protocols
+    this->update_reply_timeout_(this->last_transmission_ - this->request_time_ + this->tx_time_);
+  }
+  // an exception reply is address, function | 0x80, exception code and CRC
+  const uint8_t size = this->rx_index_ < 3 ? 0 : (this->rx_buffer_[1] & 0x80) ? 5 : 3 + this->rx_buffer_[2] + 2;
+  if (size == 0 || this->rx_index_ < size)
+    return;
+  this->rx_index_ = 0;
+  DalyBmsComponent *device = this->active_device_;
+  if (crc16(this->rx_buffer_, size - 2) != encode_uint16(this->rx_buffer_[size - 1], this->rx_buffer_[size - 2])) {
+    ESP_LOGW(TAG, "CRC error on Modbus reply from %x", device->get_address());
+    device->on_checksum_error(this->pending_request_);
+    return;
+  }
+  if (this->rx_timeout_ > this->min_rx_timeout_)
+    this->rx_timeout_--;
+  this->received_frames_++;
+  if (this->rx_buffer_[1] & 0x80) {
+    ESP_LOGW(TAG, "Modbus exception %u from %x on read 0x%02X", this->rx_buffer_[2], device->get_address(),
+             this->pending_request_);
+    return;
+  }
+  device->decode_modbus(this->pending_request_, this->rx_buffer_ + 3, this->rx_buffer_[2] / 2);
+}
+
+uint32_t DalyBmsBus::get_reply_timeout(const DalyBmsComponent *device) const {
+  for (size_t index = 0; index < this->reply_timing_.size(); index++) {
+    if (this->devices_[index] == device)
+      return this->reply_timing_[index].reply_timeout;
+  }
+  return 0;
+}
+
+void DalyBmsBus::update_reply_timeout_(uint32_t sample) {
+  // smoothed response time and its mean deviation as in TCP (RFC 6298), kept scaled by 8 and 4
+  ReplyTiming &timing = *this->active_timing_;
+  if (timing.srtt == 0) {
+    timing.srtt = sample << 3;
+    timing.rttvar = sample << 1;
+  } else {
+    const int32_t error = int32_t(sample) - int32_t(timing.srtt >> 3);
+    timing.srtt += error;
+    timing.rttvar += std::abs(error) - int32_t(timing.rttvar >> 2);
+  }
+  const uint32_t timeout = (timing.srtt >> 3) + timing.rttvar;
+  timing.reply_timeout = clamp(timeout, this->min_reply_timeout_, DALY_MAX_REPLY_TIMEOUT);
+  ESP_LOGV(TAG, "Response time of %x %ums, reply timeout %ums", this->active_device_->get_address(),
+           (unsigned) sample, (unsigned) timing.reply_timeout);
+}
+
+void DalyBmsBus::handle_frame_(const uint8_t *frame) {
+  DalyBmsComponent *device = nullptr;
+  if (this->waiting_reply_ && frame[1] == this->active_device_->get_reply_address()) {
+    device = this->active_device_;
+    if (frame[2] == this->pending_request_ && this->received_frames_++ == 0)
+      this->update_reply_timeout_(this->last_transmission_ - this->request_time_);
+  } else {
+    // late reply to a request that already timed out
+    for (auto *candidate : this->devices_) {
+      if (candidate->get_reply_address() == frame[1]) {
+        device = candidate;
+        break;
+      }
+    }
+  }
+  if (device == nullptr) {
+    ESP_LOGW(TAG, "Packet %x from unknown address %x", frame[2], frame[1]);
+    return;
+  }
+  device->decode_data(frame);
+}
+
+#ifdef USE_DALY_BMS_CAPTURE
+static uint8_t put_varint(uint8_t *out, uint32_t value) {
+  uint8_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+void DalyBmsBus::add_capture_(uint8_t kind, const uint8_t *data, uint8_t len, uint32_t now) {
+  // varint time and delta (5 bytes each at most), kind and length
+  if ((size_t) this->capture_size_ + 12 + len > sizeof(this->capture_buffer_))
+    this->flush_capture_();
+  uint8_t *out = this->capture_buffer_;
+  if (this->capture_size_ == 0) {
+    this->capture_start_ = now;
+    this->capture_last_ = now;
+    this->capture_size_ = put_varint(out, now);
+  }
+  this->capture_size_ += put_varint(out + this->capture_size_, now - this->capture_last_);
+  out[this->capture_size_++] = kind;
+  out[this->capture_size_++] = len;
+  memcpy(out + this->capture_size_, data, len);
+  this->capture_size_ += len;
+  this->capture_last_ = now;
+}
+
+void DalyBmsBus::flush_capture_() {
+  if (this->capture_size_ == 0)
+    return;
+  // numbered so the extractor notices lines the log dropped
+  ESP_LOGD(CAPTURE_TAG, "%u %s", (unsigned) this->capture_line_++,
+           base64_encode(this->capture_buffer_, this->capture_size_).c_str());
+  this->capture_size_ = 0;
+}
+#endif
+
+}  // namespace daly_bms
+}  // namespace esphome
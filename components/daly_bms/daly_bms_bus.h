@@ -0,0 +1,95 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/components/uart/uart.h"
+#include "daly_bms.h"
+
+#include <vector>
+
+namespace esphome {
+namespace daly_bms {
+
+/// Owns one UART and serialises the requests of all Daly BMSes connected to it. Replies are routed to the
+/// device by their address byte; the devices take turns so every pack gets its share of the line.
+class DalyBmsBus : public Component, public uart::UARTDevice {
+ public:
+  DalyBmsBus() = default;
+
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  float get_setup_priority() const override;
+
+  void register_device(DalyBmsComponent *device) { this->devices_.push_back(device); }
+  /// All devices on one bus speak the same protocol, the parser follows it.
+  void set_protocol(DalyProtocol protocol) { this->protocol_ = protocol; }
+  /// Current reply timeout of `device` in ms, 0 for a device that is not on this bus.
+  uint32_t get_reply_timeout(const DalyBmsComponent *device) const;
+#ifdef USE_DALY_BMS_CAPTURE
+  /// Streams the received chunks and the requests with their time to the log, see tools/daly_capture.py.
+  void set_capture(bool capture) { this->capture_ = capture; }
+#endif
+
+ protected:
+  /// Response time of one device and the reply timeout derived from it, so a pack that is offline or slow does
+  /// not stretch the timeout of the others.
+  struct ReplyTiming {
+    uint32_t reply_timeout;
+    uint32_t srtt;
+    uint32_t rttvar;
+  };
+
+  void send_next_request_();
+  void request_data_(size_t index, const uint8_t *request);
+  void parse_byte_(uint8_t c);
+  void parse_modbus_byte_(uint8_t c);
+  void resync_();
+  /// Data ID the frame in rx_buffer_ belongs to, for counting it when it is dropped.
+  uint8_t partial_frame_id_() const;
+  bool is_known_address_(uint8_t address) const;
+  void handle_frame_(const uint8_t *frame);
+  void update_reply_timeout_(uint32_t sample);
+#ifdef USE_DALY_BMS_CAPTURE
+  void add_capture_(uint8_t kind, const uint8_t *data, uint8_t len, uint32_t now);
+  void flush_capture_();
+#endif
+
+  std::vector<DalyBmsComponent *> devices_;
+  uint8_t next_device_{0};
+
+  DalyProtocol protocol_{DALY_PROTOCOL_DALY};
+  // address, function, byte count, registers and CRC of the largest Modbus reply
+  uint8_t rx_buffer_[3 + 2 * DALY_MODBUS_MAX_REGISTERS + 2];
+  uint8_t rx_index_{0};
+  uint8_t rx_checksum_{0};
+  uint32_t last_transmission_{0};
+
+  DalyBmsComponent *active_device_{nullptr};
+  bool waiting_reply_{false};
+  uint8_t pending_request_{0};
+  uint8_t expected_frames_{0};
+  uint8_t received_frames_{0};
+  uint32_t request_time_{0};
+  uint32_t tx_time_{0};
+
+  // timeouts adapt to the link: derived from the baud rate, then from the measured response time of each device
+  std::vector<ReplyTiming> reply_timing_;
+  ReplyTiming *active_timing_{nullptr};
+  uint32_t initial_reply_timeout_{0};
+  uint32_t min_reply_timeout_{0};
+  uint32_t rx_timeout_{0};
+  uint32_t min_rx_timeout_{0};
+
+#ifdef USE_DALY_BMS_CAPTURE
+  // one log line: time of its first record, then records of time delta, kind, length and bytes
+  bool capture_{false};
+  uint8_t capture_buffer_[96];
+  uint8_t capture_size_{0};
+  uint32_t capture_start_{0};
+  uint32_t capture_last_{0};
+  uint32_t capture_line_{0};
+#endif
+};
+
+}  // namespace daly_bms
+}  // namespace esphome
@@ -0,0 +1,82 @@
+#include "daly_cell_analytics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace esphome {
+namespace daly_bms {
+
+// a current read longer ago than this does not describe the cells any more
+static const uint32_t DALY_ANALYTICS_MAX_CURRENT_AGE = 5000;
+// the reference reading is kept until a step against it is accepted, but no longer than this: over minutes the
+// cells drift with the charge that went in or out, which would pass for resistance
+static const uint32_t DALY_ANALYTICS_MAX_REFERENCE_AGE = 30000;
+// each accepted step moves the resistance estimate this far towards the new value
+static const float DALY_ANALYTICS_RESISTANCE_WEIGHT = 0.25f;
+// anything outside this is a reading taken while the current moved, not the cell (mΩ)
+static const float DALY_ANALYTICS_MAX_RESISTANCE = 1000.0f;
+
+void DalyCellAnalytics::add_current(int32_t current, uint32_t time) {
+  this->current_ = current;
+  this->current_time_ = time;
+  this->has_current_ = true;
+}
+
+void DalyCellAnalytics::reset_(uint8_t cells) {
+  this->cells_ = cells;
+  this->has_reference_ = false;
+  std::fill(this->resistances_, this->resistances_ + DALY_ANALYTICS_MAX_CELLS, NAN);
+}
+
+void DalyCellAnalytics::add_cells(const uint16_t *voltages, uint8_t cells, uint32_t time) {
+  cells = std::min(cells, DALY_ANALYTICS_MAX_CELLS);
+  if (cells == 0)
+    return;
+  if (cells != this->cells_) {
+    // a different cell count is a different pack layout, start over
+    this->reset_(cells);
+    std::copy(voltages, voltages + cells, this->voltages_);
+  } else {
+    const float dt = time - this->time_;
+    const float alpha = this->time_constant_ == 0 ? 1.0f : 1.0f - expf(-dt / this->time_constant_);
+    for (uint8_t cell = 0; cell < cells; cell++)
+      this->voltages_[cell] += alpha * (voltages[cell] - this->voltages_[cell]);
+  }
+  this->time_ = time;
+
+  if (!this->has_current_ || time - this->current_time_ > DALY_ANALYTICS_MAX_CURRENT_AGE)
+    return;
+  const int32_t current = this->current_;
+  const int32_t step = current - this->reference_current_;
+  const bool fresh = this->has_reference_ && time - this->reference_time_ <= DALY_ANALYTICS_MAX_REFERENCE_AGE;
+  if (fresh && (uint32_t) std::abs(step) < this->current_step_) {
+    // a slow ramp adds up against the reference until it makes a step
+    return;
+  }
+  if (fresh) {
+    for (uint8_t cell = 0; cell < cells; cell++) {
+      // mV per 0.1 A, times 10 is mΩ
+      const float resistance = 10.0f * (voltages[cell] - this->reference_voltages_[cell]) / step;
+      if (resistance <= 0 || resistance > DALY_ANALYTICS_MAX_RESISTANCE)
+        continue;
+      float &estimate = this->resistances_[cell];
+      estimate = std::isnan(estimate) ? resistance
+                                      : estimate + DALY_ANALYTICS_RESISTANCE_WEIGHT * (resistance - estimate);
+    }
+  }
+  std::copy(voltages, voltages + cells, this->reference_voltages_);
+  this->reference_current_ = current;
+  this->reference_time_ = time;
+  this->has_reference_ = true;
+}
+
+float DalyCellAnalytics::mean() const {
+  float sum = 0;
+  for (uint8_t cell = 0; cell < this->cells_; cell++)
+    sum += this->voltages_[cell];
+  return this->cells_ != 0 ? sum / this->cells_ : NAN;
+}
+
+}  // namespace daly_bms
+}  // namespace esphome
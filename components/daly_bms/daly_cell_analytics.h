@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace daly_bms {
+
+static const uint8_t DALY_ANALYTICS_MAX_CELLS = 48;
+
+/// Per-cell statistics from the cell voltages (0x95) and the pack current (0x90) read just before them: a
+/// smoothed voltage per cell and an internal resistance estimate from the voltage change across current steps.
+class DalyCellAnalytics {
+ public:
+  /// Time constant of the voltage smoothing in ms.
+  void set_time_constant(uint32_t time_constant) { this->time_constant_ = time_constant; }
+  /// Smallest current change (0.1 A) that counts as a step for the resistance estimate.
+  void set_current_step(uint32_t current_step) { this->current_step_ = current_step; }
+
+  /// Pack current from 0x90 in 0.1 A, positive while charging.
+  void add_current(int32_t current, uint32_t time);
+  /// A complete set of cell voltages in mV.
+  void add_cells(const uint16_t *voltages, uint8_t cells, uint32_t time);
+
+  uint8_t cells() const { return this->cells_; }
+  /// Smoothed voltage of `cell` in mV.
+  float voltage(uint8_t cell) const { return this->voltages_[cell]; }
+  /// Mean of the smoothed cell voltages in mV.
+  float mean() const;
+  /// Internal resistance of `cell` in mΩ, NAN until a current step was seen.
+  float resistance(uint8_t cell) const { return this->resistances_[cell]; }
+
+ protected:
+  void reset_(uint8_t cells);
+
+  uint32_t time_constant_{600000};
+  uint32_t current_step_{50};
+
+  int32_t current_{0};
+  uint32_t current_time_{0};
+  bool has_current_{false};
+
+  uint8_t cells_{0};
+  uint32_t time_{0};
+  float voltages_[DALY_ANALYTICS_MAX_CELLS];
+  float resistances_[DALY_ANALYTICS_MAX_CELLS];
+  // the reading the next current step is measured against: the first one with a known current, then the one that
+  // completed the last step, or a new one once it got too old
+  uint16_t reference_voltages_[DALY_ANALYTICS_MAX_CELLS];
+  int32_t reference_current_{0};
+  uint32_t reference_time_{0};
+  bool has_reference_{false};
+};
+
+}  // namespace daly_bms
+}  // namespace esphome
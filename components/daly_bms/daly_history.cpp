@@ -0,0 +1,182 @@
+#include "daly_history.h"
+#include "esphome/core/helpers.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace esphome {
+namespace daly_bms {
+
+static const uint8_t DALY_HISTORY_HEADER_SIZE = 3;
+// header byte, absolute time and every value at its widest
+static const size_t DALY_HISTORY_MAX_RECORD = 1 + 5 + DALY_HISTORY_MAX_VALUES * 5;
+static_assert(DALY_HISTORY_HEADER_SIZE + DALY_HISTORY_MAX_RECORD <= DALY_HISTORY_BLOCK_SIZE,
+              "a record must fit into an empty block");
+
+static size_t put_varint(uint8_t *out, uint32_t value) {
+  size_t n = 0;
+  while (value >= 0x80) {
+    out[n++] = (value & 0x7F) | 0x80;
+    value >>= 7;
+  }
+  out[n++] = value;
+  return n;
+}
+
+static uint32_t get_varint(const uint8_t *in, uint16_t &offset) {
+  uint32_t value = 0;
+  uint8_t shift = 0;
+  uint8_t c;
+  do {
+    c = in[offset++];
+    value |= (uint32_t) (c & 0x7F) << shift;
+    shift += 7;
+  } while ((c & 0x80) && shift < 35);
+  return value;
+}
+
+static uint32_t zigzag(int32_t value) { return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31); }
+static int32_t unzigzag(uint32_t value) { return (int32_t) (value >> 1) ^ -(int32_t) (value & 1); }
+
+static uint16_t get_used(const uint8_t *block) { return block[0] | (block[1] << 8); }
+static void set_used(uint8_t *block, uint16_t used) {
+  block[0] = used & 0xFF;
+  block[1] = used >> 8;
+}
+
+void DalyHistoryCoder::reset() {
+  this->time = 0;
+  this->has_time = false;
+  memset(this->counts, 0, sizeof(this->counts));
+}
+
+bool DalyHistory::init(uint16_t blocks) {
+  if (blocks == 0)
+    return false;
+  ExternalRAMAllocator<uint8_t> allocator(ExternalRAMAllocator<uint8_t>::ALLOW_FAILURE);
+  this->buffer_ = allocator.allocate((size_t) blocks * DALY_HISTORY_BLOCK_SIZE);
+  if (this->buffer_ == nullptr)
+    return false;
+  this->blocks_ = blocks;
+  this->clear();
+  return true;
+}
+
+void DalyHistory::clear() {
+  this->first_block_ = 0;
+  this->last_block_ = 0;
+  uint8_t *block = this->block_(0);
+  set_used(block, DALY_HISTORY_HEADER_SIZE);
+  block[2] = 0;
+  this->writer_.reset();
+}
+
+void DalyHistory::start_block_() {
+  this->last_block_++;
+  if (this->last_block_ - this->first_block_ >= this->blocks_)
+    this->first_block_++;
+  uint8_t *block = this->block_(this->last_block_);
+  set_used(block, DALY_HISTORY_HEADER_SIZE);
+  block[2] = 0;
+  this->writer_.reset();
+}
+
+size_t DalyHistory::encode_(uint8_t *out, DalyHistoryType type, uint32_t time, const int32_t *values,
+                            uint8_t count) const {
+  const DalyHistoryCoder &coder = this->writer_;
+  size_t n = 0;
+  out[n++] = (type << 6) | count;
+  n += put_varint(out + n, coder.has_time ? time - coder.time : time);
+  // deltas only against a record with the same layout, a changed cell count starts over
+  const bool delta = coder.counts[type] == count;
+  for (uint8_t i = 0; i < count; i++)
+    n += put_varint(out + n, zigzag(delta ? values[i] - coder.values[type][i] : values[i]));
+  return n;
+}
+
+void DalyHistory::record(DalyHistoryType type, uint32_t time, const int32_t *values, uint8_t count) {
+  if (this->buffer_ == nullptr || count == 0)
+    return;
+  count = std::min(count, DALY_HISTORY_MAX_VALUES);
+  uint8_t encoded[DALY_HISTORY_MAX_RECORD];
+  size_t size = this->encode_(encoded, type, time, values, count);
+  uint8_t *block = this->block_(this->last_block_);
+  if (get_used(block) + size > DALY_HISTORY_BLOCK_SIZE) {
+    // the new block has no references yet, encode again with absolute values
+    this->start_block_();
+    block = this->block_(this->last_block_);
+    size = this->encode_(encoded, type, time, values, count);
+  }
+  const uint16_t used = get_used(block);
+  memcpy(block + used, encoded, size);
+  set_used(block, used + size);
+  block[2]++;
+
+  this->writer_.time = time;
+  this->writer_.has_time = true;
+  this->writer_.counts[type] = count;
+  memcpy(this->writer_.values[type], values, count * sizeof(int32_t));
+}
+
+void DalyHistory::rewind(DalyHistoryCursor &cursor) const {
+  cursor.block = this->first_block_;
+  cursor.offset = DALY_HISTORY_HEADER_SIZE;
+  cursor.lost_blocks = 0;
+  cursor.coder.reset();
+}
+
+bool DalyHistory::next(DalyHistoryCursor &cursor, DalyHistoryRecord &record) const {
+  if (this->buffer_ == nullptr)
+    return false;
+  if (cursor.block < this->first_block_) {
+    // overwritten while it was being read
+    cursor.lost_blocks += this->first_block_ - cursor.block;
+    cursor.block = this->first_block_;
+    cursor.offset = DALY_HISTORY_HEADER_SIZE;
+    cursor.coder.reset();
+  }
+  const uint8_t *block = this->block_(cursor.block);
+  while (cursor.offset >= get_used(block)) {
+    if (cursor.block >= this->last_block_)
+      return false;
+    cursor.block++;
+    cursor.offset = DALY_HISTORY_HEADER_SIZE;
+    cursor.coder.reset();
+    block = this->block_(cursor.block);
+  }
+
+  DalyHistoryCoder &coder = cursor.coder;
+  const uint8_t header = block[cursor.offset++];
+  record.type = (DalyHistoryType) (header >> 6);
+  record.count = header & 0x3F;
+  const uint32_t time = get_varint(block, cursor.offset);
+  record.time = coder.has_time ? coder.time + time : time;
+  const bool delta = coder.counts[record.type] == record.count;
+  for (uint8_t i = 0; i < record.count; i++) {
+    const int32_t value = unzigzag(get_varint(block, cursor.offset));
+    record.values[i] = delta ? coder.values[record.type][i] + value : value;
+  }
+
+  coder.time = record.time;
+  coder.has_time = true;
+  coder.counts[record.type] = record.count;
+  memcpy(coder.values[record.type], record.values, record.count * sizeof(int32_t));
+  return true;
+}
+
+size_t DalyHistory::used() const {
+  size_t used = 0;
+  for (uint32_t block = this->first_block_; block <= this->last_block_ && this->buffer_ != nullptr; block++)
+    used += get_used(this->block_(block));
+  return used;
+}
+
+uint32_t DalyHistory::records() const {
+  uint32_t records = 0;
+  for (uint32_t block = this->first_block_; block <= this->last_block_ && this->buffer_ != nullptr; block++)
+    records += this->block_(block)[2];
+  return records;
+}
+
+}  // namespace daly_bms
+}  // namespace esphome
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace daly_bms {
+
+static const size_t DALY_HISTORY_BLOCK_SIZE = 256;
+static const uint8_t DALY_HISTORY_MAX_VALUES = 48;
+
+enum DalyHistoryType : uint8_t {
+  DALY_HISTORY_PACK = 0,      // 0x90: voltage (0.1 V), current (0.1 A, signed), SOC (0.1 %)
+  DALY_HISTORY_CELLS,         // 0x95: cell voltages (mV)
+  DALY_HISTORY_TEMPERATURES,  // 0x96: probe temperatures (°C)
+  DALY_HISTORY_TYPES,
+};
+
+struct DalyHistoryRecord {
+  DalyHistoryType type;
+  uint32_t time;  // millis() when it was recorded
+  uint8_t count;
+  int32_t values[DALY_HISTORY_MAX_VALUES];
+};
+
+/// Reference values of the delta coder. Reset at the start of every block so each block decodes on its own and
+/// the oldest one can be dropped without touching the others.
+struct DalyHistoryCoder {
+  uint32_t time;
+  bool has_time;
+  uint8_t counts[DALY_HISTORY_TYPES];  // values in the last record of each type, 0 if there is none in this block
+  int32_t values[DALY_HISTORY_TYPES][DALY_HISTORY_MAX_VALUES];
+
+  void reset();
+};
+
+/// Position of a reader, it stays valid while records are added. Blocks overwritten under it are skipped.
+struct DalyHistoryCursor {
+  uint32_t block;
+  uint16_t offset;
+  uint32_t lost_blocks;
+  DalyHistoryCoder coder;
+};
+
+/// Ring of fixed-size blocks holding telemetry at protocol resolution. A block starts with its used size (2 bytes)
+/// and record count (1 byte). A record is a header byte (type and value count), the time since the previous record
+/// and its values as zigzag varints, each relative to the previous record of the same type. When the ring is full
+/// the oldest block is dropped.
+class DalyHistory {
+ public:
+  /// Allocates `blocks` blocks, in PSRAM if there is any. Returns false if the memory is not available.
+  bool init(uint16_t blocks);
+  bool is_ready() const { return this->buffer_ != nullptr; }
+
+  void record(DalyHistoryType type, uint32_t time, const int32_t *values, uint8_t count);
+  void clear();
+
+  void rewind(DalyHistoryCursor &cursor) const;
+  /// Decodes the record at `cursor` and advances it. Returns false once the newest record has been read.
+  bool next(DalyHistoryCursor &cursor, DalyHistoryRecord &record) const;
+
+  size_t capacity() const { return (size_t) this->blocks_ * DALY_HISTORY_BLOCK_SIZE; }
+  size_t used() const;
+  uint32_t records() const;
+
+ protected:
+  uint8_t *block_(uint32_t block) const { return this->buffer_ + (block % this->blocks_) * DALY_HISTORY_BLOCK_SIZE; }
+  void start_block_();
+  size_t encode_(uint8_t *out, DalyHistoryType type, uint32_t time, const int32_t *values, uint8_t count) const;
+
+  uint8_t *buffer_{nullptr};
+  uint16_t blocks_{0};
+  // blocks are numbered as they are started, the ring holds first_block_ to last_block_
+  uint32_t first_block_{0};
+  uint32_t last_block_{0};
+  DalyHistoryCoder writer_{};
+};
+
+}  // namespace daly_bms
+}  // namespace esphome
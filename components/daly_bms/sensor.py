@@ -3,7 +3,6 @@ import esphome.config_validation as cv
 from esphome.components import sensor
 from esphome.const import (
     CONF_VOLTAGE,
-    CONF_CAPACITY,
     CONF_CURRENT,
     CONF_POWER,
     CONF_BATTERY_LEVEL,
@@ -15,41 +14,42 @@ from esphome.const import (
     DEVICE_CLASS_BATTERY,
     DEVICE_CLASS_TEMPERATURE,
     DEVICE_CLASS_POWER,
+    DEVICE_CLASS_DURATION,
+    DEVICE_CLASS_ENERGY,
+    ENTITY_CATEGORY_DIAGNOSTIC,
     STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL,
+    STATE_CLASS_TOTAL_INCREASING,
     UNIT_VOLT,
     UNIT_AMPERE,
     UNIT_PERCENT,
     UNIT_CELSIUS,
     UNIT_WATT,
+    UNIT_MILLISECOND,
+    UNIT_SECOND,
+    UNIT_KILOWATT_HOURS,
     ICON_FLASH,
     ICON_PERCENT,
     ICON_COUNTER,
     ICON_THERMOMETER,
     ICON_GAUGE,
 )
-from . import DalyBmsComponent, CONF_BMS_DALY_ID
+from . import (
+    daly_bms,
+    DalyBmsComponent,
+    CONF_BMS_DALY_ID,
+    request_frames,
+    hub_local_min_max,
+    REQUEST_IDS,
+)
+
+DalySensor = daly_bms.class_("DalySensor", sensor.Sensor)
 
 
 CONF_BATTPACK_LEVEL_1_ALARM_HI_V = "battpack_level_1_alarm_high_voltage"
 CONF_BATTPACK_LEVEL_2_ALARM_HI_V = "battpack_level_2_alarm_high_voltage"
 CONF_BATTPACK_LEVEL_1_ALARM_LO_V = "battpack_level_1_alarm_low_voltage"
 CONF_BATTPACK_LEVEL_2_ALARM_LO_V = "battpack_level_2_alarm_low_voltage"
-CONF_CELL_1_VOLTAGE = "cell_1_voltage"
-CONF_CELL_2_VOLTAGE = "cell_2_voltage"
-CONF_CELL_3_VOLTAGE = "cell_3_voltage"
-CONF_CELL_4_VOLTAGE = "cell_4_voltage"
-CONF_CELL_5_VOLTAGE = "cell_5_voltage"
-CONF_CELL_6_VOLTAGE = "cell_6_voltage"
-CONF_CELL_7_VOLTAGE = "cell_7_voltage"
-CONF_CELL_8_VOLTAGE = "cell_8_voltage"
-CONF_CELL_9_VOLTAGE = "cell_9_voltage"
-CONF_CELL_10_VOLTAGE = "cell_10_voltage"
-CONF_CELL_11_VOLTAGE = "cell_11_voltage"
-CONF_CELL_12_VOLTAGE = "cell_12_voltage"
-CONF_CELL_13_VOLTAGE = "cell_13_voltage"
-CONF_CELL_14_VOLTAGE = "cell_14_voltage"
-CONF_CELL_15_VOLTAGE = "cell_15_voltage"
-CONF_CELL_16_VOLTAGE = "cell_16_voltage"
 CONF_CELL_NOMINAL_CAPACITY = "cell_nominal_capacity"
 CONF_CELL_NOMINAL_VOLTAGE = "cell_nominal_voltage"
 CONF_CELL_LEVEL_1_ALARM_HIGH_VOLTAGE = "cell_level_1_alarm_high_voltage"
@@ -61,28 +61,65 @@ CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_TEMPERATURE = "cell_level_2_alarm_difference_
 CONF_CELL_LEVEL_1_ALARM_DIFFERENCE_VOLTAGE = "cell_level_1_alarm_difference_voltage"
 CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_VOLTAGE = "cell_level_2_alarm_difference_voltage"
 CONF_CELL_VOLTAGE_DIFFERENCE = "cell_voltage_difference"
+CONF_AVERAGE_CELL_VOLTAGE = "average_cell_voltage"
 CONF_CELLS_NUMBER = "cells_number"
 CONF_MAX_CELL_VOLTAGE = "max_cell_voltage"
 CONF_MAX_CELL_VOLTAGE_NUMBER = "max_cell_voltage_number"
 CONF_MAX_TEMPERATURE_PROBE_NUMBER = "max_temperature_probe_number"
 CONF_MIN_CELL_VOLTAGE = "min_cell_voltage"
 CONF_MIN_CELL_VOLTAGE_NUMBER = "min_cell_voltage_number"
+CONF_MAX_CELL_RESISTANCE = "max_cell_resistance"
+CONF_MAX_CELL_RESISTANCE_NUMBER = "max_cell_resistance_number"
+CONF_MAX_CELL_DEVIATION = "max_cell_deviation"
+CONF_MAX_CELL_DEVIATION_NUMBER = "max_cell_deviation_number"
 CONF_MIN_TEMPERATURE_PROBE_NUMBER = "min_temperature_probe_number"
 CONF_REMAINING_CAPACITY = "remaining_capacity"
-CONF_TEMPERATURE_1 = "temperature_1"
-CONF_TEMPERATURE_2 = "temperature_2"
 CONF_WATCHDOG = "bms_watchdog"
 
 CONF_FAILURECODE = "fehlercode"
 
+CONF_CHARGED_CAPACITY = "charged_capacity"
+CONF_DISCHARGED_CAPACITY = "discharged_capacity"
+CONF_CHARGED_ENERGY = "charged_energy"
+CONF_DISCHARGED_ENERGY = "discharged_energy"
+CONF_SESSION_CAPACITY = "session_capacity"
+CONF_SESSION_ENERGY = "session_energy"
+
+CONF_TIMEOUTS = "timeouts"
+CONF_CHECKSUM_ERRORS = "checksum_errors"
+CONF_RESYNCS = "resyncs"
+CONF_DISCARDED_BYTES = "discarded_bytes"
+CONF_FRAME_RATE = "frame_rate"
+CONF_ROUND_TRIP_TIME = "round_trip_time"
+CONF_LAST_FRAME_AGE = "last_frame_age"
+
+CONF_DEADBAND = "deadband"
+CONF_HEARTBEAT = "heartbeat"
+
 ICON_ALERT = "mdi:alert"
 ICON_BATTERY_OUTLINE = "mdi:battery-outline"
-ICON_CAR_BATTERY = "mdi:car-battery"
 ICON_CURRENT_DC = "mdi:current-dc"
 ICON_THERMOMETER_CHEVRON_UP = "mdi:thermometer-chevron-up"
 ICON_THERMOMETER_CHEVRON_DOWN = "mdi:thermometer-chevron-down"
+ICON_TIMER_SAND = "mdi:timer-sand"
+ICON_SWAP_HORIZONTAL = "mdi:swap-horizontal"
 
 UNIT_AMPERE_HOUR = "Ah"
+UNIT_FRAMES_PER_SECOND = "frames/s"
+UNIT_MILLIVOLT = "mV"
+UNIT_MILLIOHM = "mΩ"
+
+MAX_CELLS = 48
+# must match DALY_MAX_TEMPERATURES
+MAX_TEMPERATURES = 16
+
+CELL_VOLTAGES = [f"cell_{i}_voltage" for i in range(1, MAX_CELLS + 1)]
+TEMPERATURES = [f"temperature_{i}" for i in range(1, MAX_TEMPERATURES + 1)]
+# per-cell health from the cell analytics
+CELL_RESISTANCES = [f"cell_{i}_resistance" for i in range(1, MAX_CELLS + 1)]
+CELL_DEVIATIONS = [f"cell_{i}_deviation" for i in range(1, MAX_CELLS + 1)]
+# frames decoded per second of each request, e.g. cell_voltage_frame_rate
+COMMAND_FRAME_RATES = {f"{frame.lower()}_frame_rate": data_id for frame, data_id in REQUEST_IDS.items()}
 
 TYPES = [
     CONF_BATTPACK_LEVEL_1_ALARM_HI_V,
@@ -90,22 +127,6 @@ TYPES = [
     CONF_BATTPACK_LEVEL_1_ALARM_LO_V,
     CONF_BATTPACK_LEVEL_2_ALARM_LO_V,
     CONF_BATTERY_LEVEL,
-    CONF_CELL_1_VOLTAGE,
-    CONF_CELL_2_VOLTAGE,
-    CONF_CELL_3_VOLTAGE,
-    CONF_CELL_4_VOLTAGE,
-    CONF_CELL_5_VOLTAGE,
-    CONF_CELL_6_VOLTAGE,
-    CONF_CELL_7_VOLTAGE,
-    CONF_CELL_8_VOLTAGE,
-    CONF_CELL_9_VOLTAGE,
-    CONF_CELL_10_VOLTAGE,
-    CONF_CELL_11_VOLTAGE,
-    CONF_CELL_12_VOLTAGE,
-    CONF_CELL_13_VOLTAGE,
-    CONF_CELL_14_VOLTAGE,
-    CONF_CELL_15_VOLTAGE,
-    CONF_CELL_16_VOLTAGE,
     CONF_CELL_NOMINAL_CAPACITY,
     CONF_CELL_NOMINAL_VOLTAGE,
     CONF_CELL_LEVEL_1_ALARM_HIGH_VOLTAGE,
@@ -117,6 +138,7 @@ TYPES = [
     CONF_CELL_LEVEL_1_ALARM_DIFFERENCE_VOLTAGE,
     CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_VOLTAGE,
     CONF_CELL_VOLTAGE_DIFFERENCE,
+    CONF_AVERAGE_CELL_VOLTAGE,
     CONF_CELLS_NUMBER,
     CONF_CURRENT,
     CONF_CYCLE,
@@ -125,194 +147,257 @@ TYPES = [
     CONF_MAX_CELL_VOLTAGE_NUMBER,
     CONF_MIN_CELL_VOLTAGE,
     CONF_MIN_CELL_VOLTAGE_NUMBER,
+    CONF_MAX_CELL_RESISTANCE,
+    CONF_MAX_CELL_RESISTANCE_NUMBER,
+    CONF_MAX_CELL_DEVIATION,
+    CONF_MAX_CELL_DEVIATION_NUMBER,
     CONF_MAX_TEMPERATURE,
     CONF_MAX_TEMPERATURE_PROBE_NUMBER,
     CONF_MIN_TEMPERATURE,
     CONF_MIN_TEMPERATURE_PROBE_NUMBER,
     CONF_REMAINING_CAPACITY,
-    CONF_TEMPERATURE_1,
-    CONF_TEMPERATURE_2,
     CONF_WATCHDOG,
     CONF_VOLTAGE,
     CONF_POWER,
+    CONF_CHARGED_CAPACITY,
+    CONF_DISCHARGED_CAPACITY,
+    CONF_CHARGED_ENERGY,
+    CONF_DISCHARGED_ENERGY,
+    CONF_SESSION_CAPACITY,
+    CONF_SESSION_ENERGY,
+    CONF_TIMEOUTS,
+    CONF_CHECKSUM_ERRORS,
+    CONF_RESYNCS,
+    CONF_DISCARDED_BYTES,
+    CONF_FRAME_RATE,
+    CONF_ROUND_TRIP_TIME,
+    CONF_LAST_FRAME_AGE,
 ]
 
-CELL_VOLTAGE_SCHEMA = sensor.sensor_schema(
+
+def daly_sensor_schema(**kwargs):
+    return sensor.sensor_schema(DalySensor, **kwargs).extend(
+        {
+            cv.Optional(CONF_DEADBAND): cv.positive_float,
+            cv.Optional(CONF_HEARTBEAT): cv.positive_time_period_milliseconds,
+        }
+    )
+
+
+CELL_VOLTAGE_SCHEMA = daly_sensor_schema(
     unit_of_measurement=UNIT_VOLT,
     device_class=DEVICE_CLASS_VOLTAGE,
     state_class=STATE_CLASS_MEASUREMENT,
     icon=ICON_FLASH,
     accuracy_decimals=3,
 )
-PACK_VOLTAGE_SCHEMA = sensor.sensor_schema(
+TEMPERATURE_SCHEMA = daly_sensor_schema(
+    unit_of_measurement=UNIT_CELSIUS,
+    icon=ICON_THERMOMETER,
+    accuracy_decimals=0,
+    device_class=DEVICE_CLASS_TEMPERATURE,
+    state_class=STATE_CLASS_MEASUREMENT,
+)
+CELL_RESISTANCE_SCHEMA = daly_sensor_schema(
+    unit_of_measurement=UNIT_MILLIOHM,
+    icon=ICON_FLASH,
+    accuracy_decimals=2,
+    state_class=STATE_CLASS_MEASUREMENT,
+)
+CELL_DEVIATION_SCHEMA = daly_sensor_schema(
+    unit_of_measurement=UNIT_MILLIVOLT,
+    icon=ICON_FLASH,
+    accuracy_decimals=1,
+    device_class=DEVICE_CLASS_VOLTAGE,
+    state_class=STATE_CLASS_MEASUREMENT,
+)
+PACK_VOLTAGE_SCHEMA = daly_sensor_schema(
     unit_of_measurement=UNIT_VOLT,
     device_class=DEVICE_CLASS_VOLTAGE,
     icon=ICON_FLASH,
     accuracy_decimals=1,
 )
+CAPACITY_TOTAL_SCHEMA = daly_sensor_schema(
+    unit_of_measurement=UNIT_AMPERE_HOUR,
+    icon=ICON_GAUGE,
+    accuracy_decimals=2,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+)
+ENERGY_TOTAL_SCHEMA = daly_sensor_schema(
+    unit_of_measurement=UNIT_KILOWATT_HOURS,
+    icon=ICON_FLASH,
+    accuracy_decimals=3,
+    device_class=DEVICE_CLASS_ENERGY,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+)
+LINK_COUNTER_SCHEMA = daly_sensor_schema(
+    icon=ICON_COUNTER,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+FRAME_RATE_SCHEMA = daly_sensor_schema(
+    unit_of_measurement=UNIT_FRAMES_PER_SECOND,
+    icon=ICON_SWAP_HORIZONTAL,
+    accuracy_decimals=1,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
 
 CONFIG_SCHEMA = cv.All(
     cv.Schema(
         {
             cv.GenerateID(CONF_BMS_DALY_ID): cv.use_id(DalyBmsComponent),
-            cv.Optional(CONF_VOLTAGE): sensor.sensor_schema(
+            cv.Optional(CONF_VOLTAGE): daly_sensor_schema(
                 unit_of_measurement=UNIT_VOLT,
                 icon=ICON_FLASH,
                 accuracy_decimals=1,
                 device_class=DEVICE_CLASS_VOLTAGE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_CURRENT): sensor.sensor_schema(
+            cv.Optional(CONF_CURRENT): daly_sensor_schema(
                 unit_of_measurement=UNIT_AMPERE,
                 icon=ICON_CURRENT_DC,
                 accuracy_decimals=1,
                 device_class=DEVICE_CLASS_CURRENT,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_POWER): sensor.sensor_schema(
+            cv.Optional(CONF_POWER): daly_sensor_schema(
                 unit_of_measurement=UNIT_WATT,
                 icon=ICON_FLASH,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_POWER,
             ),
-            cv.Optional(CONF_BATTERY_LEVEL): sensor.sensor_schema(
+            cv.Optional(CONF_BATTERY_LEVEL): daly_sensor_schema(
                 unit_of_measurement=UNIT_PERCENT,
                 icon=ICON_PERCENT,
                 accuracy_decimals=1,
                 device_class=DEVICE_CLASS_BATTERY,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_MAX_CELL_VOLTAGE): sensor.sensor_schema(
+            cv.Optional(CONF_MAX_CELL_VOLTAGE): daly_sensor_schema(
                 unit_of_measurement=UNIT_VOLT,
                 icon=ICON_FLASH,
                 accuracy_decimals=2,
                 device_class=DEVICE_CLASS_VOLTAGE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_MAX_CELL_VOLTAGE_NUMBER): sensor.sensor_schema(
+            cv.Optional(CONF_AVERAGE_CELL_VOLTAGE): daly_sensor_schema(
+                unit_of_measurement=UNIT_VOLT,
+                icon=ICON_FLASH,
+                accuracy_decimals=4,
+                device_class=DEVICE_CLASS_VOLTAGE,
+                state_class=STATE_CLASS_MEASUREMENT,
+            ),
+            cv.Optional(CONF_MAX_CELL_VOLTAGE_NUMBER): daly_sensor_schema(
                 icon=ICON_COUNTER,
                 accuracy_decimals=0,
             ),
-            cv.Optional(CONF_MIN_CELL_VOLTAGE): sensor.sensor_schema(
+            cv.Optional(CONF_MIN_CELL_VOLTAGE): daly_sensor_schema(
                 unit_of_measurement=UNIT_VOLT,
                 icon=ICON_FLASH,
                 accuracy_decimals=2,
                 device_class=DEVICE_CLASS_VOLTAGE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_MIN_CELL_VOLTAGE_NUMBER): sensor.sensor_schema(
+            cv.Optional(CONF_MIN_CELL_VOLTAGE_NUMBER): daly_sensor_schema(
                 icon=ICON_COUNTER,
                 accuracy_decimals=0,
             ),
-            cv.Optional(CONF_MAX_TEMPERATURE): sensor.sensor_schema(
+            cv.Optional(CONF_MAX_TEMPERATURE): daly_sensor_schema(
                 unit_of_measurement=UNIT_CELSIUS,
                 icon=ICON_THERMOMETER_CHEVRON_UP,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_TEMPERATURE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_MAX_TEMPERATURE_PROBE_NUMBER): sensor.sensor_schema(
+            cv.Optional(CONF_MAX_TEMPERATURE_PROBE_NUMBER): daly_sensor_schema(
                 icon=ICON_COUNTER,
                 accuracy_decimals=0,
             ),
-            cv.Optional(CONF_MIN_TEMPERATURE): sensor.sensor_schema(
+            cv.Optional(CONF_MIN_TEMPERATURE): daly_sensor_schema(
                 unit_of_measurement=UNIT_CELSIUS,
                 icon=ICON_THERMOMETER_CHEVRON_DOWN,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_TEMPERATURE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_MIN_TEMPERATURE_PROBE_NUMBER): sensor.sensor_schema(
+            cv.Optional(CONF_MIN_TEMPERATURE_PROBE_NUMBER): daly_sensor_schema(
                 icon=ICON_COUNTER,
                 accuracy_decimals=0,
             ),
-            cv.Optional(CONF_REMAINING_CAPACITY): sensor.sensor_schema(
+            cv.Optional(CONF_REMAINING_CAPACITY): daly_sensor_schema(
                 unit_of_measurement=UNIT_AMPERE_HOUR,
                 icon=ICON_GAUGE,
                 accuracy_decimals=2,
                 device_class=DEVICE_CLASS_VOLTAGE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_CELL_NOMINAL_CAPACITY): sensor.sensor_schema(
+            cv.Optional(CONF_CELL_NOMINAL_CAPACITY): daly_sensor_schema(
                 unit_of_measurement=UNIT_AMPERE_HOUR,
                 icon=ICON_GAUGE,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_VOLTAGE,
             ),
-            cv.Optional(CONF_CELLS_NUMBER): sensor.sensor_schema(
+            cv.Optional(CONF_CELLS_NUMBER): daly_sensor_schema(
                 icon=ICON_COUNTER,
                 accuracy_decimals=0,
             ),
-            cv.Optional(CONF_TEMPERATURE_1): sensor.sensor_schema(
-                unit_of_measurement=UNIT_CELSIUS,
-                icon=ICON_THERMOMETER,
-                accuracy_decimals=0,
-                device_class=DEVICE_CLASS_TEMPERATURE,
-                state_class=STATE_CLASS_MEASUREMENT,
-            ),
-            cv.Optional(CONF_TEMPERATURE_2): sensor.sensor_schema(
+            cv.Optional(CONF_CELL_LEVEL_1_ALARM_DIFFERENCE_TEMPERATURE): daly_sensor_schema(
                 unit_of_measurement=UNIT_CELSIUS,
                 icon=ICON_THERMOMETER,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_TEMPERATURE,
-                state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_CELL_LEVEL_1_ALARM_DIFFERENCE_TEMPERATURE): sensor.sensor_schema(
-                unit_of_measurement=UNIT_CELSIUS,
-                icon=ICON_THERMOMETER,
-                accuracy_decimals=0,
-                device_class=DEVICE_CLASS_TEMPERATURE,
-            ),
-            cv.Optional(CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_TEMPERATURE): sensor.sensor_schema(
+            cv.Optional(CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_TEMPERATURE): daly_sensor_schema(
                 unit_of_measurement=UNIT_CELSIUS,
                 icon=ICON_THERMOMETER,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_TEMPERATURE,
             ), 
-            cv.Optional(CONF_CYCLE): sensor.sensor_schema(
+            cv.Optional(CONF_CYCLE): daly_sensor_schema(
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_FAILURECODE): sensor.sensor_schema(
+            cv.Optional(CONF_FAILURECODE): daly_sensor_schema(
                 icon=ICON_ALERT,
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_WATCHDOG): sensor.sensor_schema(
+            cv.Optional(CONF_WATCHDOG): daly_sensor_schema(
                 state_class=STATE_CLASS_MEASUREMENT,
             ),
-            cv.Optional(CONF_CELL_LEVEL_1_ALARM_DIFFERENCE_VOLTAGE): sensor.sensor_schema(
+            cv.Optional(CONF_CELL_LEVEL_1_ALARM_DIFFERENCE_VOLTAGE): daly_sensor_schema(
                 unit_of_measurement=UNIT_VOLT,
                 device_class=DEVICE_CLASS_VOLTAGE,
                 icon=ICON_FLASH,
                 accuracy_decimals=3,
             ),
-            cv.Optional(CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_VOLTAGE): sensor.sensor_schema(
+            cv.Optional(CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_VOLTAGE): daly_sensor_schema(
                 unit_of_measurement=UNIT_VOLT,
                 device_class=DEVICE_CLASS_VOLTAGE,
                 icon=ICON_FLASH,
                 accuracy_decimals=3,
             ),  
-            cv.Optional(CONF_CELL_VOLTAGE_DIFFERENCE): sensor.sensor_schema(
+            cv.Optional(CONF_CELL_VOLTAGE_DIFFERENCE): daly_sensor_schema(
                 unit_of_measurement=UNIT_VOLT,
                 device_class=DEVICE_CLASS_VOLTAGE,
                 icon=ICON_FLASH,
                 accuracy_decimals=1,
             ),
-            cv.Optional(CONF_CELL_1_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_2_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_3_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_4_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_5_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_6_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_7_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_8_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_9_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_10_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_11_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_12_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_13_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_14_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_15_VOLTAGE): CELL_VOLTAGE_SCHEMA,
-            cv.Optional(CONF_CELL_16_VOLTAGE): CELL_VOLTAGE_SCHEMA,
+            **{cv.Optional(key): CELL_VOLTAGE_SCHEMA for key in CELL_VOLTAGES},
+            **{cv.Optional(key): TEMPERATURE_SCHEMA for key in TEMPERATURES},
+            **{cv.Optional(key): CELL_RESISTANCE_SCHEMA for key in CELL_RESISTANCES},
+            **{cv.Optional(key): CELL_DEVIATION_SCHEMA for key in CELL_DEVIATIONS},
+            **{cv.Optional(key): FRAME_RATE_SCHEMA for key in COMMAND_FRAME_RATES},
+            cv.Optional(CONF_MAX_CELL_RESISTANCE): CELL_RESISTANCE_SCHEMA,
+            cv.Optional(CONF_MAX_CELL_RESISTANCE_NUMBER): daly_sensor_schema(
+                icon=ICON_COUNTER,
+                accuracy_decimals=0,
+            ),
+            cv.Optional(CONF_MAX_CELL_DEVIATION): CELL_DEVIATION_SCHEMA,
+            cv.Optional(CONF_MAX_CELL_DEVIATION_NUMBER): daly_sensor_schema(
+                icon=ICON_COUNTER,
+                accuracy_decimals=0,
+            ),
             cv.Optional(CONF_CELL_NOMINAL_VOLTAGE): CELL_VOLTAGE_SCHEMA,
             cv.Optional(CONF_CELL_LEVEL_1_ALARM_HIGH_VOLTAGE): CELL_VOLTAGE_SCHEMA,
             cv.Optional(CONF_CELL_LEVEL_2_ALARM_HIGH_VOLTAGE): CELL_VOLTAGE_SCHEMA,
@@ -322,19 +407,168 @@ CONFIG_SCHEMA = cv.All(
             cv.Optional(CONF_BATTPACK_LEVEL_2_ALARM_HI_V): PACK_VOLTAGE_SCHEMA,
             cv.Optional(CONF_BATTPACK_LEVEL_1_ALARM_LO_V): PACK_VOLTAGE_SCHEMA,
             cv.Optional(CONF_BATTPACK_LEVEL_2_ALARM_LO_V): PACK_VOLTAGE_SCHEMA,
-            
+            cv.Optional(CONF_CHARGED_CAPACITY): CAPACITY_TOTAL_SCHEMA,
+            cv.Optional(CONF_DISCHARGED_CAPACITY): CAPACITY_TOTAL_SCHEMA,
+            cv.Optional(CONF_CHARGED_ENERGY): ENERGY_TOTAL_SCHEMA,
+            cv.Optional(CONF_DISCHARGED_ENERGY): ENERGY_TOTAL_SCHEMA,
+            # restart with every charge or discharge
+            cv.Optional(CONF_SESSION_CAPACITY): daly_sensor_schema(
+                unit_of_measurement=UNIT_AMPERE_HOUR,
+                icon=ICON_GAUGE,
+                accuracy_decimals=2,
+                state_class=STATE_CLASS_TOTAL,
+            ),
+            cv.Optional(CONF_SESSION_ENERGY): daly_sensor_schema(
+                unit_of_measurement=UNIT_KILOWATT_HOURS,
+                icon=ICON_FLASH,
+                accuracy_decimals=3,
+                device_class=DEVICE_CLASS_ENERGY,
+                state_class=STATE_CLASS_TOTAL,
+            ),
+            cv.Optional(CONF_TIMEOUTS): LINK_COUNTER_SCHEMA,
+            cv.Optional(CONF_CHECKSUM_ERRORS): LINK_COUNTER_SCHEMA,
+            cv.Optional(CONF_RESYNCS): LINK_COUNTER_SCHEMA,
+            cv.Optional(CONF_DISCARDED_BYTES): LINK_COUNTER_SCHEMA,
+            cv.Optional(CONF_FRAME_RATE): FRAME_RATE_SCHEMA,
+            cv.Optional(CONF_ROUND_TRIP_TIME): daly_sensor_schema(
+                unit_of_measurement=UNIT_MILLISECOND,
+                icon=ICON_TIMER_SAND,
+                accuracy_decimals=0,
+                device_class=DEVICE_CLASS_DURATION,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
+            cv.Optional(CONF_LAST_FRAME_AGE): daly_sensor_schema(
+                unit_of_measurement=UNIT_SECOND,
+                icon=ICON_TIMER_SAND,
+                accuracy_decimals=0,
+                device_class=DEVICE_CLASS_DURATION,
+                state_class=STATE_CLASS_MEASUREMENT,
+                entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+            ),
         }
     ).extend(cv.COMPONENT_SCHEMA)
 )
 
+# frames each sensor is decoded from, the link diagnostics need none
+# the analytics pair the current from 0x90 with complete cell readings
+ANALYTICS_FRAMES = ("BATTERY_LEVEL", "CELL_VOLTAGE", "STATUS")
+SENSOR_FRAMES = {
+    CONF_BATTPACK_LEVEL_1_ALARM_HI_V: ("PACK_THRESHOLDS",),
+    CONF_BATTPACK_LEVEL_2_ALARM_HI_V: ("PACK_THRESHOLDS",),
+    CONF_BATTPACK_LEVEL_1_ALARM_LO_V: ("PACK_THRESHOLDS",),
+    CONF_BATTPACK_LEVEL_2_ALARM_LO_V: ("PACK_THRESHOLDS",),
+    CONF_BATTERY_LEVEL: ("BATTERY_LEVEL",),
+    CONF_CELL_NOMINAL_CAPACITY: ("CAPACITY_NOMINAL_VOLTAGE",),
+    CONF_CELL_NOMINAL_VOLTAGE: ("CAPACITY_NOMINAL_VOLTAGE",),
+    CONF_CELL_LEVEL_1_ALARM_HIGH_VOLTAGE: ("CELL_THRESHOLDS",),
+    CONF_CELL_LEVEL_2_ALARM_HIGH_VOLTAGE: ("CELL_THRESHOLDS",),
+    CONF_CELL_LEVEL_1_ALARM_LOW_VOLTAGE: ("CELL_THRESHOLDS",),
+    CONF_CELL_LEVEL_2_ALARM_LOW_VOLTAGE: ("CELL_THRESHOLDS",),
+    CONF_CELL_LEVEL_1_ALARM_DIFFERENCE_TEMPERATURE: ("REST_THRESHOLDS",),
+    CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_TEMPERATURE: ("REST_THRESHOLDS",),
+    CONF_CELL_LEVEL_1_ALARM_DIFFERENCE_VOLTAGE: ("REST_THRESHOLDS",),
+    CONF_CELL_LEVEL_2_ALARM_DIFFERENCE_VOLTAGE: ("REST_THRESHOLDS",),
+    CONF_AVERAGE_CELL_VOLTAGE: ("CELL_VOLTAGE", "STATUS"),
+    CONF_CELLS_NUMBER: ("STATUS",),
+    CONF_CURRENT: ("BATTERY_LEVEL",),
+    CONF_CYCLE: ("STATUS",),
+    CONF_FAILURECODE: ("FAILURE_STATUS",),
+    CONF_REMAINING_CAPACITY: ("MOS",),
+    CONF_WATCHDOG: ("MOS",),
+    CONF_VOLTAGE: ("BATTERY_LEVEL",),
+    CONF_POWER: ("BATTERY_LEVEL",),
+    CONF_CHARGED_CAPACITY: ("BATTERY_LEVEL",),
+    CONF_DISCHARGED_CAPACITY: ("BATTERY_LEVEL",),
+    CONF_CHARGED_ENERGY: ("BATTERY_LEVEL",),
+    CONF_DISCHARGED_ENERGY: ("BATTERY_LEVEL",),
+    CONF_SESSION_CAPACITY: ("BATTERY_LEVEL", "MOS"),
+    CONF_SESSION_ENERGY: ("BATTERY_LEVEL", "MOS"),
+    CONF_MAX_CELL_RESISTANCE: ANALYTICS_FRAMES,
+    CONF_MAX_CELL_RESISTANCE_NUMBER: ANALYTICS_FRAMES,
+    CONF_MAX_CELL_DEVIATION: ANALYTICS_FRAMES,
+    CONF_MAX_CELL_DEVIATION_NUMBER: ANALYTICS_FRAMES,
+}
+ANALYTICS = [
+    CONF_MAX_CELL_RESISTANCE,
+    CONF_MAX_CELL_RESISTANCE_NUMBER,
+    CONF_MAX_CELL_DEVIATION,
+    CONF_MAX_CELL_DEVIATION_NUMBER,
+    *CELL_RESISTANCES,
+    *CELL_DEVIATIONS,
+]
+# with local_min_max these come from the cell and temperature snapshots instead
+MIN_MAX_VOLTAGE = [
+    CONF_CELL_VOLTAGE_DIFFERENCE,
+    CONF_MAX_CELL_VOLTAGE,
+    CONF_MAX_CELL_VOLTAGE_NUMBER,
+    CONF_MIN_CELL_VOLTAGE,
+    CONF_MIN_CELL_VOLTAGE_NUMBER,
+]
+MIN_MAX_TEMPERATURE = [
+    CONF_MAX_TEMPERATURE,
+    CONF_MAX_TEMPERATURE_PROBE_NUMBER,
+    CONF_MIN_TEMPERATURE,
+    CONF_MIN_TEMPERATURE_PROBE_NUMBER,
+]
+
+
+def sensor_frames(key, local_min_max):
+    if key in MIN_MAX_VOLTAGE:
+        return ("CELL_VOLTAGE", "STATUS") if local_min_max else ("MIN_MAX_VOLTAGE",)
+    if key in MIN_MAX_TEMPERATURE:
+        return ("TEMPERATURE", "STATUS") if local_min_max else ("MIN_MAX_TEMPERATURE",)
+    if key in CELL_VOLTAGES:
+        return ("CELL_VOLTAGE", "STATUS")
+    if key in TEMPERATURES:
+        return ("TEMPERATURE", "STATUS")
+    if key in CELL_RESISTANCES or key in CELL_DEVIATIONS:
+        return ANALYTICS_FRAMES
+    return SENSOR_FRAMES.get(key, ())
+
+
+async def new_daly_sensor(sensor_config):
+    sens = await sensor.new_sensor(sensor_config)
+    if CONF_DEADBAND in sensor_config:
+        cg.add(sens.set_deadband(sensor_config[CONF_DEADBAND]))
+    if CONF_HEARTBEAT in sensor_config:
+        cg.add(sens.set_heartbeat(sensor_config[CONF_HEARTBEAT]))
+    return sens
+
 
 async def setup_conf(config, key, hub):
     if sensor_config := config.get(key):
-        sens = await sensor.new_sensor(sensor_config)
+        sens = await new_daly_sensor(sensor_config)
         cg.add(getattr(hub, f"set_{key}_sensor")(sens))
 
 
 async def to_code(config):
     hub = await cg.get_variable(config[CONF_BMS_DALY_ID])
+    local_min_max = hub_local_min_max(config[CONF_BMS_DALY_ID])
+    for key in TYPES + CELL_VOLTAGES + TEMPERATURES + CELL_RESISTANCES + CELL_DEVIATIONS:
+        if key in config:
+            request_frames(hub, *sensor_frames(key, local_min_max))
+    if any(key in config for key in ANALYTICS):
+        cg.add_define("USE_DALY_BMS_CELL_ANALYTICS")
     for key in TYPES:
         await setup_conf(config, key, hub)
+    for i, key in enumerate(CELL_VOLTAGES):
+        if sensor_config := config.get(key):
+            sens = await new_daly_sensor(sensor_config)
+            cg.add(hub.set_cell_voltage_sensor(i, sens))
+    for i, key in enumerate(TEMPERATURES):
+        if sensor_config := config.get(key):
+            sens = await new_daly_sensor(sensor_config)
+            cg.add(hub.set_temperature_sensor(i, sens))
+    for i, key in enumerate(CELL_RESISTANCES):
+        if sensor_config := config.get(key):
+            sens = await new_daly_sensor(sensor_config)
+            cg.add(hub.set_cell_resistance_sensor(i, sens))
+    for i, key in enumerate(CELL_DEVIATIONS):
+        if sensor_config := config.get(key):
+            sens = await new_daly_sensor(sensor_config)
+            cg.add(hub.set_cell_deviation_sensor(i, sens))
+    for key, data_id in COMMAND_FRAME_RATES.items():
+        if sensor_config := config.get(key):
+            sens = await new_daly_sensor(sensor_config)
+            cg.add(hub.set_command_frame_rate_sensor(data_id, sens))
@@ -0,0 +1,49 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import switch
+from . import daly_bms, DalyBmsComponent, CONF_BMS_DALY_ID, request_frames
+
+DalyMosSwitch = daly_bms.class_(
+    "DalyMosSwitch", switch.Switch, cg.Parented.template(DalyBmsComponent)
+)
+
+CONF_CHARGING_MOS = "charging_mos"
+CONF_DISCHARGING_MOS = "discharging_mos"
+
+ICON_POWER_PLUG = "mdi:power-plug"
+ICON_POWER_PLUG_OUTLINE = "mdi:power-plug-outline"
+
+TYPES = [
+    CONF_CHARGING_MOS,
+    CONF_DISCHARGING_MOS,
+]
+
+CONFIG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.GenerateID(CONF_BMS_DALY_ID): cv.use_id(DalyBmsComponent),
+            cv.Optional(CONF_CHARGING_MOS): switch.switch_schema(
+                DalyMosSwitch, icon=ICON_POWER_PLUG
+            ),
+            cv.Optional(CONF_DISCHARGING_MOS): switch.switch_schema(
+                DalyMosSwitch, icon=ICON_POWER_PLUG_OUTLINE
+            ),
+        }
+    ).extend(cv.COMPONENT_SCHEMA)
+)
+
+
+async def setup_conf(config, key, hub):
+    if switch_config := config.get(key):
+        # the switch state is read back from 0x93
+        request_frames(hub, "MOS")
+        var = await switch.new_switch(switch_config)
+        await cg.register_parented(var, hub)
+        cg.add(var.set_charging(key == CONF_CHARGING_MOS))
+        cg.add(getattr(hub, f"set_{key}_switch")(var))
+
+
+async def to_code(config):
+    hub = await cg.get_variable(config[CONF_BMS_DALY_ID])
+    for key in TYPES:
+        await setup_conf(config, key, hub)
@@ -2,15 +2,42 @@ import esphome.codegen as cg
 import esphome.config_validation as cv
 from esphome.components import text_sensor
 from esphome.const import CONF_STATUS
-from . import DalyBmsComponent, CONF_BMS_DALY_ID
+from . import (
+    DalyBmsComponent,
+    CONF_BMS_DALY_ID,
+    PROTOCOL_MODBUS,
+    request_frames,
+    hub_protocol,
+)
 
 ICON_CAR_BATTERY = "mdi:car-battery"
 ICON_ALERT = "mdi:alert"
+ICON_CODE_JSON = "mdi:code-json"
+
+CONF_FAILURES = "failures"
+CONF_SNAPSHOT = "snapshot"
 
 TYPES = [
     CONF_STATUS,
+    CONF_FAILURES,
+    CONF_SNAPSHOT,
 ]
 
+# frames each text sensor is decoded from
+TEXT_SENSOR_FRAMES = {
+    CONF_STATUS: ("MOS",),
+    CONF_FAILURES: ("FAILURE_STATUS",),
+    CONF_SNAPSHOT: (
+        "BATTERY_LEVEL",
+        "MOS",
+        "STATUS",
+        "CELL_VOLTAGE",
+        "TEMPERATURE",
+        "BALANCE",
+        "FAILURE_STATUS",
+    ),
+}
+
 CONFIG_SCHEMA = cv.All(
     cv.Schema(
         {
@@ -18,7 +45,12 @@ CONFIG_SCHEMA = cv.All(
             cv.Optional(CONF_STATUS): text_sensor.text_sensor_schema(
                 icon=ICON_CAR_BATTERY
             ),
-
+            cv.Optional(CONF_FAILURES): text_sensor.text_sensor_schema(
+                icon=ICON_ALERT
+            ),
+            cv.Optional(CONF_SNAPSHOT): text_sensor.text_sensor_schema(
+                icon=ICON_CODE_JSON
+            ),
         }
     ).extend(cv.COMPONENT_SCHEMA)
 )
@@ -32,5 +64,15 @@ async def setup_conf(config, key, hub):
 
 async def to_code(config):
     hub = await cg.get_variable(config[CONF_BMS_DALY_ID])
+    modbus = hub_protocol(config[CONF_BMS_DALY_ID]) == PROTOCOL_MODBUS
+    for key in TYPES:
+        if key in config:
+            frames = TEXT_SENSOR_FRAMES[key]
+            if modbus and key == CONF_SNAPSHOT:
+                # no failure status over Modbus, the snapshot goes without "alarms"
+                frames = tuple(frame for frame in frames if frame != "FAILURE_STATUS")
+            request_frames(hub, *frames)
+    if CONF_SNAPSHOT in config:
+        cg.add_define("USE_DALY_BMS_SNAPSHOT")
     for key in TYPES:
         await setup_conf(config, key, hub)
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Extract the raw UART capture of the daly_bms component from a log.
+
+With `capture: true` the bus logs every received chunk and every request it sends as numbered base64 lines
+under the daly_bms.capture tag at debug level. This tool collects them from a saved log (or stdin) into a capture
+file that daly_sim.py --replay plays back on a pty and tools/host daly_replay feeds through the component, or
+prints the records with --dump.
+
+Capture file: the magic b"DALYCAP\\x01" followed by records of varint ms since the previous record, kind byte
+(0 received, 1 sent, 2 gap where log lines were lost), varint length and the bytes.
+"""
+
+import argparse
+import base64
+import re
+import sys
+
+MAGIC = b"DALYCAP\x01"
+RX = 0
+TX = 1
+GAP = 2
+KIND_NAMES = {RX: "rx", TX: "tx", GAP: "gap"}
+
+LINE = re.compile(r"\[daly_bms\.capture[^\]]*\]: (\d+) ([A-Za-z0-9+/=]+)")
+
+
+def get_varint(data, offset):
+    value = 0
+    shift = 0
+    while True:
+        c = data[offset]
+        offset += 1
+        value |= (c & 0x7F) << shift
+        shift += 7
+        if not c & 0x80:
+            return value, offset
+
+
+def put_varint(value):
+    out = bytearray()
+    while value >= 0x80:
+        out.append((value & 0x7F) | 0x80)
+        value >>= 7
+    out.append(value)
+    return bytes(out)
+
+
+def decode_line(data):
+    """Yield (absolute ms, kind, bytes) of one log line, see DalyBmsBus::add_capture_()."""
+    now, offset = get_varint(data, 0)
+    while offset < len(data):
+        dt, offset = get_varint(data, offset)
+        now = (now + dt) & 0xFFFFFFFF
+        kind = data[offset]
+        length = data[offset + 1]
+        offset += 2
+        yield now, kind, data[offset : offset + length]
+        offset += length
+
+
+def parse_log(lines):
+    """Yield (absolute ms, kind, bytes) for all capture lines, with a GAP record where line numbers skip."""
+    expected = None
+    for line in lines:
+        match = LINE.search(line)
+        if match is None:
+            continue
+        number = int(match.group(1))
+        try:
+            data = base64.b64decode(match.group(2), validate=True)
+        except ValueError:
+            continue
+        records = list(decode_line(data))
+        if not records:
+            continue
+        if expected is not None and number != expected:
+            yield records[0][0], GAP, b""
+        expected = number + 1
+        yield from records
+
+
+def write_capture(records, out):
+    out.write(MAGIC)
+    last = None
+    count = 0
+    for now, kind, data in records:
+        # millis() wraps after 49 days
+        dt = 0 if last is None else (now - last) & 0xFFFFFFFF
+        last = now
+        out.write(put_varint(dt) + bytes([kind]) + put_varint(len(data)) + data)
+        count += 1
+    return count
+
+
+def read_capture(path):
+    """Yield (ms since the previous record, kind, bytes) from a capture file."""
+    with open(path, "rb") as f:
+        data = f.read()
+    if not data.startswith(MAGIC):
+        raise ValueError(f"{path} is not a daly_bms capture")
+    offset = len(MAGIC)
+    while offset < len(data):
+        dt, offset = get_varint(data, offset)
+        kind = data[offset]
+        length, offset = get_varint(data, offset + 1)
+        yield dt, kind, data[offset : offset + length]
+        offset += length
+
+
+def dump(path, out=sys.stdout):
+    now = 0
+    for dt, kind, data in read_capture(path):
+        now += dt
+        out.write(f"{now / 1000:10.3f} {KIND_NAMES.get(kind, kind):3} {data.hex(' ')}\n")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("input", help="log file, - for stdin, or a capture file with --dump")
+    parser.add_argument("-o", "--output", help="capture file to write")
+    parser.add_argument("--dump", action="store_true", help="print the records of a capture file")
+    args = parser.parse_args()
+
+    if args.dump:
+        dump(args.input)
+        return
+    if not args.output:
+        parser.error("--output is required unless --dump is given")
+    source = sys.stdin if args.input == "-" else open(args.input, encoding="utf-8", errors="replace")
+    with source, open(args.output, "wb") as out:
+        count = write_capture(parse_log(source), out)
+    print(f"{count} records written to {args.output}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+"""Daly BMS simulator on a pseudo terminal.
+
+Answers the read requests of the daly_bms component (0x90-0x98, 0x50, 0x59, 0x5A, 0x5E) like one or
+more packs on a shared line and measures how the master drives the bus: burst (sweep) duration,
+turnaround between a reply and the next request per command, and frames per second.
+
+Point daly_bench of the host build (tools/host) at the printed pty, or bridge it to a serial adapter with socat.
+
+With --replay the packs are replaced by a capture taken with daly_capture.py: the received chunks are written
+with their recorded timing and chunk boundaries, so a parser problem seen in the field repeats on every run.
+"""
+
+import argparse
+import os
+import pty
+import random
+import select
+import sys
+import time
+import tty
+
+import daly_capture
+
+FRAME_SIZE = 13
+START = 0xA5
+TEMPERATURE_OFFSET = 40
+CURRENT_OFFSET = 30000
+
+
+def frame(address, data_id, data):
+    data = bytes(data).ljust(8, b"\x00")
+    body = bytes([START, address, data_id, 0x08]) + data
+    return body + bytes([sum(body) & 0xFF])
+
+
+class Pack:
+    def __init__(self, board, cells, temperatures, rng):
+        self.board = board
+        self.cells = cells
+        self.temperatures = temperatures
+        self.rng = rng
+        self.cell_mv = [3300 + rng.randint(-15, 15) for _ in range(cells)]
+        self.probes = [25 + rng.randint(-2, 2) for _ in range(temperatures)]
+        self.current_da = 0
+        self.soc_pm = 800
+        self.balancing = 0
+
+    def step(self):
+        # slow random walk so change-driven publishing has something to do
+        self.current_da = max(-1500, min(1500, self.current_da + self.rng.randint(-20, 20)))
+        for i in range(self.cells):
+            self.cell_mv[i] = max(2800, min(3650, self.cell_mv[i] + self.rng.randint(-2, 2)))
+        for i in range(self.temperatures):
+            self.probes[i] = max(-20, min(70, self.probes[i] + self.rng.choice((-1, 0, 0, 0, 1))))
+        self.balancing = self.rng.getrandbits(self.cells) if self.rng.random() < 0.1 else self.balancing
+
+    def pack_dv(self):
+        return sum(self.cell_mv) // 100
+
+    def replies(self, data_id):
+        """Return the data parts of all frames answering data_id."""
+        self.step()
+        pack_dv = self.pack_dv()
+        current = self.current_da + CURRENT_OFFSET
+        if data_id == 0x90:
+            return [[pack_dv >> 8, pack_dv & 0xFF, 0, 0, current >> 8, current & 0xFF,
+                     self.soc_pm >> 8, self.soc_pm & 0xFF]]
+        if data_id == 0x91:
+            hi = max(range(self.cells), key=lambda i: self.cell_mv[i])
+            lo = min(range(self.cells), key=lambda i: self.cell_mv[i])
+            return [[self.cell_mv[hi] >> 8, self.cell_mv[hi] & 0xFF, hi + 1,
+                     self.cell_mv[lo] >> 8, self.cell_mv[lo] & 0xFF, lo + 1]]
+        if data_id == 0x92:
+            hi = max(range(self.temperatures), key=lambda i: self.probes[i])
+            lo = min(range(self.temperatures), key=lambda i: self.probes[i])
+            return [[self.probes[hi] + TEMPERATURE_OFFSET, hi + 1,
+                     self.probes[lo] + TEMPERATURE_OFFSET, lo + 1]]
+        if data_id == 0x93:
+            state = 0 if self.current_da == 0 else (1 if self.current_da > 0 else 2)
+            return [[state, 1, 1, 42, 0, 1, 0x86, 0xA0]]
+        if data_id == 0x94:
+            return [[self.cells, self.temperatures, 0, 0, 0, 0, 12, 0]]
+        if data_id == 0x95:
+            out = []
+            for n in range(0, self.cells, 3):
+                data = [n // 3 + 1]
+                for mv in self.cell_mv[n : n + 3]:
+                    data += [mv >> 8, mv & 0xFF]
+                out.append(data)
+            return out
+        if data_id == 0x96:
+            out = []
+            for n in range(0, self.temperatures, 7):
+                out.append([n // 7 + 1] + [t + TEMPERATURE_OFFSET for t in self.probes[n : n + 7]])
+            return out
+        if data_id == 0x97:
+            return [list(self.balancing.to_bytes(6, "little"))]
+        if data_id == 0x98:
+            return [[0, 0, 0, 0, 0, 0, 0, 0]]
+        if data_id == 0x59:
+            return [[0x0E, 0x42, 0x0E, 0x74, 0x0B, 0xB8, 0x0A, 0xF0]]
+        if data_id == 0x5A:
+            return [[0x02, 0x3A, 0x02, 0x44, 0x01, 0xA4, 0x01, 0x90]]
+        if data_id == 0x5E:
+            return [[0x01, 0x2C, 0x01, 0xF4, 5, 10]]
+        if data_id == 0x50:
+            return [[0x00, 0x01, 0x86, 0xA0, 0, 0, 0x0C, 0xE4]]
+        return []
+
+
+class Stats:
+    def __init__(self, idle_gap):
+        self.idle_gap = idle_gap
+        self.requests = {}
+        self.turnaround = {}
+        self.frames = 0
+        self.dropped_bytes = 0
+        self.corrupted_bytes = 0
+        self.bursts = []
+        self.burst_start = None
+        self.last_request = None
+        self.last_reply_done = None
+        self.last_data_id = None
+        self.started = time.monotonic()
+
+    def on_request(self, now, data_id):
+        self.requests[data_id] = self.requests.get(data_id, 0) + 1
+        if self.last_request is None or now - self.last_request > self.idle_gap:
+            if self.burst_start is not None:
+                self.bursts.append(self.last_request - self.burst_start)
+            self.burst_start = now
+        elif self.last_reply_done is not None and self.last_data_id is not None:
+            self.turnaround.setdefault(self.last_data_id, []).append(now - self.last_reply_done)
+        self.last_request = now
+
+    def on_reply_done(self, now, data_id, frames):
+        self.frames += frames
+        self.last_reply_done = now
+        self.last_data_id = data_id
+
+    def report(self, out=sys.stdout):
+        elapsed = time.monotonic() - self.started
+        print(f"--- {elapsed:.1f}s, {self.frames} frames, {self.frames / elapsed:.1f} frames/s", file=out)
+        if self.bursts:
+            bursts = sorted(self.bursts)
+            mean = sum(bursts) / len(bursts)
+            print(f"  sweep: n={len(bursts)} mean={mean * 1000:.1f}ms "
+                  f"p50={bursts[len(bursts) // 2] * 1000:.1f}ms max={bursts[-1] * 1000:.1f}ms", file=out)
+        for data_id in sorted(self.requests):
+            samples = sorted(self.turnaround.get(data_id, []))
+            line = f"  0x{data_id:02X}: {self.requests[data_id]} requests"
+            if samples:
+                mean = sum(samples) / len(samples)
+                line += (f", next request after {mean * 1000:.1f}ms mean / "
+                         f"{samples[len(samples) // 2] * 1000:.1f}ms p50 / {samples[-1] * 1000:.1f}ms max")
+            print(line, file=out)
+        if self.dropped_bytes or self.corrupted_bytes:
+            print(f"  injected: {self.dropped_bytes} dropped, {self.corrupted_bytes} corrupted bytes", file=out)
+        out.flush()
+
+
+class Simulator:
+    def __init__(self, args):
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.packs = {}
+        for board in range(1, args.packs + 1):
+            self.packs[board] = Pack(board, args.cells, args.temperatures, self.rng)
+        self.byte_time = 10.0 / args.baud_rate
+        self.stats = Stats(args.idle_gap / 1000.0)
+        self.rx = bytearray()
+        self.tx = []  # (due, bytes, data_id, frames)
+        if args.replay:
+            self.load_replay(args.replay, time.monotonic() + args.replay_delay)
+
+    def load_replay(self, path, start):
+        """Queue the received chunks of a capture, either at their recorded time or back to back at line rate."""
+        due = start
+        chunks = 0
+        for dt, kind, data in daly_capture.read_capture(path):
+            if not self.args.max_speed:
+                due += dt / 1000.0
+            if kind != daly_capture.RX:
+                continue
+            self.tx.append((due, data, None, 0))
+            chunks += 1
+            if self.args.max_speed:
+                due += len(data) * self.byte_time
+        print(f"Replaying {chunks} chunks from {path}", flush=True)
+
+    def board_for(self, address):
+        if address >= 0x80:
+            return address - 0x7F
+        if address >= 0x40:
+            return address - 0x3F
+        return None
+
+    def mangle(self, data):
+        out = bytearray()
+        for b in data:
+            if self.rng.random() < self.args.drop:
+                self.stats.dropped_bytes += 1
+                continue
+            if self.rng.random() < self.args.noise:
+                self.stats.corrupted_bytes += 1
+                b ^= 1 << self.rng.randrange(8)
+            out.append(b)
+        return bytes(out)
+
+    def handle_rx(self, now):
+        while len(self.rx) >= FRAME_SIZE:
+            start = self.rx.find(START)
+            if start < 0:
+                self.rx.clear()
+                return
+            del self.rx[:start]
+            if len(self.rx) < FRAME_SIZE:
+                return
+            request = bytes(self.rx[:FRAME_SIZE])
+            if sum(request[:12]) & 0xFF != request[12]:
+                del self.rx[:1]
+                continue
+            del self.rx[:FRAME_SIZE]
+            data_id = request[2]
+            self.stats.on_request(now, data_id)
+            if self.args.replay:
+                continue
+            board = self.board_for(request[1])
+            pack = self.packs.get(board)
+            if pack is None:
+                continue
+            due = now + self.args.delay / 1000.0
+            replies = pack.replies(data_id)
+            for i, data in enumerate(replies):
+                payload = self.mangle(frame(board, data_id, data))
+                last = i == len(replies) - 1
+                self.tx.append((due, payload, data_id if last else None, len(replies)))
+                due += FRAME_SIZE * self.byte_time + self.args.frame_delay / 1000.0
+
+    def run(self, fd):
+        next_report = time.monotonic() + self.args.report
+        end = time.monotonic() + self.args.duration if self.args.duration else None
+        while end is None or time.monotonic() < end:
+            if self.args.replay and not self.tx:
+                break
+            now = time.monotonic()
+            timeout = 0.05
+            if self.tx:
+                timeout = max(0.0, min(timeout, self.tx[0][0] - now))
+            readable, _, _ = select.select([fd], [], [], timeout)
+            now = time.monotonic()
+            if readable:
+                try:
+                    self.rx += os.read(fd, 256)
+                except OSError:
+                    pass
+                self.handle_rx(now)
+            while self.tx and self.tx[0][0] <= now:
+                _, payload, data_id, frames = self.tx.pop(0)
+                os.write(fd, payload)
+                if data_id is not None:
+                    self.stats.on_reply_done(now + len(payload) * self.byte_time, data_id, frames)
+            if now >= next_report:
+                self.stats.report()
+                next_report = now + self.args.report
+        self.stats.report()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--cells", type=int, default=16, help="cells per pack (1-48)")
+    parser.add_argument("--temperatures", type=int, default=2, help="temperature probes per pack")
+    parser.add_argument("--packs", type=int, default=1, help="packs answering on the line (boards 1..n)")
+    parser.add_argument("--baud-rate", type=int, default=9600)
+    parser.add_argument("--delay", type=float, default=10.0, help="ms between request and first reply frame")
+    parser.add_argument("--frame-delay", type=float, default=1.0, help="ms between frames of one reply")
+    parser.add_argument("--noise", type=float, default=0.0, help="probability of a bit flip per byte")
+    parser.add_argument("--drop", type=float, default=0.0, help="probability of dropping a byte")
+    parser.add_argument("--idle-gap", type=float, default=300.0, help="ms of silence that ends a sweep")
+    parser.add_argument("--report", type=float, default=10.0, help="seconds between reports")
+    parser.add_argument("--duration", type=float, default=0.0, help="stop after this many seconds")
+    parser.add_argument("--seed", type=int, default=None)
+    parser.add_argument("--link", help="create a symlink to the pty at this path")
+    parser.add_argument("--replay", help="play back the received bytes of a capture file instead of simulating packs")
+    parser.add_argument("--replay-delay", type=float, default=2.0, help="seconds before the replay starts")
+    parser.add_argument("--max-speed", action="store_true", help="replay without the recorded gaps")
+    args = parser.parse_args()
+
+    master, slave = pty.openpty()
+    tty.setraw(slave)
+    name = os.ttyname(slave)
+    if args.link:
+        if os.path.lexists(args.link):
+            os.unlink(args.link)
+        os.symlink(name, args.link)
+        name = f"{args.link} -> {name}"
+    print(f"Daly BMS simulator on {name}", flush=True)
+    simulator = Simulator(args)
+    try:
+        simulator.run(master)
+    except KeyboardInterrupt:
+        simulator.stats.report()
+    finally:
+        if args.link and os.path.islink(args.link):
+            os.unlink(args.link)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,277 @@
+// Runs the bus and component in real time against a tty, usually the pty of tools/daly_sim.py, and reports what
+// the link looks like from the master: sweep time, round trip time and frame rate per command, and the CPU time
+// the parser and decoder spend per received byte.
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "daly_bms.h"
+#include "daly_bms_bus.h"
+#include "esphome/core/log.h"
+#include "host_app.h"
+#include "host_uart.h"
+
+using namespace esphome;
+using namespace esphome::daly_bms;
+
+static const uint8_t READ_IDS[] = {0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x59, 0x5A, 0x5E, 0x50};
+// silence on the line that ends a sweep, as in tools/daly_sim.py
+static const uint64_t IDLE_GAP_US = 300000;
+
+struct Options {
+  std::string port;
+  uint32_t baud_rate{9600};
+  uint8_t packs{1};
+  uint32_t duration_ms{10000};
+  uint32_t update_interval{1000};
+  bool modbus{false};
+  int cells{-1};  // checked against the cells_number of every pack when set
+  int log_level{ESPHOME_LOG_LEVEL_WARN};
+};
+
+/// A serial port that notes when requests go out and replies come in.
+class TimedSerialUART : public daly_host::SerialUART {
+ public:
+  void write_array(const uint8_t *data, size_t len) override {
+    this->note_(daly_host::now_us());
+    daly_host::SerialUART::write_array(data, len);
+  }
+  int available() override {
+    const size_t before = this->received.size();
+    const int avail = daly_host::SerialUART::available();
+    if (this->received.size() != before)
+      this->note_(daly_host::now_us());
+    return avail;
+  }
+  void finish() {
+    if (this->sweep_start_ != 0)
+      this->sweeps.push_back(this->last_ - this->sweep_start_);
+  }
+
+  // duration of each burst of requests and replies, us
+  std::vector<uint64_t> sweeps;
+
+ protected:
+  void note_(uint64_t now) {
+    if (this->sweep_start_ == 0 || now - this->last_ >= IDLE_GAP_US) {
+      if (this->sweep_start_ != 0)
+        this->sweeps.push_back(this->last_ - this->sweep_start_);
+      this->sweep_start_ = now;
+    }
+    this->last_ = now;
+  }
+
+  uint64_t sweep_start_{0};
+  uint64_t last_{0};
+};
+
+/// The sensors a typical configuration has, so decoding costs what it costs on the device.
+struct PackSensors {
+  DalySensor voltage, current, soc, cells_number, min_cell, max_cell, max_temperature;
+  DalySensor cells[DALY_MAX_CELLS];
+  DalySensor probes[DALY_MAX_TEMPERATURES];
+
+  void attach(DalyBmsComponent *bms) {
+    bms->set_voltage_sensor(&this->voltage);
+    bms->set_current_sensor(&this->current);
+    bms->set_battery_level_sensor(&this->soc);
+    bms->set_cells_number_sensor(&this->cells_number);
+    bms->set_min_cell_voltage_sensor(&this->min_cell);
+    bms->set_max_cell_voltage_sensor(&this->max_cell);
+    bms->set_max_temperature_sensor(&this->max_temperature);
+    for (uint8_t i = 0; i < DALY_MAX_CELLS; i++)
+      bms->set_cell_voltage_sensor(i, &this->cells[i]);
+    for (uint8_t i = 0; i < DALY_MAX_TEMPERATURES; i++)
+      bms->set_temperature_sensor(i, &this->probes[i]);
+  }
+};
+
+/// The bus and one component per pack, at addresses 0x80, 0x81, ...
+struct Rig {
+  DalyBmsBus bus;
+  std::vector<std::unique_ptr<DalyBmsComponent>> bms;
+  std::vector<std::unique_ptr<PackSensors>> sensors;
+  daly_host::App app;
+
+  Rig(uart::UARTComponent *uart, const Options &options) {
+    this->bus.set_uart_parent(uart);
+    this->bus.set_protocol(options.modbus ? DALY_PROTOCOL_MODBUS : DALY_PROTOCOL_DALY);
+    this->app.register_component(&this->bus);
+    for (uint8_t i = 0; i < options.packs; i++) {
+      auto *bms = new DalyBmsComponent();
+      bms->set_address(0x80 + i);
+      bms->set_protocol(options.modbus ? DALY_PROTOCOL_MODBUS : DALY_PROTOCOL_DALY);
+      bms->set_update_interval(options.update_interval);
+      bms->set_cell_update_interval(options.update_interval);
+      bms->set_threshold_update_interval(3600000);
+      bms->set_diagnostic_update_interval(60000);
+      bms->set_energy_hash(0x80 + i);
+      for (uint8_t data_id : READ_IDS)
+        bms->enable_request(data_id);
+      auto *sensors = new PackSensors();
+      sensors->attach(bms);
+      this->bus.register_device(bms);
+      this->app.register_component(bms);
+      this->bms.emplace_back(bms);
+      this->sensors.emplace_back(sensors);
+    }
+  }
+};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s --port PATH [--baud RATE] [--packs N] [--duration S] [--update-interval MS] [--modbus]\n"
+          "       [--cells N] [--log LEVEL]\n",
+          name);
+  exit(2);
+}
+
+static Options parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--modbus") {
+      options.modbus = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      usage(argv[0]);
+    const char *value = argv[++i];
+    if (arg == "--port") {
+      options.port = value;
+    } else if (arg == "--baud") {
+      options.baud_rate = atoi(value);
+    } else if (arg == "--packs") {
+      options.packs = std::max(1, std::min(atoi(value), 16));
+    } else if (arg == "--duration") {
+      options.duration_ms = atof(value) * 1000;
+    } else if (arg == "--update-interval") {
+      options.update_interval = atoi(value);
+    } else if (arg == "--cells") {
+      options.cells = atoi(value);
+    } else if (arg == "--log") {
+      options.log_level = atoi(value);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (options.port.empty())
+    usage(argv[0]);
+  return options;
+}
+
+static void report_sweeps(const std::vector<uint64_t> &sweeps) {
+  if (sweeps.empty()) {
+    printf("  sweep: none\n");
+    return;
+  }
+  uint64_t sum = 0, max = 0;
+  for (uint64_t sweep : sweeps) {
+    sum += sweep;
+    max = std::max(max, sweep);
+  }
+  printf("  sweep: n=%zu mean=%.1fms max=%.1fms\n", sweeps.size(), sum / 1e3 / sweeps.size(), max / 1e3);
+}
+
+/// Prints the link statistics of one pack, returns the frames it decoded.
+static uint32_t report_pack(const DalyBmsComponent *bms, double seconds) {
+  uint32_t frames = 0, timeouts = 0, checksum_errors = 0;
+  for (uint8_t data_id : READ_IDS) {
+    const DalyCommandStats *stats = bms->get_command_stats(data_id);
+    frames += stats->frames;
+    timeouts += stats->timeouts;
+    checksum_errors += stats->checksum_errors;
+  }
+  printf("  pack 0x%02X: %u frames, %.1f frames/s, %u timeouts, %u checksum errors, %u discarded bytes\n",
+         bms->get_address(), (unsigned) frames, frames / seconds, (unsigned) timeouts, (unsigned) checksum_errors,
+         (unsigned) bms->get_discarded_bytes());
+  for (uint8_t data_id : READ_IDS) {
+    const DalyCommandStats *stats = bms->get_command_stats(data_id);
+    if (stats->replies == 0 && stats->timeouts == 0)
+      continue;
+    printf("    0x%02X: round trip n=%u mean=%.1fms max=%ums, %.2f frames/s, %u timeouts, %u checksum errors, "
+           "%u resyncs\n",
+           data_id, (unsigned) stats->replies, stats->replies != 0 ? double(stats->rtt_sum) / stats->replies : 0.0,
+           (unsigned) stats->rtt_max, stats->frames / seconds, (unsigned) stats->timeouts,
+           (unsigned) stats->checksum_errors, (unsigned) stats->resyncs);
+  }
+  return frames;
+}
+
+/// Feeds what came over the line through a fresh bus and components in one go and times the loop that parses
+/// and decodes it. The simulated clock stands still, so no request times out halfway.
+static double parser_ns_per_byte(const std::vector<uint8_t> &received, const Options &options) {
+  const int rounds = 20;
+  double best = INFINITY;
+  for (int round = 0; round < rounds; round++) {
+    daly_host::reset();
+    daly_host::MemoryUART uart;
+    uart.set_baud_rate(options.baud_rate);
+    Rig rig(&uart, options);
+    rig.app.setup();
+    // the first loop sends a request, so discarded bytes have a device to go to
+    rig.app.loop();
+    const uint64_t in = uart.receive(received.data(), received.size(), daly_host::now_us());
+    daly_host::advance(in - daly_host::now_us());
+    const auto start = std::chrono::steady_clock::now();
+    rig.bus.loop();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+  }
+  return best / received.size();
+}
+
+int main(int argc, char **argv) {
+  const Options options = parse_options(argc, argv);
+  daly_host::set_log_level(options.log_level);
+  daly_host::set_real_time(true);
+
+  TimedSerialUART uart;
+  if (!uart.open(options.port, options.baud_rate)) {
+    fprintf(stderr, "Cannot open %s at %u baud: %s\n", options.port.c_str(), (unsigned) options.baud_rate,
+            strerror(errno));
+    return 2;
+  }
+  Rig rig(&uart, options);
+  rig.app.setup();
+  const uint64_t end = daly_host::now_us() + options.duration_ms * 1000ULL;
+  while (daly_host::now_us() < end) {
+    rig.app.loop();
+    // about as often as the firmware loop comes around
+    usleep(1000);
+  }
+  uart.finish();
+
+  const double seconds = options.duration_ms / 1000.0;
+  printf("daly_bench: %.1fs, %u packs at %u baud, %s\n", seconds, (unsigned) options.packs,
+         (unsigned) options.baud_rate, options.modbus ? "Modbus" : "Daly protocol");
+  report_sweeps(uart.sweeps);
+  int failed = 0;
+  for (size_t i = 0; i < rig.bms.size(); i++) {
+    if (report_pack(rig.bms[i].get(), seconds) == 0) {
+      fprintf(stderr, "pack 0x%02X decoded no frames\n", rig.bms[i]->get_address());
+      failed++;
+    }
+    const float cells = rig.sensors[i]->cells_number.state;
+    if (options.cells >= 0 && cells != options.cells) {
+      fprintf(stderr, "pack 0x%02X reports %g cells, expected %d\n", rig.bms[i]->get_address(), cells, options.cells);
+      failed++;
+    }
+  }
+
+  if (!uart.received.empty()) {
+    daly_host::set_real_time(false);
+    daly_host::set_log_level(ESPHOME_LOG_LEVEL_NONE);
+    printf("  parser: %zu bytes, %.0f ns/byte (decoding included)\n", uart.received.size(),
+           parser_ns_per_byte(uart.received, options));
+  }
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,1112 @@
+// Drives the bus and component through packs on an in-memory line and checks what they decode. The packs answer
+// with the frames tools/daly_sim.py sends, but with fixed values.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "daly_bms.h"
+#include "daly_bms_bus.h"
+#include "daly_cell_analytics.h"
+#include "daly_history.h"
+#include "esphome/core/log.h"
+#include "host_app.h"
+#include "host_uart.h"
+
+using namespace esphome;
+using namespace esphome::daly_bms;
+
+static int failures = 0;
+
+#define EXPECT(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+#define EXPECT_NEAR(actual, expected, tolerance) \
+  do { \
+    const double a_ = (actual), e_ = (expected); \
+    if (!(std::fabs(a_ - e_) <= (tolerance))) { \
+      fprintf(stderr, "%s:%d: %s is %g, expected %g\n", __FILE__, __LINE__, #actual, a_, e_); \
+      failures++; \
+    } \
+  } while (0)
+
+static const uint8_t READ_IDS[] = {0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x59, 0x5A, 0x5E, 0x50};
+
+static std::vector<uint8_t> daly_frame(uint8_t address, uint8_t data_id, std::vector<uint8_t> data) {
+  data.resize(8);
+  std::vector<uint8_t> frame = {0xA5, address, data_id, 0x08};
+  frame.insert(frame.end(), data.begin(), data.end());
+  uint8_t checksum = 0;
+  for (uint8_t byte : frame)
+    checksum += byte;
+  frame.push_back(checksum);
+  return frame;
+}
+
+/// One pack on the line.
+struct PackModel {
+  uint8_t board{1};
+  std::vector<uint16_t> cells;  // mV
+  std::vector<int8_t> probes;   // °C
+  int16_t current{-123};        // 0.1 A, negative while discharging
+  uint16_t soc{875};            // 0.1 %
+  uint8_t state{2};             // 0 standby, 1 charging, 2 discharging
+  uint64_t balancing{0};        // bit n is cell n + 1
+  uint8_t alarms[7]{};
+  uint32_t reply_delay_us{10000};
+  bool silent{false};
+  // sent in front of the next reply, and a byte of the next reply flipped
+  std::vector<uint8_t> garbage;
+  bool corrupt_next{false};
+  // the next reply frame breaks off after this many bytes
+  uint8_t truncate_next{0};
+
+  uint16_t pack_decivolts() const {
+    uint32_t sum = 0;
+    for (uint16_t mv : this->cells)
+      sum += mv;
+    return sum / 100;
+  }
+
+  std::vector<std::vector<uint8_t>> replies(uint8_t data_id) const {
+    const uint16_t voltage = this->pack_decivolts();
+    const uint16_t current = this->current + 30000;
+    switch (data_id) {
+      case 0x90:
+        return {{uint8_t(voltage >> 8), uint8_t(voltage), 0, 0, uint8_t(current >> 8), uint8_t(current),
+                 uint8_t(this->soc >> 8), uint8_t(this->soc)}};
+      case 0x93:
+        // both MOS on, 100 Ah left
+        return {{this->state, 1, 1, 42, 0x00, 0x01, 0x86, 0xA0}};
+      case 0x94:
+        return {{uint8_t(this->cells.size()), uint8_t(this->probes.size()), 0, 0, 0, 0, 12, 0}};
+      case 0x95: {
+        std::vector<std::vector<uint8_t>> out;
+        for (size_t n = 0; n < this->cells.size(); n += 3) {
+          std::vector<uint8_t> data = {uint8_t(n / 3 + 1)};
+          for (size_t i = n; i < n + 3 && i < this->cells.size(); i++) {
+            data.push_back(this->cells[i] >> 8);
+            data.push_back(this->cells[i]);
+          }
+          out.push_back(data);
+        }
+        return out;
+      }
+      case 0x96: {
+        std::vector<std::vector<uint8_t>> out;
+        for (size_t n = 0; n < this->probes.size(); n += 7) {
+          std::vector<uint8_t> data = {uint8_t(n / 7 + 1)};
+          for (size_t i = n; i < n + 7 && i < this->probes.size(); i++)
+            data.push_back(this->probes[i] + 40);
+          out.push_back(data);
+        }
+        return out;
+      }
+      case 0x97: {
+        std::vector<uint8_t> data;
+        for (uint8_t i = 0; i < 6; i++)
+          data.push_back(this->balancing >> (8 * i));
+        return {data};
+      }
+      case 0x98:
+        return {{this->alarms[0], this->alarms[1], this->alarms[2], this->alarms[3], this->alarms[4],
+                 this->alarms[5], this->alarms[6], 0}};
+      case 0x59:
+        return {{0x0E, 0x42, 0x0E, 0x74, 0x0B, 0xB8, 0x0A, 0xF0}};
+      case 0x5A:
+        return {{0x02, 0x3A, 0x02, 0x44, 0x01, 0xA4, 0x01, 0x90}};
+      case 0x5E:
+        return {{0x01, 0x2C, 0x01, 0xF4, 5, 10}};
+      case 0x50:
+        return {{0x00, 0x01, 0x86, 0xA0, 0, 0, 0x0C, 0xE4}};
+      case DALY_COMMAND_RESET:
+        // restarts without acknowledging it
+        return {};
+      case DALY_COMMAND_SET_SOC:
+      case DALY_COMMAND_DISCHARGING_MOS:
+      case DALY_COMMAND_CHARGING_MOS:
+        // commands are acknowledged with their own ID
+        return {{1}};
+      default:
+        return {};
+    }
+  }
+
+  /// Holding registers as in the Modbus map of the H/K/M/S series.
+  std::vector<uint8_t> registers(uint16_t start, uint16_t count) const {
+    uint16_t map[0x53] = {};
+    for (size_t i = 0; i < this->cells.size(); i++)
+      map[i] = this->cells[i];
+    for (size_t i = 0; i < this->probes.size() && i < 8; i++)
+      map[0x30 + i] = this->probes[i] + 40;
+    map[0x38] = this->pack_decivolts();
+    map[0x39] = this->current + 30000;
+    map[0x3A] = this->soc;
+    map[0x3C] = this->cells.size();
+    map[0x3D] = this->probes.size();
+    const auto max_cell = std::max_element(this->cells.begin(), this->cells.end());
+    const auto min_cell = std::min_element(this->cells.begin(), this->cells.end());
+    map[0x3E] = *max_cell;
+    map[0x3F] = max_cell - this->cells.begin() + 1;
+    map[0x40] = *min_cell;
+    map[0x41] = min_cell - this->cells.begin() + 1;
+    const auto max_probe = std::max_element(this->probes.begin(), this->probes.end());
+    const auto min_probe = std::min_element(this->probes.begin(), this->probes.end());
+    map[0x43] = *max_probe + 40;
+    map[0x44] = max_probe - this->probes.begin() + 1;
+    map[0x45] = *min_probe + 40;
+    map[0x46] = min_probe - this->probes.begin() + 1;
+    map[0x48] = this->state;
+    map[0x4B] = 1000;  // 100 Ah
+    map[0x4C] = 12;
+    for (uint8_t i = 0; i < 3; i++)
+      map[0x4E + i] = this->balancing >> (16 * i);
+    map[0x51] = 1;
+    map[0x52] = 1;
+    std::vector<uint8_t> out;
+    for (uint16_t reg = start; reg < start + count; reg++) {
+      out.push_back(reg < 0x53 ? map[reg] >> 8 : 0);
+      out.push_back(reg < 0x53 ? map[reg] : 0);
+    }
+    return out;
+  }
+};
+
+/// A bus with its packs and the components that poll them.
+struct Rig {
+  daly_host::MemoryUART uart;
+  DalyBmsBus bus;
+  std::vector<std::unique_ptr<DalyBmsComponent>> bms;
+  std::vector<PackModel> packs;
+  daly_host::App app;
+  // data IDs in the order they went out, the low byte of the first register for Modbus reads
+  std::vector<uint8_t> requests;
+  size_t served{0};
+  bool modbus;
+
+  explicit Rig(bool modbus = false) : modbus(modbus) {
+    daly_host::reset();
+    // the components take millis() 0 for "never", on the device setup() runs well after boot
+    daly_host::advance(1000000);
+    this->bus.set_uart_parent(&this->uart);
+    this->bus.set_protocol(modbus ? DALY_PROTOCOL_MODBUS : DALY_PROTOCOL_DALY);
+    this->app.register_component(&this->bus);
+  }
+
+  DalyBmsComponent *add(uint8_t address, const PackModel &pack) {
+    auto *bms = new DalyBmsComponent();
+    bms->set_address(address);
+    bms->set_protocol(this->modbus ? DALY_PROTOCOL_MODBUS : DALY_PROTOCOL_DALY);
+    bms->set_update_interval(1000);
+    bms->set_cell_update_interval(1000);
+    bms->set_threshold_update_interval(3600000);
+    bms->set_diagnostic_update_interval(60000);
+    bms->set_energy_hash(address);
+    for (uint8_t data_id : READ_IDS)
+      bms->enable_request(data_id);
+    this->bus.register_device(bms);
+    this->app.register_component(bms);
+    this->bms.emplace_back(bms);
+    this->packs.push_back(pack);
+    return bms;
+  }
+
+  void start() { this->app.setup(); }
+
+  void run(uint32_t duration_ms) {
+    const uint64_t end = daly_host::now_us() + duration_ms * 1000ULL;
+    while (daly_host::now_us() < end) {
+      this->app.loop();
+      this->serve_();
+      daly_host::advance(500);
+    }
+  }
+
+  void serve_() {
+    if (this->modbus) {
+      this->serve_modbus_();
+      return;
+    }
+    while (this->uart.tx.size() - this->served >= DALY_FRAME_SIZE) {
+      const uint8_t *request = this->uart.tx.data() + this->served;
+      this->served += DALY_FRAME_SIZE;
+      this->requests.push_back(request[2]);
+      const uint8_t board = request[1] >= 0x80 ? request[1] - 0x7F : request[1] - 0x3F;
+      for (PackModel &pack : this->packs) {
+        if (pack.board != board || pack.silent)
+          continue;
+        uint64_t at = daly_host::now_us() + pack.reply_delay_us;
+        if (!pack.garbage.empty()) {
+          at = this->uart.receive(pack.garbage.data(), pack.garbage.size(), at);
+          pack.garbage.clear();
+        }
+        for (auto &data : pack.replies(request[2])) {
+          auto frame = daly_frame(board, request[2], data);
+          if (pack.corrupt_next) {
+            frame[6] ^= 0x10;
+            pack.corrupt_next = false;
+          }
+          if (pack.truncate_next != 0) {
+            frame.resize(pack.truncate_next);
+            pack.truncate_next = 0;
+          }
+          at = this->uart.receive(frame.data(), frame.size(), at);
+        }
+      }
+    }
+  }
+
+  void serve_modbus_() {
+    while (this->uart.tx.size() - this->served >= DALY_MODBUS_REQUEST_SIZE) {
+      const uint8_t *request = this->uart.tx.data() + this->served;
+      this->served += DALY_MODBUS_REQUEST_SIZE;
+      this->requests.push_back(request[3]);
+      for (PackModel &pack : this->packs) {
+        if (pack.board != request[0] || pack.silent)
+          continue;
+        const auto data = pack.registers(encode_uint16(request[2], request[3]), encode_uint16(request[4], request[5]));
+        std::vector<uint8_t> reply = {request[0], 0x03, uint8_t(data.size())};
+        reply.insert(reply.end(), data.begin(), data.end());
+        const uint16_t crc = crc16(reply.data(), reply.size());
+        reply.push_back(crc);
+        reply.push_back(crc >> 8);
+        if (pack.corrupt_next) {
+          reply[4] ^= 0x10;
+          pack.corrupt_next = false;
+        }
+        this->uart.receive(reply.data(), reply.size(), daly_host::now_us() + pack.reply_delay_us);
+      }
+    }
+  }
+};
+
+static PackModel sixteen_cells() {
+  PackModel pack;
+  for (uint8_t i = 0; i < 16; i++)
+    pack.cells.push_back(3300 + 2 * i);
+  pack.probes = {23, 25, 31};
+  return pack;
+}
+
+static void test_decodes_frames() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.balancing = 0b101;
+  pack.alarms[0] = 0x01;  // cell voltage high level 1
+  auto *bms = rig.add(0x80, pack);
+  DalySensor voltage, current, soc, cells_number, cycles, remaining, min_cell, max_cell, max_cell_number,
+      max_temperature, cell_high_alarm, nominal_capacity;
+  bms->set_voltage_sensor(&voltage);
+  bms->set_current_sensor(&current);
+  bms->set_battery_level_sensor(&soc);
+  bms->set_cells_number_sensor(&cells_number);
+  bms->set_cycle_sensor(&cycles);
+  bms->set_remaining_capacity_sensor(&remaining);
+  bms->set_min_cell_voltage_sensor(&min_cell);
+  bms->set_max_cell_voltage_sensor(&max_cell);
+  bms->set_max_cell_voltage_number_sensor(&max_cell_number);
+  bms->set_max_temperature_sensor(&max_temperature);
+  bms->set_cell_level_1_alarm_high_voltage_sensor(&cell_high_alarm);
+  bms->set_cell_nominal_capacity_sensor(&nominal_capacity);
+  DalySensor cell_sensors[16], probe_sensors[3];
+  for (uint8_t i = 0; i < 16; i++)
+    bms->set_cell_voltage_sensor(i, &cell_sensors[i]);
+  for (uint8_t i = 0; i < 3; i++)
+    bms->set_temperature_sensor(i, &probe_sensors[i]);
+  DalyBinarySensor charging_mos, balance[3];
+  bms->set_charging_mos_enabled_binary_sensor(&charging_mos);
+  for (uint8_t i = 0; i < 3; i++)
+    bms->set_cell_balance_binary_sensor(i, &balance[i]);
+  text_sensor::TextSensor failures_text;
+  bms->set_failures_text_sensor(&failures_text);
+
+  rig.start();
+  rig.run(3000);
+
+  EXPECT_NEAR(voltage.state, pack.pack_decivolts() / 10.0, 1e-3);
+  EXPECT_NEAR(current.state, -12.3, 1e-3);
+  EXPECT_NEAR(soc.state, 87.5, 1e-3);
+  EXPECT_NEAR(cells_number.state, 16, 0);
+  EXPECT_NEAR(cycles.state, 12, 0);
+  EXPECT_NEAR(remaining.state, 100.0, 1e-3);
+  EXPECT_NEAR(min_cell.state, 3.300, 1e-6);
+  EXPECT_NEAR(max_cell.state, 3.330, 1e-6);
+  EXPECT_NEAR(max_cell_number.state, 16, 0);
+  EXPECT_NEAR(max_temperature.state, 31, 0);
+  EXPECT_NEAR(cell_high_alarm.state, 3.650, 1e-6);
+  EXPECT_NEAR(nominal_capacity.state, 100.0, 1e-3);
+  for (uint8_t i = 0; i < 16; i++)
+    EXPECT_NEAR(cell_sensors[i].state, (3300 + 2 * i) / 1000.0, 1e-6);
+  EXPECT_NEAR(probe_sensors[2].state, 31, 0);
+  EXPECT(charging_mos.state);
+  EXPECT(balance[0].state && !balance[1].state && balance[2].state);
+  EXPECT(failures_text.state == "Cell voltage high level 1");
+
+  const DalyCommandStats *stats = bms->get_command_stats(0x95);
+  EXPECT(stats != nullptr && stats->frames >= 6 && stats->replies >= 1 && stats->timeouts == 0);
+  EXPECT(bms->get_command_stats(0x42) == nullptr);
+}
+
+static void test_decodes_cells_across_frames() {
+  Rig rig;
+  PackModel pack;
+  // sixteen 0x95 frames of three cells each
+  for (uint16_t i = 0; i < 48; i++)
+    pack.cells.push_back(3200 + 3 * i);
+  pack.cells[40] = 3100;
+  pack.probes = {25};
+  auto *bms = rig.add(0x80, pack);
+  DalySensor cells[48], cells_number, min_cell, min_cell_number, max_cell, max_cell_number;
+  for (uint8_t i = 0; i < 48; i++)
+    bms->set_cell_voltage_sensor(i, &cells[i]);
+  bms->set_cells_number_sensor(&cells_number);
+  bms->set_min_cell_voltage_sensor(&min_cell);
+  bms->set_min_cell_voltage_number_sensor(&min_cell_number);
+  bms->set_max_cell_voltage_sensor(&max_cell);
+  bms->set_max_cell_voltage_number_sensor(&max_cell_number);
+  rig.start();
+  rig.run(3000);
+
+  EXPECT_NEAR(cells_number.state, 48, 0);
+  for (uint8_t i = 0; i < 48; i++)
+    EXPECT_NEAR(cells[i].state, pack.cells[i] / 1000.0, 1e-6);
+  EXPECT_NEAR(min_cell.state, 3.100, 1e-6);
+  EXPECT_NEAR(min_cell_number.state, 41, 0);
+  EXPECT_NEAR(max_cell.state, 3.341, 1e-6);
+  EXPECT_NEAR(max_cell_number.state, 48, 0);
+  const DalyCommandStats *stats = bms->get_command_stats(0x95);
+  EXPECT(stats != nullptr && stats->frames >= 16 && stats->timeouts == 0);
+}
+
+static void test_decodes_balance_bits_above_16() {
+  Rig rig;
+  PackModel pack;
+  for (uint16_t i = 0; i < 24; i++)
+    pack.cells.push_back(3300);
+  pack.probes = {25};
+  // bit 30 is past the cell count and has to be ignored
+  pack.balancing = UINT64_C(1) << 20 | UINT64_C(1) << 23 | UINT64_C(1) << 30;
+  auto *bms = rig.add(0x80, pack);
+  DalyBinarySensor balance[32];
+  for (uint8_t i = 0; i < 32; i++)
+    bms->set_cell_balance_binary_sensor(i, &balance[i]);
+  rig.start();
+  rig.run(3000);
+
+  for (uint8_t i = 0; i < 24; i++)
+    EXPECT(balance[i].has_state() && balance[i].state == (i == 20 || i == 23));
+  EXPECT(!balance[30].has_state());
+
+  rig.packs[0].balancing = UINT64_C(1) << 17;
+  rig.run(3000);
+  for (uint8_t i = 0; i < 24; i++)
+    EXPECT(balance[i].state == (i == 17));
+}
+
+static void test_decodes_probes_across_frames() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  // two 0x96 frames, the second one half full
+  pack.probes = {21, 22, 23, 24, 25, 26, 27, -5, 35, 29};
+  auto *bms = rig.add(0x80, pack);
+  DalySensor probes[10], max_temperature, min_temperature;
+  for (uint8_t i = 0; i < 10; i++)
+    bms->set_temperature_sensor(i, &probes[i]);
+  bms->set_max_temperature_sensor(&max_temperature);
+  bms->set_min_temperature_sensor(&min_temperature);
+  rig.start();
+  rig.run(3000);
+
+  for (uint8_t i = 0; i < 10; i++)
+    EXPECT_NEAR(probes[i].state, pack.probes[i], 0);
+  EXPECT_NEAR(max_temperature.state, 35, 0);
+  EXPECT_NEAR(min_temperature.state, -5, 0);
+  const DalyCommandStats *stats = bms->get_command_stats(0x96);
+  EXPECT(stats != nullptr && stats->frames >= 2 && stats->timeouts == 0);
+}
+
+static void test_reports_failure_edges() {
+  Rig rig;
+  auto *bms = rig.add(0x80, sixteen_cells());
+  struct Call {
+    DalyFailureBits bits, raised, cleared;
+  };
+  std::vector<Call> calls;
+  bms->add_failure_callback([&calls](const DalyFailureBits &bits, const DalyFailureBits &raised,
+                                     const DalyFailureBits &cleared) { calls.push_back({bits, raised, cleared}); });
+  rig.start();
+
+  // all clear from the start is no change
+  rig.run(3000);
+  EXPECT(calls.empty());
+
+  rig.packs[0].alarms[0] = 0x01;  // cell voltage high level 1
+  rig.packs[0].alarms[3] = 0x80;
+  rig.run(3000);
+  EXPECT(calls.size() == 1);
+  EXPECT(calls[0].bits == (DalyFailureBits{0x01, 0, 0, 0x80, 0, 0, 0}));
+  EXPECT(calls[0].raised == (DalyFailureBits{0x01, 0, 0, 0x80, 0, 0, 0}));
+  EXPECT(calls[0].cleared == DalyFailureBits{});
+
+  // one bit goes, another comes, in the same reply
+  rig.packs[0].alarms[0] = 0x04;
+  rig.run(3000);
+  EXPECT(calls.size() == 2);
+  EXPECT(calls[1].bits == (DalyFailureBits{0x04, 0, 0, 0x80, 0, 0, 0}));
+  EXPECT(calls[1].raised == (DalyFailureBits{0x04, 0, 0, 0, 0, 0, 0}));
+  EXPECT(calls[1].cleared == (DalyFailureBits{0x01, 0, 0, 0, 0, 0, 0}));
+
+  rig.packs[0].alarms[0] = 0;
+  rig.packs[0].alarms[3] = 0;
+  rig.run(3000);
+  EXPECT(calls.size() == 3);
+  EXPECT(calls[2].bits == DalyFailureBits{});
+  EXPECT(calls[2].raised == DalyFailureBits{});
+  EXPECT(calls[2].cleared == (DalyFailureBits{0x04, 0, 0, 0x80, 0, 0, 0}));
+
+  // the same bits again and again are no edge
+  rig.run(5000);
+  EXPECT(calls.size() == 3);
+}
+
+static void test_publishes_snapshot_json() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.balancing = 0b101;
+  pack.alarms[0] = 0x01;
+  auto *bms = rig.add(0x80, pack);
+  text_sensor::TextSensor snapshot;
+  bms->set_snapshot_text_sensor(&snapshot);
+  rig.start();
+  rig.run(3000);
+
+  EXPECT(snapshot.state ==
+         "{\"v\":53.0,\"i\":-12.3,\"soc\":87.5,\"state\":2,\"chg\":1,\"dsg\":1,\"mah\":100000,\"cycles\":12,"
+         "\"bal\":\"050000000000\",\"alarms\":\"01000000000000\","
+         "\"mv\":[3300,3302,3304,3306,3308,3310,3312,3314,3316,3318,3320,3322,3324,3326,3328,3330],"
+         "\"temp\":[23,25,31]}");
+}
+
+static void test_integrates_charge_and_energy() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.current = -1000;  // 100 A discharge at 53.0 V
+  auto *bms = rig.add(0x80, pack);
+  DalySensor charged, discharged, discharged_energy, session;
+  bms->set_charged_capacity_sensor(&charged);
+  bms->set_discharged_capacity_sensor(&discharged);
+  bms->set_discharged_energy_sensor(&discharged_energy);
+  bms->set_session_capacity_sensor(&session);
+  rig.start();
+  // 0x90 every second, 36 s between the first and the last sample
+  rig.run(36500);
+
+  EXPECT_NEAR(discharged.state, 1.0, 0.01);
+  EXPECT_NEAR(discharged_energy.state, 0.053, 0.001);
+  EXPECT_NEAR(charged.state, 0, 0);
+  EXPECT_NEAR(session.state, 1.0, 0.01);
+}
+
+static void test_skips_integration_gaps() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.current = -1000;
+  auto *bms = rig.add(0x80, pack);
+  DalySensor discharged;
+  bms->set_discharged_capacity_sensor(&discharged);
+  rig.start();
+  rig.run(36500);
+  EXPECT_NEAR(discharged.state, 1.0, 0.01);
+
+  // 11 minutes without a sample: the current in between is unknown, nothing is added for them
+  rig.packs[0].silent = true;
+  rig.run(1000);
+  daly_host::advance(11 * 60 * 1000000ULL);
+  rig.packs[0].silent = false;
+  rig.run(10500);
+  EXPECT(discharged.state < 1.0 + 11 * 100 / 3600.0 + 0.01);
+  EXPECT(discharged.state > 1.0 + 9 * 100 / 3600.0 - 0.01);
+}
+
+static void test_resets_session_on_state_change() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.current = -1000;
+  auto *bms = rig.add(0x80, pack);
+  DalySensor charged, discharged, session;
+  bms->set_charged_capacity_sensor(&charged);
+  bms->set_discharged_capacity_sensor(&discharged);
+  bms->set_session_capacity_sensor(&session);
+  rig.start();
+  rig.run(36500);
+  EXPECT_NEAR(session.state, 1.0, 0.01);
+
+  // charging now: a new session, the totals carry on
+  rig.packs[0].state = 1;
+  rig.packs[0].current = 1000;
+  rig.run(18000);
+  // the sample across the change averages -100 A and +100 A to nothing, 17 s of charging follow
+  EXPECT_NEAR(session.state, 17 * 100 / 3600.0, 0.01);
+  EXPECT_NEAR(charged.state, 17 * 100 / 3600.0, 0.01);
+  EXPECT_NEAR(discharged.state, 1.0, 0.01);
+
+  // standby does not end the session, and adds nothing past the sample across the change
+  rig.packs[0].state = 0;
+  rig.packs[0].current = 0;
+  const float charging_session = session.state;
+  rig.run(5000);
+  EXPECT_NEAR(session.state, charging_session, 0.02);
+}
+
+static void test_history_round_trip() {
+  DalyHistory history;
+  EXPECT(history.init(4));
+  struct Written {
+    DalyHistoryType type;
+    uint32_t time;
+    std::vector<int32_t> values;
+  };
+  std::vector<int32_t> cells;
+  for (int32_t i = 0; i < 16; i++)
+    cells.push_back(3300 + 2 * i);
+  const std::vector<Written> written = {
+      {DALY_HISTORY_PACK, 1000, {530, -123, 875}},
+      {DALY_HISTORY_CELLS, 1010, cells},
+      {DALY_HISTORY_TEMPERATURES, 1020, {23, -5, 31}},
+      // current across zero, a big step, and a jump in time
+      {DALY_HISTORY_PACK, 2000, {531, 1500, 874}},
+      {DALY_HISTORY_PACK, 3600000, {400, -30000, 0}},
+      // a different cell count is stored whole, not as deltas
+      {DALY_HISTORY_CELLS, 3600010, {3300, 3301, 3302, 3303, 3304, 3305, 3306, 3307}},
+  };
+  for (const Written &record : written)
+    history.record(record.type, record.time, record.values.data(), record.values.size());
+  EXPECT(history.records() == written.size());
+
+  DalyHistoryCursor cursor;
+  DalyHistoryRecord record;
+  history.rewind(cursor);
+  for (const Written &expected : written) {
+    EXPECT(history.next(cursor, record));
+    EXPECT(record.type == expected.type && record.time == expected.time);
+    EXPECT(std::vector<int32_t>(record.values, record.values + record.count) == expected.values);
+  }
+  EXPECT(!history.next(cursor, record));
+}
+
+static void test_history_drops_oldest_block() {
+  DalyHistory history;
+  EXPECT(history.init(2));
+  DalyHistoryCursor reader;
+  DalyHistoryRecord record;
+  history.rewind(reader);
+  const uint32_t written = 500;
+  for (uint32_t i = 0; i < written; i++) {
+    const int32_t pack[3] = {int32_t(500 + i % 7), int32_t(i % 2 ? -100 : 100), int32_t(900 - i / 10)};
+    history.record(DALY_HISTORY_PACK, 1000 * (i + 1), pack, 3);
+    if (i == 0)
+      EXPECT(history.next(reader, record));
+  }
+  EXPECT(history.used() <= history.capacity());
+
+  // what is left is the newest records without a hole, ending with the last one written
+  DalyHistoryCursor cursor;
+  history.rewind(cursor);
+  uint32_t count = 0, first = 0, last = 0;
+  bool contiguous = true;
+  while (history.next(cursor, record)) {
+    if (count == 0)
+      first = record.time;
+    else
+      contiguous &= record.time == last + 1000;
+    last = record.time;
+    count++;
+  }
+  EXPECT(count == history.records() && count < written);
+  EXPECT(first > 1000 && last == 1000 * written && contiguous);
+  EXPECT_NEAR(record.values[0], 500 + (written - 1) % 7, 0);
+  EXPECT_NEAR(record.values[2], 900 - int32_t(written - 1) / 10, 0);
+
+  // a reader that was overtaken skips ahead to the oldest block left
+  EXPECT(history.next(reader, record));
+  EXPECT(reader.lost_blocks > 0 && record.time == first);
+}
+
+static void test_dumps_history_in_batches() {
+  Rig rig;
+  auto *bms = rig.add(0x80, sixteen_cells());
+  bms->set_history_blocks(4);
+  rig.start();
+  rig.run(3000);
+  // nothing new while the dump runs
+  rig.packs[0].silent = true;
+  rig.run(1000);
+
+  const uint32_t before = daly_host::log_count(ESPHOME_LOG_LEVEL_INFO);
+  bms->dump_history(2);
+  // the header line and the first batch right away, the next batch 50 ms later
+  rig.run(1);
+  EXPECT(daly_host::log_count(ESPHOME_LOG_LEVEL_INFO) - before == 3);
+  rig.run(48);
+  EXPECT(daly_host::log_count(ESPHOME_LOG_LEVEL_INFO) - before == 3);
+  rig.run(2);
+  EXPECT(daly_host::log_count(ESPHOME_LOG_LEVEL_INFO) - before == 5);
+  rig.run(5000);
+  // every record once, between the header and the end line: one per 0x90 frame and per complete 0x95/0x96 reply
+  const uint32_t records = bms->get_command_stats(0x90)->frames + bms->get_command_stats(0x95)->replies +
+                           bms->get_command_stats(0x96)->replies;
+  EXPECT(records >= 6);
+  EXPECT(daly_host::log_count(ESPHOME_LOG_LEVEL_INFO) - before == 2 + records);
+}
+
+static void test_suppresses_changes_within_deadband() {
+  Rig rig;
+  auto *bms = rig.add(0x80, sixteen_cells());
+  DalySensor voltage, current;
+  voltage.set_deadband(0.5f);
+  bms->set_voltage_sensor(&voltage);
+  // without a deadband or heartbeat every reading is published
+  bms->set_current_sensor(&current);
+  int voltage_published = 0, current_published = 0;
+  voltage.add_on_state_callback([&voltage_published](float) { voltage_published++; });
+  current.add_on_state_callback([&current_published](float) { current_published++; });
+  rig.start();
+  rig.run(3000);
+  EXPECT(voltage_published == 1);
+  EXPECT(current_published >= 3);
+
+  // 0.2 V is inside the deadband
+  rig.packs[0].cells[0] += 200;
+  rig.run(3000);
+  EXPECT(voltage_published == 1);
+  EXPECT_NEAR(voltage.state, 53.0, 1e-3);
+  // 0.6 V from the last published value is not, even though each step was smaller
+  rig.packs[0].cells[0] += 400;
+  rig.run(3000);
+  EXPECT(voltage_published == 2);
+  EXPECT_NEAR(voltage.state, 53.6, 1e-3);
+}
+
+static void test_republishes_on_heartbeat() {
+  Rig rig;
+  auto *bms = rig.add(0x80, sixteen_cells());
+  DalySensor voltage;
+  voltage.set_deadband(0.5f);
+  voltage.set_heartbeat(10000);
+  bms->set_voltage_sensor(&voltage);
+  DalyBinarySensor charging_mos;
+  charging_mos.set_heartbeat(10000);
+  bms->set_charging_mos_enabled_binary_sensor(&charging_mos);
+  int voltage_published = 0, mos_published = 0;
+  voltage.add_on_state_callback([&voltage_published](float) { voltage_published++; });
+  charging_mos.add_on_state_callback([&mos_published](bool) { mos_published++; });
+  rig.start();
+  // polled every second, unchanged: the first reading and one heartbeat after 10 s
+  rig.run(15000);
+  EXPECT(voltage_published == 2);
+  EXPECT(mos_published == 2);
+  // a change within the deadband waits for the heartbeat as well
+  rig.packs[0].cells[0] += 200;
+  rig.run(4000);
+  EXPECT(voltage_published == 2);
+  rig.run(3000);
+  EXPECT(voltage_published == 3);
+  EXPECT_NEAR(voltage.state, 53.2, 1e-3);
+}
+
+static size_t count_requests(const Rig &rig, uint8_t data_id, size_t from = 0) {
+  return std::count(rig.requests.begin() + from, rig.requests.end(), data_id);
+}
+
+static void test_polls_faster_while_active() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.state = 0;
+  pack.current = 0;
+  auto *bms = rig.add(0x80, pack);
+  bms->set_update_interval(5000);
+  bms->set_active_update_interval(1000);
+  rig.start();
+  rig.run(1000);
+  size_t from = rig.requests.size();
+  rig.run(20000);
+  EXPECT(count_requests(rig, 0x90, from) == 4);
+
+  // discharging: the next sweep switches to the active interval
+  rig.packs[0].state = 2;
+  rig.run(5000);
+  from = rig.requests.size();
+  rig.run(10000);
+  EXPECT(count_requests(rig, 0x90, from) == 10);
+
+  // back in standby, back to the idle interval
+  rig.packs[0].state = 0;
+  rig.run(1500);
+  from = rig.requests.size();
+  rig.run(20000);
+  EXPECT(count_requests(rig, 0x90, from) == 4);
+}
+
+static void test_current_step_wakes_up_polling() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.state = 0;
+  pack.current = 0;
+  auto *bms = rig.add(0x80, pack);
+  bms->set_update_interval(5000);
+  bms->set_active_update_interval(1000);
+  bms->set_current_step(5.0f);
+  rig.start();
+  rig.run(6000);
+  size_t from = rig.requests.size();
+
+  // a 4 A change is below the step, the pack stays on the idle interval
+  rig.packs[0].current = -40;
+  rig.run(5000);
+  EXPECT(count_requests(rig, 0x90, from) == 1);
+
+  // 6 A more is a step even though the BMS still reports standby: the fast frames are asked again right away and
+  // once more a second later, then the standby state takes over again
+  rig.packs[0].current = -100;
+  from = rig.requests.size();
+  rig.run(5000);
+  EXPECT(count_requests(rig, 0x90, from) == 3);
+  // back on the idle interval once the last active poll is through
+  rig.run(2000);
+  from = rig.requests.size();
+  rig.run(20000);
+  EXPECT(count_requests(rig, 0x90, from) == 4);
+}
+
+static void test_resyncs_after_garbage() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  // a stray byte and a frame that broke off after five bytes, right in front of the first reply
+  pack.garbage = {0x13, 0xA5, 0x01, 0x90, 0x08, 0x01};
+  auto *bms = rig.add(0x80, pack);
+  DalySensor voltage;
+  bms->set_voltage_sensor(&voltage);
+  rig.start();
+  rig.run(300);
+
+  // the reply behind the garbage is not lost
+  EXPECT_NEAR(voltage.state, pack.pack_decivolts() / 10.0, 1e-3);
+  EXPECT(bms->get_discarded_bytes() >= 6);
+  EXPECT(bms->get_command_stats(0x90)->timeouts == 0);
+}
+
+static void test_counts_checksum_errors() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.corrupt_next = true;
+  auto *bms = rig.add(0x80, pack);
+  DalySensor voltage;
+  bms->set_voltage_sensor(&voltage);
+  rig.start();
+  rig.run(3000);
+
+  const DalyCommandStats *stats = bms->get_command_stats(0x90);
+  EXPECT(stats->checksum_errors == 1);
+  EXPECT(stats->timeouts == 1);
+  // the next sweep reads it again
+  EXPECT_NEAR(voltage.state, pack.pack_decivolts() / 10.0, 1e-3);
+}
+
+static void test_counts_frames_that_break_off() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.truncate_next = 7;
+  auto *bms = rig.add(0x80, pack);
+  bms->set_diagnostic_update_interval(2000);
+  DalySensor resyncs, voltage_rate, cell_rate;
+  bms->set_resyncs_sensor(&resyncs);
+  bms->set_command_frame_rate_sensor(0x90, &voltage_rate);
+  bms->set_command_frame_rate_sensor(0x95, &cell_rate);
+  rig.start();
+  rig.run(2100);
+
+  EXPECT(bms->get_command_stats(0x90)->resyncs == 1);
+  EXPECT_NEAR(resyncs.state, 1, 0);
+  // 16 cells take six frames per sweep, the battery level one
+  EXPECT(voltage_rate.state > 0);
+  EXPECT_NEAR(cell_rate.state, 6 * voltage_rate.state, 0.01);
+}
+
+static void test_routes_replies_of_two_packs() {
+  Rig rig;
+  PackModel first = sixteen_cells();
+  PackModel second = sixteen_cells();
+  second.board = 2;
+  second.cells.resize(8);
+  auto *bms1 = rig.add(0x80, first);
+  auto *bms2 = rig.add(0x81, second);
+  DalySensor voltage1, voltage2, cells2;
+  bms1->set_voltage_sensor(&voltage1);
+  bms2->set_voltage_sensor(&voltage2);
+  bms2->set_cells_number_sensor(&cells2);
+  rig.start();
+  rig.run(3000);
+
+  EXPECT_NEAR(voltage1.state, first.pack_decivolts() / 10.0, 1e-3);
+  EXPECT_NEAR(voltage2.state, second.pack_decivolts() / 10.0, 1e-3);
+  EXPECT_NEAR(cells2.state, 8, 0);
+}
+
+static void test_keeps_reply_timeouts_per_pack() {
+  Rig rig;
+  PackModel online = sixteen_cells();
+  PackModel offline = sixteen_cells();
+  offline.board = 2;
+  offline.silent = true;
+  auto *bms1 = rig.add(0x80, online);
+  auto *bms2 = rig.add(0x81, offline);
+  rig.start();
+  rig.run(5000);
+
+  // the pack that answers keeps a timeout close to its response time, the silent one backs off alone
+  EXPECT(rig.bus.get_reply_timeout(bms1) < 100);
+  EXPECT(rig.bus.get_reply_timeout(bms2) == 1000);
+  EXPECT(bms1->get_command_stats(0x90)->timeouts == 0);
+}
+
+static void test_writes_go_first() {
+  Rig rig;
+  auto *bms = rig.add(0x80, sixteen_cells());
+  std::vector<std::pair<uint8_t, bool>> done;
+  bms->add_on_write_complete_callback([&done](uint8_t command, bool success) { done.push_back({command, success}); });
+  rig.start();
+  // in the middle of the first sweep
+  rig.run(40);
+  const size_t sent = rig.requests.size();
+  bms->set_discharging_mos(false);
+  rig.run(500);
+
+  EXPECT(rig.requests.size() > sent + 1);
+  // at most the read that was already on the line goes before it
+  EXPECT(rig.requests[sent] == DALY_COMMAND_DISCHARGING_MOS || rig.requests[sent + 1] == DALY_COMMAND_DISCHARGING_MOS);
+  EXPECT(done.size() == 1 && done[0].first == DALY_COMMAND_DISCHARGING_MOS && done[0].second);
+}
+
+static void test_reset_is_done_once_sent() {
+  Rig rig;
+  auto *bms = rig.add(0x80, sixteen_cells());
+  std::vector<std::pair<uint8_t, bool>> done;
+  bms->add_on_write_complete_callback([&done](uint8_t command, bool success) { done.push_back({command, success}); });
+  rig.start();
+  rig.run(500);
+  bms->reset_bms();
+  rig.run(20);
+
+  EXPECT(std::find(rig.requests.begin(), rig.requests.end(), DALY_COMMAND_RESET) != rig.requests.end());
+  EXPECT(done.size() == 1 && done[0].first == DALY_COMMAND_RESET && done[0].second);
+  // polling goes on without waiting out a reply timeout
+  const size_t sent = rig.requests.size();
+  rig.run(100);
+  EXPECT(rig.requests.size() > sent);
+}
+
+static void test_decodes_modbus_registers() {
+  Rig rig(true);
+  PackModel pack = sixteen_cells();
+  pack.balancing = 0b110;
+  auto *bms = rig.add(0x80, pack);
+  DalySensor voltage, current, soc, remaining, cycles, cells_number, max_cell, max_cell_number, max_temperature;
+  bms->set_voltage_sensor(&voltage);
+  bms->set_current_sensor(&current);
+  bms->set_battery_level_sensor(&soc);
+  bms->set_remaining_capacity_sensor(&remaining);
+  bms->set_cycle_sensor(&cycles);
+  bms->set_cells_number_sensor(&cells_number);
+  bms->set_max_cell_voltage_sensor(&max_cell);
+  bms->set_max_cell_voltage_number_sensor(&max_cell_number);
+  bms->set_max_temperature_sensor(&max_temperature);
+  DalySensor cell_sensors[16], probe_sensors[3];
+  for (uint8_t i = 0; i < 16; i++)
+    bms->set_cell_voltage_sensor(i, &cell_sensors[i]);
+  for (uint8_t i = 0; i < 3; i++)
+    bms->set_temperature_sensor(i, &probe_sensors[i]);
+  DalyBinarySensor charging_mos, balance[3];
+  bms->set_charging_mos_enabled_binary_sensor(&charging_mos);
+  for (uint8_t i = 0; i < 3; i++)
+    bms->set_cell_balance_binary_sensor(i, &balance[i]);
+  rig.start();
+  rig.run(1500);
+
+  // the pack read from 0x30 and the cell read from 0x00
+  EXPECT(std::find(rig.requests.begin(), rig.requests.end(), 0x30) != rig.requests.end());
+  EXPECT(std::find(rig.requests.begin(), rig.requests.end(), 0x00) != rig.requests.end());
+  EXPECT_NEAR(voltage.state, pack.pack_decivolts() / 10.0, 1e-3);
+  EXPECT_NEAR(current.state, -12.3, 1e-3);
+  EXPECT_NEAR(soc.state, 87.5, 1e-3);
+  EXPECT_NEAR(remaining.state, 100.0, 1e-3);
+  EXPECT_NEAR(cycles.state, 12, 0);
+  EXPECT_NEAR(cells_number.state, 16, 0);
+  EXPECT_NEAR(max_cell.state, 3.330, 1e-6);
+  EXPECT_NEAR(max_cell_number.state, 16, 0);
+  EXPECT_NEAR(max_temperature.state, 31, 0);
+  for (uint8_t i = 0; i < 16; i++)
+    EXPECT_NEAR(cell_sensors[i].state, (3300 + 2 * i) / 1000.0, 1e-6);
+  EXPECT_NEAR(probe_sensors[0].state, 23, 0);
+  EXPECT_NEAR(probe_sensors[2].state, 31, 0);
+  EXPECT(charging_mos.state);
+  EXPECT(!balance[0].state && balance[1].state && balance[2].state);
+  EXPECT(bms->get_command_stats(0x90)->replies >= 1 && bms->get_command_stats(0x95)->replies >= 1);
+}
+
+static void test_publishes_modbus_snapshot() {
+  Rig rig(true);
+  PackModel pack = sixteen_cells();
+  pack.balancing = 0b101;
+  auto *bms = rig.add(0x80, pack);
+  text_sensor::TextSensor snapshot;
+  bms->set_snapshot_text_sensor(&snapshot);
+  rig.start();
+  rig.run(1500);
+
+  // thresholds and the failure status are not read over Modbus, the sweep completes without them
+  EXPECT(snapshot.state ==
+         "{\"v\":53.0,\"i\":-12.3,\"soc\":87.5,\"state\":2,\"chg\":1,\"dsg\":1,\"mah\":100000,\"cycles\":12,"
+         "\"bal\":\"050000000000\","
+         "\"mv\":[3300,3302,3304,3306,3308,3310,3312,3314,3316,3318,3320,3322,3324,3326,3328,3330],"
+         "\"temp\":[23,25,31]}");
+  EXPECT(bms->get_command_stats(0x98)->replies == 0 && bms->get_command_stats(0x59)->timeouts == 0);
+}
+
+static void test_counts_modbus_errors_per_frame() {
+  Rig rig(true);
+  PackModel pack = sixteen_cells();
+  pack.corrupt_next = true;
+  auto *bms = rig.add(0x80, pack);
+  rig.start();
+  rig.run(1500);
+
+  // the first pack read had a CRC error and timed out, that counts for every frame it stands in for
+  for (uint8_t data_id : {0x90, 0x93, 0x94, 0x96, 0x97}) {
+    EXPECT(bms->get_command_stats(data_id)->checksum_errors == 1);
+    EXPECT(bms->get_command_stats(data_id)->timeouts == 1);
+  }
+  EXPECT(bms->get_command_stats(0x95)->checksum_errors == 0);
+  // Modbus has no failure status, so it is never asked for
+  EXPECT(bms->get_command_stats(0x98)->timeouts == 0);
+
+  Rig silent(true);
+  pack.silent = true;
+  bms = silent.add(0x80, pack);
+  silent.start();
+  silent.run(3000);
+  EXPECT(bms->get_command_stats(0x90)->timeouts >= 1);
+  EXPECT(bms->get_command_stats(0x95)->timeouts >= 1);
+}
+
+static void test_times_out_on_a_silent_pack() {
+  Rig rig;
+  PackModel pack = sixteen_cells();
+  pack.silent = true;
+  auto *bms = rig.add(0x80, pack);
+  rig.start();
+  rig.run(3000);
+
+  EXPECT(bms->get_command_stats(0x90)->timeouts >= 2);
+  EXPECT(bms->get_command_stats(0x90)->frames == 0);
+}
+
+static void test_captures_traffic() {
+  Rig rig;
+  PackModel first = sixteen_cells();
+  first.garbage = {0x13, 0xA5, 0x01, 0x90, 0x08, 0x01};
+  PackModel second = sixteen_cells();
+  second.board = 2;
+  auto *bms1 = rig.add(0x80, first);
+  auto *bms2 = rig.add(0x81, second);
+  rig.bus.set_capture(true);
+  const uint32_t before = daly_host::log_count(ESPHOME_LOG_LEVEL_DEBUG);
+  rig.start();
+  rig.run(3000);
+
+  uint32_t frames = 0;
+  for (uint8_t data_id : READ_IDS)
+    frames += bms1->get_command_stats(data_id)->frames + bms2->get_command_stats(data_id)->frames;
+  EXPECT(frames > 0);
+  EXPECT(daly_host::log_count(ESPHOME_LOG_LEVEL_DEBUG) > before);
+  // run_replay.py checks that daly_replay decodes the same from the capture in the log
+  printf("captured %u frames\n", (unsigned) frames);
+}
+
+static void test_resistance_from_a_slow_ramp() {
+  DalyCellAnalytics analytics;
+  analytics.set_current_step(50);
+  // 2 mΩ per cell, the current ramps by 1 A per reading: no two readings in a row are 5 A apart
+  uint32_t time = 1000;
+  for (int32_t current = 0; current <= 100; current += 10, time += 2000) {
+    const uint16_t voltages[2] = {uint16_t(3300 + current / 5), uint16_t(3400 + current / 5)};
+    analytics.add_current(current, time);
+    analytics.add_cells(voltages, 2, time);
+  }
+  EXPECT_NEAR(analytics.resistance(0), 2.0, 1e-3);
+  EXPECT_NEAR(analytics.resistance(1), 2.0, 1e-3);
+
+  // a step against a reading from a minute ago is drift as much as resistance
+  DalyCellAnalytics stale;
+  stale.set_current_step(50);
+  const uint16_t before[1] = {3300}, after[1] = {3320};
+  stale.add_current(0, 1000);
+  stale.add_cells(before, 1, 1000);
+  stale.add_current(100, 61000);
+  stale.add_cells(after, 1, 61000);
+  EXPECT(std::isnan(stale.resistance(0)));
+}
+
+int main(int argc, char **argv) {
+  daly_host::set_log_level(getenv("DALY_LOG") != nullptr ? atoi(getenv("DALY_LOG")) : ESPHOME_LOG_LEVEL_ERROR);
+  const struct {
+    const char *name;
+    void (*run)();
+  } tests[] = {
+      {"decodes_frames", test_decodes_frames},
+      {"decodes_cells_across_frames", test_decodes_cells_across_frames},
+      {"decodes_balance_bits_above_16", test_decodes_balance_bits_above_16},
+      {"decodes_probes_across_frames", test_decodes_probes_across_frames},
+      {"reports_failure_edges", test_reports_failure_edges},
+      {"publishes_snapshot_json", test_publishes_snapshot_json},
+      {"integrates_charge_and_energy", test_integrates_charge_and_energy},
+      {"skips_integration_gaps", test_skips_integration_gaps},
+      {"resets_session_on_state_change", test_resets_session_on_state_change},
+      {"history_round_trip", test_history_round_trip},
+      {"history_drops_oldest_block", test_history_drops_oldest_block},
+      {"dumps_history_in_batches", test_dumps_history_in_batches},
+      {"suppresses_changes_within_deadband", test_suppresses_changes_within_deadband},
+      {"republishes_on_heartbeat", test_republishes_on_heartbeat},
+      {"polls_faster_while_active", test_polls_faster_while_active},
+      {"current_step_wakes_up_polling", test_current_step_wakes_up_polling},
+      {"resyncs_after_garbage", test_resyncs_after_garbage},
+      {"counts_checksum_errors", test_counts_checksum_errors},
+      {"counts_frames_that_break_off", test_counts_frames_that_break_off},
+      {"routes_replies_of_two_packs", test_routes_replies_of_two_packs},
+      {"keeps_reply_timeouts_per_pack", test_keeps_reply_timeouts_per_pack},
+      {"writes_go_first", test_writes_go_first},
+      {"reset_is_done_once_sent", test_reset_is_done_once_sent},
+      {"decodes_modbus_registers", test_decodes_modbus_registers},
+      {"publishes_modbus_snapshot", test_publishes_modbus_snapshot},
+      {"counts_modbus_errors_per_frame", test_counts_modbus_errors_per_frame},
+      {"times_out_on_a_silent_pack", test_times_out_on_a_silent_pack},
+      {"captures_traffic", test_captures_traffic},
+      {"resistance_from_a_slow_ramp", test_resistance_from_a_slow_ramp},
+  };
+  for (const auto &test : tests) {
+    if (argc > 1 && strcmp(argv[1], test.name) != 0)
+      continue;
+    const int before = failures;
+    test.run();
+    printf("%s %s\n", failures == before ? "ok  " : "FAIL", test.name);
+  }
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,315 @@
+// Feeds a capture file of tools/daly_capture.py through the bus and component, with the recorded timing in
+// simulated time or back to back, and reports what they make of it: frames decoded, checksum errors, resyncs and
+// discarded bytes per pack, and the CPU time the parser and decoder spend per received byte.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "daly_bms.h"
+#include "daly_bms_bus.h"
+#include "esphome/core/log.h"
+#include "host_app.h"
+#include "host_uart.h"
+
+using namespace esphome;
+using namespace esphome::daly_bms;
+
+static const uint8_t READ_IDS[] = {0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x59, 0x5A, 0x5E, 0x50};
+
+// keep in sync with tools/daly_capture.py
+static const char CAPTURE_MAGIC[] = "DALYCAP\x01";
+static const uint8_t CAPTURE_RX = 0;
+static const uint8_t CAPTURE_TX = 1;
+static const uint8_t CAPTURE_GAP = 2;
+// the line stays quiet this long after the last record, so the last reply completes or times out
+static const uint32_t TAIL_MS = 3000;
+
+struct Record {
+  uint32_t dt_ms;  // since the previous record
+  uint8_t kind;
+  std::vector<uint8_t> data;
+};
+
+struct Options {
+  std::string path;
+  std::vector<uint8_t> addresses;  // taken from the recorded requests when empty
+  uint32_t baud_rate{9600};
+  bool modbus{false};
+  bool max_speed{false};
+  int expect_frames{-1};
+  int log_level{ESPHOME_LOG_LEVEL_NONE};
+};
+
+static bool get_varint(const std::vector<uint8_t> &data, size_t *offset, uint32_t *value) {
+  *value = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (*offset >= data.size())
+      return false;
+    const uint8_t c = data[(*offset)++];
+    *value |= uint32_t(c & 0x7F) << shift;
+    if ((c & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+static bool read_capture(const std::string &path, std::vector<Record> *records) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    return false;
+  std::vector<uint8_t> data;
+  uint8_t buffer[4096];
+  size_t len;
+  while ((len = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    data.insert(data.end(), buffer, buffer + len);
+  fclose(file);
+  const size_t magic_size = sizeof(CAPTURE_MAGIC) - 1;
+  if (data.size() < magic_size || memcmp(data.data(), CAPTURE_MAGIC, magic_size) != 0)
+    return false;
+  size_t offset = magic_size;
+  while (offset < data.size()) {
+    Record record;
+    uint32_t length;
+    if (!get_varint(data, &offset, &record.dt_ms) || offset >= data.size())
+      return false;
+    record.kind = data[offset++];
+    if (!get_varint(data, &offset, &length) || data.size() - offset < length)
+      return false;
+    record.data.assign(data.begin() + offset, data.begin() + offset + length);
+    offset += length;
+    records->push_back(std::move(record));
+  }
+  return true;
+}
+
+/// The protocol and the packs the recorded requests went to, unless given on the command line.
+static void detect_packs(const std::vector<Record> &records, Options *options) {
+  const bool given = !options->addresses.empty();
+  for (const Record &record : records) {
+    if (record.kind != CAPTURE_TX)
+      continue;
+    uint8_t address;
+    if (record.data.size() == DALY_MODBUS_REQUEST_SIZE) {
+      // the slave address is the board number, see DalyBmsComponent::get_reply_address()
+      options->modbus = true;
+      address = record.data[0] + 0x7F;
+    } else if (record.data.size() == DALY_FRAME_SIZE) {
+      address = record.data[1];
+    } else {
+      continue;
+    }
+    if (!given && std::find(options->addresses.begin(), options->addresses.end(), address) == options->addresses.end())
+      options->addresses.push_back(address);
+  }
+  if (options->addresses.empty())
+    options->addresses.push_back(0x80);
+}
+
+/// The sensors a typical configuration has, so decoding costs what it costs on the device.
+struct PackSensors {
+  DalySensor voltage, current, soc, cells_number, min_cell, max_cell, max_temperature;
+  DalySensor cells[DALY_MAX_CELLS];
+  DalySensor probes[DALY_MAX_TEMPERATURES];
+
+  void attach(DalyBmsComponent *bms) {
+    bms->set_voltage_sensor(&this->voltage);
+    bms->set_current_sensor(&this->current);
+    bms->set_battery_level_sensor(&this->soc);
+    bms->set_cells_number_sensor(&this->cells_number);
+    bms->set_min_cell_voltage_sensor(&this->min_cell);
+    bms->set_max_cell_voltage_sensor(&this->max_cell);
+    bms->set_max_temperature_sensor(&this->max_temperature);
+    for (uint8_t i = 0; i < DALY_MAX_CELLS; i++)
+      bms->set_cell_voltage_sensor(i, &this->cells[i]);
+    for (uint8_t i = 0; i < DALY_MAX_TEMPERATURES; i++)
+      bms->set_temperature_sensor(i, &this->probes[i]);
+  }
+};
+
+/// The bus and one component per pack on an in-memory line that only carries the recorded bytes.
+struct Rig {
+  daly_host::MemoryUART uart;
+  DalyBmsBus bus;
+  std::vector<std::unique_ptr<DalyBmsComponent>> bms;
+  std::vector<std::unique_ptr<PackSensors>> sensors;
+  daly_host::App app;
+  // time spent in the loop that parsed received bytes, ns
+  double parse_ns{0};
+
+  explicit Rig(const Options &options) {
+    // the components take millis() 0 for "never", on the device setup() runs well after boot
+    daly_host::advance(1000000);
+    this->uart.set_baud_rate(options.baud_rate);
+    this->bus.set_uart_parent(&this->uart);
+    this->bus.set_protocol(options.modbus ? DALY_PROTOCOL_MODBUS : DALY_PROTOCOL_DALY);
+    this->app.register_component(&this->bus);
+    for (uint8_t address : options.addresses) {
+      auto *bms = new DalyBmsComponent();
+      bms->set_address(address);
+      bms->set_protocol(options.modbus ? DALY_PROTOCOL_MODBUS : DALY_PROTOCOL_DALY);
+      bms->set_update_interval(1000);
+      bms->set_cell_update_interval(1000);
+      bms->set_threshold_update_interval(3600000);
+      bms->set_diagnostic_update_interval(60000);
+      bms->set_energy_hash(address);
+      for (uint8_t data_id : READ_IDS)
+        bms->enable_request(data_id);
+      auto *sensors = new PackSensors();
+      sensors->attach(bms);
+      this->bus.register_device(bms);
+      this->app.register_component(bms);
+      this->bms.emplace_back(bms);
+      this->sensors.emplace_back(sensors);
+    }
+  }
+
+  /// One pass of the firmware loop, the part that parses the received bytes timed.
+  void loop() {
+    if (this->uart.available() > 0) {
+      const auto start = std::chrono::steady_clock::now();
+      this->bus.loop();
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      this->parse_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    }
+    this->app.loop();
+  }
+
+  /// Puts a received chunk on the line as it was read: all of it in the buffer now.
+  void receive(const std::vector<uint8_t> &data) {
+    const uint64_t now = daly_host::now_us();
+    const uint64_t span = data.size() * this->uart.byte_time_us();
+    this->uart.receive(data.data(), data.size(), now > span ? now - span : 0);
+  }
+
+  /// Loops every millisecond of simulated time for `duration_ms`.
+  void idle(uint32_t duration_ms) {
+    for (uint32_t ms = 0; ms < duration_ms; ms++) {
+      this->loop();
+      daly_host::advance(1000);
+    }
+  }
+};
+
+static void usage(const char *name) {
+  fprintf(stderr,
+          "usage: %s CAPTURE [--address ADDR]... [--baud RATE] [--modbus] [--max-speed] [--expect-frames N]\n"
+          "       [--log LEVEL]\n",
+          name);
+  exit(2);
+}
+
+static Options parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--modbus") {
+      options.modbus = true;
+      continue;
+    }
+    if (arg == "--max-speed") {
+      options.max_speed = true;
+      continue;
+    }
+    if (arg.compare(0, 2, "--") != 0) {
+      if (!options.path.empty())
+        usage(argv[0]);
+      options.path = arg;
+      continue;
+    }
+    if (i + 1 >= argc)
+      usage(argv[0]);
+    const char *value = argv[++i];
+    if (arg == "--address") {
+      options.addresses.push_back(strtol(value, nullptr, 0));
+    } else if (arg == "--baud") {
+      options.baud_rate = atoi(value);
+    } else if (arg == "--expect-frames") {
+      options.expect_frames = atoi(value);
+    } else if (arg == "--log") {
+      options.log_level = atoi(value);
+    } else {
+      usage(argv[0]);
+    }
+  }
+  if (options.path.empty())
+    usage(argv[0]);
+  return options;
+}
+
+/// Prints what the component made of the replies of one pack, returns the frames it decoded.
+static uint32_t report_pack(const DalyBmsComponent *bms) {
+  uint32_t frames = 0, checksum_errors = 0, resyncs = 0;
+  for (uint8_t data_id : READ_IDS) {
+    const DalyCommandStats *stats = bms->get_command_stats(data_id);
+    frames += stats->frames;
+    checksum_errors += stats->checksum_errors;
+    resyncs += stats->resyncs;
+  }
+  printf("  pack 0x%02X: %u frames, %u checksum errors, %u resyncs, %u discarded bytes\n", bms->get_address(),
+         (unsigned) frames, (unsigned) checksum_errors, (unsigned) resyncs, (unsigned) bms->get_discarded_bytes());
+  for (uint8_t data_id : READ_IDS) {
+    const DalyCommandStats *stats = bms->get_command_stats(data_id);
+    if (stats->frames == 0 && stats->checksum_errors == 0 && stats->resyncs == 0)
+      continue;
+    printf("    0x%02X: %u frames, %u checksum errors, %u resyncs\n", data_id, (unsigned) stats->frames,
+           (unsigned) stats->checksum_errors, (unsigned) stats->resyncs);
+  }
+  return frames;
+}
+
+int main(int argc, char **argv) {
+  Options options = parse_options(argc, argv);
+  daly_host::set_log_level(options.log_level);
+  std::vector<Record> records;
+  if (!read_capture(options.path, &records)) {
+    fprintf(stderr, "%s is not a daly_bms capture\n", options.path.c_str());
+    return 2;
+  }
+  detect_packs(records, &options);
+
+  Rig rig(options);
+  rig.app.setup();
+  size_t counts[3] = {0, 0, 0}, rx_bytes = 0;
+  uint64_t recorded_ms = 0;
+  for (const Record &record : records) {
+    recorded_ms += record.dt_ms;
+    if (record.kind <= CAPTURE_GAP)
+      counts[record.kind]++;
+    if (!options.max_speed)
+      rig.idle(record.dt_ms);
+    if (record.kind != CAPTURE_RX)
+      continue;
+    rx_bytes += record.data.size();
+    rig.receive(record.data);
+    if (options.max_speed) {
+      // one loop per chunk, the next chunk comes as soon as the bytes of this one are in the buffer
+      rig.loop();
+      daly_host::advance(1000);
+    }
+  }
+  rig.idle(TAIL_MS);
+
+  printf("daly_replay: %s, %zu received, %zu sent, %zu gaps, %zu bytes over %.1fs, %s, %s\n", options.path.c_str(),
+         counts[CAPTURE_RX], counts[CAPTURE_TX], counts[CAPTURE_GAP], rx_bytes, recorded_ms / 1000.0,
+         options.modbus ? "Modbus" : "Daly protocol", options.max_speed ? "back to back" : "recorded timing");
+  uint32_t frames = 0;
+  for (const auto &bms : rig.bms)
+    frames += report_pack(bms.get());
+  if (rx_bytes != 0)
+    printf("  parser: %.0f ns/byte (decoding included)\n", rig.parse_ns / rx_bytes);
+
+  if (options.expect_frames >= 0 && frames != (uint32_t) options.expect_frames) {
+    fprintf(stderr, "decoded %u frames, expected %d\n", (unsigned) frames, options.expect_frames);
+    return 1;
+  }
+  if (frames == 0) {
+    fprintf(stderr, "decoded no frames\n");
+    return 1;
+  }
+  return 0;
+}
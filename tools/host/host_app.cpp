@@ -0,0 +1,209 @@
+#include "host_app.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+
+namespace daly_host {
+
+static bool real_time = false;
+static uint64_t simulated_us = 0;
+static int log_level = ESPHOME_LOG_LEVEL_INFO;
+static uint32_t log_counts[ESPHOME_LOG_LEVEL_VERY_VERBOSE + 1];
+
+struct ScheduledItem {
+  esphome::Component *component;
+  std::string name;
+  bool interval;
+  uint32_t period;
+  uint64_t next_us;
+  std::function<void()> f;
+};
+
+// intervals and timeouts of all components, a new item with the same component and name replaces the old one
+static std::vector<ScheduledItem> scheduled;
+
+void reset() {
+  scheduled.clear();
+  simulated_us = 0;
+  memset(log_counts, 0, sizeof(log_counts));
+}
+
+void set_real_time(bool real) { real_time = real; }
+
+uint64_t now_us() {
+  if (!real_time)
+    return simulated_us;
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void advance(uint64_t us) { simulated_us += us; }
+
+void set_log_level(int level) { log_level = level; }
+
+uint32_t log_count(int level) { return log_counts[level]; }
+
+static void schedule(esphome::Component *component, const std::string &name, bool interval, uint32_t period,
+                     std::function<void()> &&f) {
+  scheduled.erase(std::remove_if(scheduled.begin(), scheduled.end(),
+                                 [&](const ScheduledItem &item) {
+                                   return item.component == component && item.interval == interval &&
+                                          item.name == name;
+                                 }),
+                  scheduled.end());
+  // like the firmware, a new interval first runs after a random part of its period; here after none of it
+  scheduled.push_back({component, name, interval, period, now_us() + (interval ? 0 : period * 1000ULL), std::move(f)});
+}
+
+static bool cancel(esphome::Component *component, const std::string &name, bool interval) {
+  const size_t before = scheduled.size();
+  scheduled.erase(std::remove_if(scheduled.begin(), scheduled.end(),
+                                 [&](const ScheduledItem &item) {
+                                   return item.component == component && item.interval == interval &&
+                                          item.name == name;
+                                 }),
+                  scheduled.end());
+  return scheduled.size() != before;
+}
+
+static void run_scheduled() {
+  const uint64_t now = now_us();
+  for (size_t i = 0; i < scheduled.size(); i++) {
+    if (scheduled[i].next_us > now)
+      continue;
+    // the callback may add or cancel items, so run a copy
+    std::function<void()> f = scheduled[i].f;
+    if (scheduled[i].interval) {
+      scheduled[i].next_us = now + std::max<uint64_t>(scheduled[i].period, 1) * 1000ULL;
+    } else {
+      scheduled.erase(scheduled.begin() + i);
+      i--;
+    }
+    f();
+  }
+}
+
+void App::setup() {
+  std::stable_sort(this->components_.begin(), this->components_.end(),
+                   [](esphome::Component *a, esphome::Component *b) {
+                     return a->get_setup_priority() > b->get_setup_priority();
+                   });
+  for (auto *component : this->components_) {
+    component->setup();
+    if (auto *polling = dynamic_cast<esphome::PollingComponent *>(component))
+      polling->start_poller();
+  }
+  for (auto *component : this->components_)
+    component->dump_config();
+}
+
+void App::loop() {
+  for (auto *component : this->components_)
+    component->loop();
+  run_scheduled();
+}
+
+void App::run_for(uint32_t duration_ms, uint32_t step_us) {
+  const uint64_t end = now_us() + duration_ms * 1000ULL;
+  while (now_us() < end) {
+    this->loop();
+    advance(step_us);
+  }
+}
+
+}  // namespace daly_host
+
+namespace esphome {
+
+namespace setup_priority {
+const float BUS = 1000.0f;
+const float IO = 900.0f;
+const float DATA = 600.0f;
+const float LATE = -100.0f;
+}  // namespace setup_priority
+
+uint32_t millis() { return daly_host::now_us() / 1000; }
+uint32_t micros() { return daly_host::now_us(); }
+void delay(uint32_t ms) { daly_host::advance(ms * 1000ULL); }
+
+void Component::set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f) {
+  daly_host::schedule(this, name, true, interval, std::move(f));
+}
+bool Component::cancel_interval(const std::string &name) { return daly_host::cancel(this, name, true); }
+void Component::set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f) {
+  daly_host::schedule(this, name, false, timeout, std::move(f));
+}
+bool Component::cancel_timeout(const std::string &name) { return daly_host::cancel(this, name, false); }
+
+void esp_log_printf_(int level, const char *tag, int line, const char *format, ...) {
+  daly_host::log_counts[level]++;
+  if (level > daly_host::log_level)
+    return;
+  static const char LETTERS[] = "?EWICDVV";
+  fprintf(stderr, "[%10.3f][%c][%s:%d]: ", daly_host::now_us() / 1e6, LETTERS[level], tag, line);
+  va_list args;
+  va_start(args, format);
+  vfprintf(stderr, format, args);
+  va_end(args);
+  fputc('\n', stderr);
+}
+
+uint16_t crc16(const uint8_t *data, uint16_t len, uint16_t crc, uint16_t reverse_poly, bool refin, bool refout) {
+  // the Modbus variant, the only one the component uses
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t i = 0; i < 8; i++)
+      crc = (crc & 1) ? (crc >> 1) ^ reverse_poly : crc >> 1;
+  }
+  return crc;
+}
+
+std::string format_hex(const uint8_t *data, size_t length) {
+  std::string out(length * 2, '0');
+  for (size_t i = 0; i < length; i++)
+    snprintf(&out[2 * i], 3, "%02x", data[i]);
+  return out;
+}
+
+std::string base64_encode(const uint8_t *buf, size_t buf_len) {
+  static const char CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < buf_len; i += 3) {
+    const uint32_t value = buf[i] << 16 | (i + 1 < buf_len ? buf[i + 1] << 8 : 0) | (i + 2 < buf_len ? buf[i + 2] : 0);
+    out += CHARS[(value >> 18) & 63];
+    out += CHARS[(value >> 12) & 63];
+    out += i + 1 < buf_len ? CHARS[(value >> 6) & 63] : '=';
+    out += i + 2 < buf_len ? CHARS[value & 63] : '=';
+  }
+  return out;
+}
+
+static std::map<uint32_t, std::string> saved_preferences;
+static ESPPreferences preferences;
+ESPPreferences *global_preferences = &preferences;
+
+bool ESPPreferenceObject::save_(const uint8_t *data, size_t len) {
+  if (!this->valid_)
+    return false;
+  saved_preferences[this->key_].assign(reinterpret_cast<const char *>(data), len);
+  return true;
+}
+
+bool ESPPreferenceObject::load_(uint8_t *data, size_t len) {
+  auto it = saved_preferences.find(this->key_);
+  if (!this->valid_ || it == saved_preferences.end() || it->second.size() != len)
+    return false;
+  memcpy(data, it->second.data(), len);
+  return true;
+}
+
+}  // namespace esphome
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "esphome/core/component.h"
+
+/// Runs components on the host the way the firmware does: setup() in priority order, then loop() of every
+/// component followed by the intervals and timeouts that are due.
+namespace daly_host {
+
+/// Forgets all scheduled intervals and timeouts, log counts and the simulated time, for the next test.
+void reset();
+
+/// Simulated time starts at 0 and only moves with advance(); real time follows the monotonic clock.
+void set_real_time(bool real);
+uint64_t now_us();
+void advance(uint64_t us);
+
+/// Log lines above `level` are counted but not printed.
+void set_log_level(int level);
+uint32_t log_count(int level);
+
+class App {
+ public:
+  void register_component(esphome::Component *component) { this->components_.push_back(component); }
+  void setup();
+  void loop();
+  /// Loops every `step_us` of simulated time until `duration_ms` have passed.
+  void run_for(uint32_t duration_ms, uint32_t step_us = 1000);
+
+ protected:
+  std::vector<esphome::Component *> components_;
+};
+
+}  // namespace daly_host
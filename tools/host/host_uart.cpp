@@ -0,0 +1,150 @@
+#include "host_uart.h"
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "esphome/core/log.h"
+#include "host_app.h"
+
+namespace esphome {
+namespace uart {
+
+static const char *const TAG = "uart";
+
+void UARTDevice::check_uart_settings(uint32_t baud_rate, uint8_t stop_bits, UARTParityOptions parity,
+                                     uint8_t data_bits) {
+  if (this->parent_->get_baud_rate() != baud_rate) {
+    ESP_LOGE(TAG, "  Invalid baud_rate: Integration requested baud_rate %u but you have %u!", (unsigned) baud_rate,
+             (unsigned) this->parent_->get_baud_rate());
+  }
+}
+
+}  // namespace uart
+}  // namespace esphome
+
+namespace daly_host {
+
+bool MemoryUART::peek_byte(uint8_t *data) {
+  if (this->available() == 0)
+    return false;
+  *data = this->rx_.front().value;
+  return true;
+}
+
+bool MemoryUART::read_array(uint8_t *data, size_t len) {
+  if ((size_t) this->available() < len)
+    return false;
+  for (size_t i = 0; i < len; i++) {
+    data[i] = this->rx_.front().value;
+    this->rx_.pop_front();
+  }
+  return true;
+}
+
+int MemoryUART::available() {
+  const uint64_t now = now_us();
+  int count = 0;
+  for (const Byte &byte : this->rx_) {
+    if (byte.due > now)
+      break;
+    count++;
+  }
+  return count;
+}
+
+uint64_t MemoryUART::receive(const uint8_t *data, size_t len, uint64_t start_us) {
+  // the line carries one byte at a time, a reply cannot overtake bytes still on the wire
+  uint64_t due = std::max(start_us, this->rx_.empty() ? 0 : this->rx_.back().due);
+  for (size_t i = 0; i < len; i++) {
+    due += this->byte_time_us();
+    this->rx_.push_back({due, data[i]});
+  }
+  return due;
+}
+
+static speed_t to_speed(uint32_t baud_rate) {
+  switch (baud_rate) {
+    case 9600:
+      return B9600;
+    case 19200:
+      return B19200;
+    case 38400:
+      return B38400;
+    case 57600:
+      return B57600;
+    case 115200:
+      return B115200;
+    default:
+      return B0;
+  }
+}
+
+SerialUART::~SerialUART() {
+  if (this->fd_ >= 0)
+    close(this->fd_);
+}
+
+bool SerialUART::open(const std::string &path, uint32_t baud_rate) {
+  this->fd_ = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (this->fd_ < 0)
+    return false;
+  termios tio{};
+  if (tcgetattr(this->fd_, &tio) != 0)
+    return false;
+  cfmakeraw(&tio);
+  const speed_t speed = to_speed(baud_rate);
+  if (speed == B0)
+    return false;
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  tio.c_cflag |= CLOCAL | CREAD;
+  this->baud_rate_ = baud_rate;
+  return tcsetattr(this->fd_, TCSANOW, &tio) == 0;
+}
+
+void SerialUART::write_array(const uint8_t *data, size_t len) {
+  while (len != 0) {
+    const ssize_t written = write(this->fd_, data, len);
+    if (written <= 0)
+      return;
+    data += written;
+    len -= written;
+  }
+}
+
+void SerialUART::fill_() {
+  uint8_t buffer[256];
+  ssize_t len;
+  while ((len = read(this->fd_, buffer, sizeof(buffer))) > 0) {
+    this->buffer_.insert(this->buffer_.end(), buffer, buffer + len);
+    this->received.insert(this->received.end(), buffer, buffer + len);
+  }
+}
+
+bool SerialUART::peek_byte(uint8_t *data) {
+  this->fill_();
+  if (this->buffer_.empty())
+    return false;
+  *data = this->buffer_.front();
+  return true;
+}
+
+bool SerialUART::read_array(uint8_t *data, size_t len) {
+  this->fill_();
+  if (this->buffer_.size() < len)
+    return false;
+  std::copy(this->buffer_.begin(), this->buffer_.begin() + len, data);
+  this->buffer_.erase(this->buffer_.begin(), this->buffer_.begin() + len);
+  return true;
+}
+
+int SerialUART::available() {
+  this->fill_();
+  return this->buffer_.size();
+}
+
+}  // namespace daly_host
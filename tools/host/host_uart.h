@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "esphome/components/uart/uart.h"
+
+namespace daly_host {
+
+/// A line in memory: what the component writes is collected in `tx`, received bytes are queued with the time
+/// they finish on the wire and only become available from then on.
+class MemoryUART : public esphome::uart::UARTComponent {
+ public:
+  void write_array(const uint8_t *data, size_t len) override { this->tx.insert(this->tx.end(), data, data + len); }
+  bool peek_byte(uint8_t *data) override;
+  bool read_array(uint8_t *data, size_t len) override;
+  int available() override;
+  void flush() override {}
+
+  /// Queues `len` bytes whose first byte starts at `start_us`, returns the time the last one is in.
+  uint64_t receive(const uint8_t *data, size_t len, uint64_t start_us);
+  /// Time one byte takes at the baud rate (10 bits per byte).
+  uint64_t byte_time_us() const { return 10000000ULL / this->baud_rate_; }
+  /// Bytes queued that are not available yet.
+  size_t in_flight() const { return this->rx_.size(); }
+
+  std::vector<uint8_t> tx;
+
+ protected:
+  struct Byte {
+    uint64_t due;
+    uint8_t value;
+  };
+  std::deque<Byte> rx_;
+};
+
+/// A tty, e.g. the pty tools/daly_sim.py prints or a USB RS485 adapter, in raw mode at the baud rate.
+class SerialUART : public esphome::uart::UARTComponent {
+ public:
+  ~SerialUART() override;
+  bool open(const std::string &path, uint32_t baud_rate);
+
+  void write_array(const uint8_t *data, size_t len) override;
+  bool peek_byte(uint8_t *data) override;
+  bool read_array(uint8_t *data, size_t len) override;
+  int available() override;
+  void flush() override {}
+
+  /// Everything read from the line, for replaying it offline afterwards.
+  std::vector<uint8_t> received;
+
+ protected:
+  void fill_();
+
+  int fd_{-1};
+  std::deque<uint8_t> buffer_;
+};
+
+}  // namespace daly_host
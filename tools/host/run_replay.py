@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+"""Captures the traffic of a daly_host_test run, turns the log into a capture file with tools/daly_capture.py and
+checks that daly_replay decodes the same frames from it, with the recorded timing and back to back.
+
+usage: run_replay.py DALY_HOST_TEST DALY_REPLAY
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), ".."))
+import daly_capture  # noqa: E402
+
+# ESPHOME_LOG_LEVEL_DEBUG, the level of the capture lines
+LOG_LEVEL_DEBUG = 5
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("test", help="path of the daly_host_test binary")
+    parser.add_argument("replay", help="path of the daly_replay binary")
+    args = parser.parse_args()
+
+    test = subprocess.run([args.test, "captures_traffic"], env={**os.environ, "DALY_LOG": str(LOG_LEVEL_DEBUG)},
+                          capture_output=True, text=True)
+    sys.stdout.write(test.stdout)
+    if test.returncode != 0:
+        sys.stderr.write(test.stderr)
+        return test.returncode
+    match = re.search(r"captured (\d+) frames", test.stdout)
+    if match is None:
+        print("daly_host_test did not report the captured frames", file=sys.stderr)
+        return 1
+
+    with tempfile.TemporaryDirectory() as directory:
+        path = os.path.join(directory, "test.cap")
+        with open(path, "wb") as out:
+            count = daly_capture.write_capture(daly_capture.parse_log(test.stderr.splitlines()), out)
+        if count == 0:
+            print("no capture lines in the log", file=sys.stderr)
+            return 1
+        for mode in ([], ["--max-speed"]):
+            replay = subprocess.run([args.replay, path, "--expect-frames", match.group(1)] + mode)
+            if replay.returncode != 0:
+                return replay.returncode
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
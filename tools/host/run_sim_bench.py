@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+"""Runs daly_bench against tools/daly_sim.py on a pty and returns its exit code.
+
+usage: run_sim_bench.py DALY_BENCH [--duration S] [--packs N] [--cells N] [--temperatures N] [--noise P]
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+SIMULATOR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "daly_sim.py")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("bench", help="path of the daly_bench binary")
+    parser.add_argument("--duration", type=float, default=10.0)
+    parser.add_argument("--packs", type=int, default=1)
+    parser.add_argument("--cells", type=int, default=16)
+    parser.add_argument("--temperatures", type=int, default=2)
+    parser.add_argument("--noise", type=float, default=0.0)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    with tempfile.TemporaryDirectory() as directory:
+        link = os.path.join(directory, "daly")
+        simulator = subprocess.Popen(
+            [sys.executable, SIMULATOR, "--link", link, "--seed", str(args.seed), "--packs", str(args.packs),
+             "--cells", str(args.cells), "--temperatures", str(args.temperatures), "--noise", str(args.noise),
+             "--report", str(args.duration + 1)],
+            stdout=subprocess.PIPE, text=True)
+        try:
+            # the simulator prints its pty once it listens
+            line = simulator.stdout.readline()
+            if not line.startswith("Daly BMS simulator on"):
+                print(f"simulator did not start: {line!r}", file=sys.stderr)
+                return 2
+            bench = subprocess.run(
+                [args.bench, "--port", link, "--duration", str(args.duration), "--packs", str(args.packs),
+                 "--cells", str(args.cells)])
+            return bench.returncode
+        finally:
+            simulator.terminate()
+            simulator.wait()
+
+
+if __name__ == "__main__":
+    sys.exit(main())
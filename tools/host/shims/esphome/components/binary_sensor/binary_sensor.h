@@ -0,0 +1,31 @@
+#pragma once
+
+#include <functional>
+#include <utility>
+
+#include "esphome/core/entity_base.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace binary_sensor {
+
+class BinarySensor : public EntityBase {
+ public:
+  void publish_state(bool state) {
+    this->state = state;
+    this->has_state_ = true;
+    this->callbacks_.call(state);
+  }
+  void publish_initial_state(bool state) { this->publish_state(state); }
+  void add_on_state_callback(std::function<void(bool)> &&callback) { this->callbacks_.add(std::move(callback)); }
+  bool has_state() const { return this->has_state_; }
+
+  bool state{false};
+
+ protected:
+  bool has_state_{false};
+  CallbackManager<void(bool)> callbacks_;
+};
+
+}  // namespace binary_sensor
+}  // namespace esphome
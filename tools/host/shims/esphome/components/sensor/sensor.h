@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cmath>
+#include <functional>
+#include <utility>
+
+#include "esphome/core/entity_base.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace sensor {
+
+class Sensor : public EntityBase {
+ public:
+  void publish_state(float state) {
+    this->state = state;
+    this->has_state_ = true;
+    this->callbacks_.call(state);
+  }
+  void add_on_state_callback(std::function<void(float)> &&callback) { this->callbacks_.add(std::move(callback)); }
+  bool has_state() const { return this->has_state_; }
+  float get_state() const { return this->state; }
+
+  float state{NAN};
+
+ protected:
+  bool has_state_{false};
+  CallbackManager<void(float)> callbacks_;
+};
+
+}  // namespace sensor
+}  // namespace esphome
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "esphome/core/entity_base.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace text_sensor {
+
+class TextSensor : public EntityBase {
+ public:
+  void publish_state(const std::string &state) {
+    this->state = state;
+    this->has_state_ = true;
+    this->callbacks_.call(state);
+  }
+  void add_on_state_callback(std::function<void(std::string)> &&callback) {
+    this->callbacks_.add(std::move(callback));
+  }
+  bool has_state() const { return this->has_state_; }
+
+  std::string state;
+
+ protected:
+  bool has_state_{false};
+  CallbackManager<void(std::string)> callbacks_;
+};
+
+}  // namespace text_sensor
+
+#define SUB_TEXT_SENSOR(name) \
+ protected: \
+  text_sensor::TextSensor *name##_text_sensor_{nullptr}; \
+\
+ public: \
+  void set_##name##_text_sensor(text_sensor::TextSensor *text_sensor) { this->name##_text_sensor_ = text_sensor; }
+
+}  // namespace esphome
@@ -0,0 +1,31 @@
+#pragma once
+
+// What codegen would emit for a configuration that uses every frame and feature of the component. The
+// minimal build (DALY_HOST_MINIMAL) only decodes 0x90, so the #ifdef guards are compiled both ways.
+
+#define ESPHOME_LOG_LEVEL ESPHOME_LOG_LEVEL_VERY_VERBOSE
+
+#define USE_SENSOR
+#define USE_BINARY_SENSOR
+#define USE_TEXT_SENSOR
+#define USE_SWITCH
+
+#define USE_DALY_BMS_BATTERY_LEVEL
+#ifndef DALY_HOST_MINIMAL
+#define USE_DALY_BMS_MIN_MAX_VOLTAGE
+#define USE_DALY_BMS_MIN_MAX_TEMPERATURE
+#define USE_DALY_BMS_MOS
+#define USE_DALY_BMS_STATUS
+#define USE_DALY_BMS_CELL_VOLTAGE
+#define USE_DALY_BMS_TEMPERATURE
+#define USE_DALY_BMS_BALANCE
+#define USE_DALY_BMS_FAILURE_STATUS
+#define USE_DALY_BMS_CELL_THRESHOLDS
+#define USE_DALY_BMS_PACK_THRESHOLDS
+#define USE_DALY_BMS_REST_THRESHOLDS
+#define USE_DALY_BMS_CAPACITY_NOMINAL_VOLTAGE
+#define USE_DALY_BMS_HISTORY
+#define USE_DALY_BMS_CAPTURE
+#define USE_DALY_BMS_SNAPSHOT
+#define USE_DALY_BMS_CELL_ANALYTICS
+#endif
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <string>
+
+namespace esphome {
+
+class EntityBase {
+ public:
+  const std::string &get_name() const { return this->name_; }
+  void set_name(const std::string &name) { this->name_ = name; }
+
+ protected:
+  std::string name_;
+};
+
+}  // namespace esphome
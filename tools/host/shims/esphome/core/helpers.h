@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "esphome/core/hal.h"
+
+namespace esphome {
+
+inline uint16_t encode_uint16(uint8_t msb, uint8_t lsb) { return (uint16_t(msb) << 8) | lsb; }
+inline uint32_t encode_uint32(uint8_t byte1, uint8_t byte2, uint8_t byte3, uint8_t byte4) {
+  return (uint32_t(byte1) << 24) | (uint32_t(byte2) << 16) | (uint32_t(byte3) << 8) | byte4;
+}
+
+template<typename T> T clamp(T value, T min, T max) { return value < min ? min : value > max ? max : value; }
+
+uint16_t crc16(const uint8_t *data, uint16_t len, uint16_t crc = 0xffff, uint16_t reverse_poly = 0xa001,
+               bool refin = false, bool refout = false);
+std::string format_hex(const uint8_t *data, size_t length);
+std::string base64_encode(const uint8_t *buf, size_t buf_len);
+
+template<typename... X> class CallbackManager;
+template<typename... Ts> class CallbackManager<void(Ts...)> {
+ public:
+  void add(std::function<void(Ts...)> &&callback) { this->callbacks_.push_back(std::move(callback)); }
+  void call(Ts... args) {
+    for (auto &callback : this->callbacks_)
+      callback(args...);
+  }
+
+ protected:
+  std::vector<std::function<void(Ts...)>> callbacks_;
+};
+
+template<typename T> class Parented {
+ public:
+  Parented() = default;
+  Parented(T *parent) : parent_(parent) {}
+  T *get_parent() const { return this->parent_; }
+  void set_parent(T *parent) { this->parent_ = parent; }
+
+ protected:
+  T *parent_{nullptr};
+};
+
+// there is no PSRAM on the host, the flags only decide whether a failed allocation may return nullptr
+template<class T> class ExternalRAMAllocator {
+ public:
+  using value_type = T;
+  enum Flags { NONE = 0, REFUSE_INTERNAL = 1 << 0, ALLOW_FAILURE = 1 << 1 };
+
+  ExternalRAMAllocator() = default;
+  ExternalRAMAllocator(Flags flags) : flags_(flags) {}
+
+  T *allocate(size_t n) {
+    auto *ptr = static_cast<T *>(std::malloc(n * sizeof(T)));
+    if (ptr == nullptr && (this->flags_ & ALLOW_FAILURE) == 0)
+      std::abort();
+    return ptr;
+  }
+  void deallocate(T *p, size_t n) { std::free(p); }
+
+ private:
+  Flags flags_{NONE};
+};
+
+}  // namespace esphome